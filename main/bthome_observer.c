@@ -4,6 +4,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "bthome.h"
 #include "bthome_ble.h"
@@ -11,28 +12,34 @@
 #include "http_server.h"
 #include "bthome_observer.h"
 #include "sensors.h"
+#include "tracked_mutex.h"
 
 static const char *TAG = "bthome_observer";
 extern bool g_ntp_initialized;
 
 #define CACHE_SIZE 10
-#define MAX_BTHOME_SENSORS 50
 
 #define BTHOME_SENSOR_TEMPERATURE_F 0xF1  // Custom ID for Fahrenheit temperature
 
-// BTHome sensor mapping for integration with sensor system
-typedef struct {
-    esp_bd_addr_t addr;
-    uint8_t object_id;
-    int sensor_id;
-    bool registered;
-} bthome_sensor_mapping_t;
+// BTHome devices advertise anywhere from every few seconds to every few
+// minutes, and some only on change; tolerate a few missed intervals
+#define BTHOME_SENSOR_TIMEOUT_SECONDS 300
 
-static bthome_sensor_mapping_t bthome_sensor_map[MAX_BTHOME_SENSORS];
-static int bthome_sensor_count = 0;
-static SemaphoreHandle_t sensor_map_mutex = NULL;
 static settings_t *g_settings = NULL;
 
+// Ingestion counters. Packets arrive on the BLE task and /metrics reads them
+// on the httpd task; the spinlock keeps snapshots consistent.
+static bthome_stats_t stats;
+static bthome_device_stats_t device_stats[BTHOME_DEVICE_STATS_MAX];
+static int device_stats_count = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define STATS_INC(field) do {           \
+    taskENTER_CRITICAL(&stats_lock);    \
+    stats.field++;                      \
+    taskEXIT_CRITICAL(&stats_lock);     \
+} while (0)
+
 // Compare two MAC addresses
 static bool mac_equal(const esp_bd_addr_t a, const esp_bd_addr_t b) {
     return memcmp(a, b, 6) == 0;
@@ -83,7 +90,7 @@ typedef struct {
 
 // LFU Cache
 static cache_entry_t packet_cache[CACHE_SIZE];
-static SemaphoreHandle_t cache_mutex = NULL;
+static tracked_mutex_t *cache_mutex = NULL;
 
 // Find the LFU entry to evict (lowest frequency, oldest if tie)
 static int find_lfu_entry(void) {
@@ -123,16 +130,21 @@ static void cache_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *pa
         return;
     }
     
-    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    tracked_mutex_take(cache_mutex, portMAX_DELAY);
     struct timeval now;
     if (gettimeofday(&now, NULL) != 0) {
         ESP_LOGE(TAG, "Failed to get current time");
-        xSemaphoreGive(cache_mutex);
+        tracked_mutex_give(cache_mutex);
         return;
     }
     
     // Check if MAC already exists
     int idx = find_entry_by_mac(addr);
+    if (idx >= 0) {
+        STATS_INC(cache_hits);
+    } else {
+        STATS_INC(cache_misses);
+    }
     
     if (idx >= 0) {
         // Update existing entry
@@ -144,6 +156,7 @@ static void cache_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *pa
             packet_cache[idx].last_seen = now;
         } else {
             ESP_LOGE(TAG, "Failed to copy packet for cache update");
+            STATS_INC(cache_errors);
         }
     } else {
         // Find slot to use (LFU eviction)
@@ -152,6 +165,7 @@ static void cache_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *pa
         if (idx >= 0) {
             if (packet_cache[idx].occupied) {
                 bthome_packet_free(&packet_cache[idx].packet);
+                STATS_INC(cache_evictions);
             }
             
             bthome_packet_init(&packet_cache[idx].packet);
@@ -163,11 +177,12 @@ static void cache_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *pa
                 packet_cache[idx].occupied = true;
             } else {
                 ESP_LOGE(TAG, "Failed to copy packet for new cache entry");
+                STATS_INC(cache_errors);
             }
         }
     }
     
-    xSemaphoreGive(cache_mutex);
+    tracked_mutex_give(cache_mutex);
 }
 
 // HTTP handler for displaying cached packets
@@ -177,7 +192,7 @@ static esp_err_t bthome_packets_handler(httpd_req_t *req) {
         return ESP_FAIL;
     }
     
-    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    tracked_mutex_take(cache_mutex, portMAX_DELAY);
     
     // Start HTML response
     httpd_resp_set_type(req, "text/html");
@@ -327,39 +342,17 @@ static esp_err_t bthome_packets_handler(httpd_req_t *req) {
     httpd_resp_sendstr_chunk(req, "</body></html>");
     httpd_resp_sendstr_chunk(req, NULL);  // End chunked response
     
-    xSemaphoreGive(cache_mutex);
+    tracked_mutex_give(cache_mutex);
     return ESP_OK;
 }
 
-// Find or register a BTHome sensor in the sensor system
-static int find_or_register_bthome_sensor(esp_bd_addr_t addr, uint8_t object_id) {
-    if (sensor_map_mutex == NULL) {
-        return -1;
-    }
-    
-    // Check if this MAC is enabled in settings
-    char device_name[32];
-    if (!is_mac_enabled(addr, device_name, sizeof(device_name))) {
-        return -1;  // MAC not in enabled filters
-    }
-    
-    xSemaphoreTake(sensor_map_mutex, portMAX_DELAY);
-    
-    // Check if already registered
-    for (int i = 0; i < bthome_sensor_count; i++) {
-        if (mac_equal(bthome_sensor_map[i].addr, addr) && 
-            bthome_sensor_map[i].object_id == object_id) {
-            int sensor_id = bthome_sensor_map[i].sensor_id;
-            xSemaphoreGive(sensor_map_mutex);
-            return sensor_id;
-        }
-    }
-    
-    // Not found, register new sensor
-    if (bthome_sensor_count >= MAX_BTHOME_SENSORS) {
-        ESP_LOGW(TAG, "Maximum BTHome sensors reached (%d)", MAX_BTHOME_SENSORS);
-        xSemaphoreGive(sensor_map_mutex);
-        return -1;
+// Find or register a BTHome sensor in the sensor system, keyed by (MAC, object ID).
+// device_name is the configured name for an enabled MAC (may be empty).
+static int find_or_register_bthome_sensor(esp_bd_addr_t addr, uint8_t object_id, const char *device_name) {
+    sensor_key_t key = sensor_key_from_mac(addr, object_id);
+    int sensor_id = sensors_find(key);
+    if (sensor_id >= 0) {
+        return sensor_id;
     }
     
     const char *type_name = bthome_get_object_name(object_id);
@@ -426,7 +419,8 @@ static int find_or_register_bthome_sensor(esp_bd_addr_t addr, uint8_t object_id)
              addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
 
     // Register with sensor system
-    int sensor_id = sensors_register(
+    sensor_id = sensors_register_with_key(
+        key,
         sensor_name, // Don't set a display name for the C value if temp_use_fahrenheit is true
         unit ? unit : "",
         metric_name,
@@ -434,26 +428,77 @@ static int find_or_register_bthome_sensor(esp_bd_addr_t addr, uint8_t object_id)
         addr_str);
     if (sensor_id < 0) {
         ESP_LOGE(TAG, "Failed to register BTHome sensor: %s", sensor_name);
-        xSemaphoreGive(sensor_map_mutex);
         return -1;
     }
     
-    // Store mapping
-    memcpy(bthome_sensor_map[bthome_sensor_count].addr, addr, 6);
-    bthome_sensor_map[bthome_sensor_count].object_id = object_id;
-    bthome_sensor_map[bthome_sensor_count].sensor_id = sensor_id;
-    bthome_sensor_map[bthome_sensor_count].registered = true;
-    bthome_sensor_count++;
+    sensors_set_timeout(sensor_id, BTHOME_SENSOR_TIMEOUT_SECONDS);
+    sensors_set_producer(sensor_id, SENSOR_PRODUCER_BTHOME);
+    
     ESP_LOGI(TAG, "Registered BTHome sensor: %s (ID %d)", sensor_name, sensor_id);
-   
-    xSemaphoreGive(sensor_map_mutex);
     return sensor_id;
 }
 
+// Track RSSI and packet loss of an enabled device. BTHome packet IDs count
+// up by one per new reading, and each reading is usually advertised several
+// times, so repeats are duplicates and skipped IDs were lost.
+static void record_device_packet(const esp_bd_addr_t addr, const char *name, int rssi,
+                                 const bthome_packet_t *packet) {
+    taskENTER_CRITICAL(&stats_lock);
+    bthome_device_stats_t *device = NULL;
+    for (int i = 0; i < device_stats_count; i++) {
+        if (mac_equal(device_stats[i].addr, addr)) {
+            device = &device_stats[i];
+            break;
+        }
+    }
+    if (device == NULL && device_stats_count < BTHOME_DEVICE_STATS_MAX) {
+        device = &device_stats[device_stats_count++];
+        memcpy(device->addr, addr, sizeof(esp_bd_addr_t));
+        device->last_packet_id = -1;
+    }
+    if (device != NULL) {
+        strncpy(device->name, name, sizeof(device->name) - 1);
+        device->name[sizeof(device->name) - 1] = '\0';
+        device->rssi = rssi;
+        device->packets++;
+        if (packet->has_packet_id) {
+            if (device->last_packet_id >= 0) {
+                uint8_t step = (uint8_t)(packet->packet_id - device->last_packet_id);
+                if (step == 0) {
+                    device->duplicates++;
+                } else if (step < 128) {
+                    // Larger steps are a restart or reordering, not loss
+                    device->lost += step - 1;
+                }
+            }
+            device->last_packet_id = packet->packet_id;
+        }
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+static void bthome_process_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *packet);
+
 static void bthome_packet_callback(esp_bd_addr_t addr, int rssi, 
                                     const bthome_packet_t *packet, void *user_data) {
+    int64_t start_us = esp_timer_get_time();
+    STATS_INC(advertisements);
+    bthome_process_packet(addr, rssi, packet);
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.callback_count++;
+    stats.callback_us += elapsed_us;
+    if (elapsed_us > stats.callback_max_us) {
+        stats.callback_max_us = elapsed_us;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+static void bthome_process_packet(esp_bd_addr_t addr, int rssi, const bthome_packet_t *packet) {
     if (g_ntp_initialized == false) {
         ESP_LOGW(TAG, "NTP time not synchronized yet, ignoring BTHome packet");
+        STATS_INC(rejected_no_time);
         return;
     }
     
@@ -468,7 +513,14 @@ static void bthome_packet_callback(esp_bd_addr_t addr, int rssi,
     ESP_LOGI(TAG, "BTHome packet from %s (RSSI: %d dBm)", mac_str, rssi);
     
     // Register and update sensors for all measurements (filtered by settings)
-    for (size_t i = 0; i < packet->measurement_count; i++) {
+    char device_name[32];
+    bool mac_enabled = is_mac_enabled(addr, device_name, sizeof(device_name));
+    if (mac_enabled) {
+        record_device_packet(addr, device_name, rssi, packet);
+    } else {
+        STATS_INC(filtered);
+    }
+    for (size_t i = 0; mac_enabled && i < packet->measurement_count; i++) {
         if(!is_object_id_selected(packet->measurements[i].object_id)) {
             continue;
         }
@@ -485,7 +537,7 @@ static void bthome_packet_callback(esp_bd_addr_t addr, int rssi,
         if (is_temperature && g_settings && g_settings->temp_use_fahrenheit) {
             float f_value = value * 9.0f / 5.0f + 32.0f;
             // Find or register this sensor (only if MAC and object_id are enabled in settings)
-            int sensor_id = find_or_register_bthome_sensor(addr, BTHOME_SENSOR_TEMPERATURE_F);
+            int sensor_id = find_or_register_bthome_sensor(addr, BTHOME_SENSOR_TEMPERATURE_F, device_name);
             if (sensor_id >= 0) {
                 // Update sensor value
                 sensors_update(sensor_id, f_value, true);
@@ -493,7 +545,7 @@ static void bthome_packet_callback(esp_bd_addr_t addr, int rssi,
         }
         
         // Find or register this sensor (only if MAC and object_id are enabled in settings)
-        int sensor_id = find_or_register_bthome_sensor(addr, m->object_id);
+        int sensor_id = find_or_register_bthome_sensor(addr, m->object_id, device_name);
         if (sensor_id >= 0) {
             // Update sensor value
             sensors_update(sensor_id, value, true);
@@ -589,21 +641,12 @@ void bthome_observer_init(settings_t *settings, httpd_handle_t server) {
     
     // Initialize cache
     memset(packet_cache, 0, sizeof(packet_cache));
-    cache_mutex = xSemaphoreCreateMutex();
+    cache_mutex = tracked_mutex_create("bthome_cache");
     if (cache_mutex == NULL) {
         ESP_LOGE(TAG, "Failed to create cache mutex");
         return;
     }
     
-    // Initialize BTHome sensor mapping
-    memset(bthome_sensor_map, 0, sizeof(bthome_sensor_map));
-    bthome_sensor_count = 0;
-    sensor_map_mutex = xSemaphoreCreateMutex();
-    if (sensor_map_mutex == NULL) {
-        ESP_LOGE(TAG, "Failed to create sensor map mutex");
-        return;
-    }
-    
     // Initialize NVS (required for BLE)
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -666,7 +709,7 @@ void bthome_cache_iterate(bthome_cache_iterator_t callback, void *user_data) {
         return;
     }
     
-    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    tracked_mutex_take(cache_mutex, portMAX_DELAY);
     
     for (int i = 0; i < CACHE_SIZE; i++) {
         if (packet_cache[i].occupied) {
@@ -684,5 +727,22 @@ void bthome_cache_iterate(bthome_cache_iterator_t callback, void *user_data) {
         }
     }
     
-    xSemaphoreGive(cache_mutex);
+    tracked_mutex_give(cache_mutex);
+}
+
+void bthome_get_stats(bthome_stats_t *out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+bool bthome_get_device_stats(int index, bthome_device_stats_t *out) {
+    bool found = false;
+    taskENTER_CRITICAL(&stats_lock);
+    if (index >= 0 && index < device_stats_count) {
+        *out = device_stats[index];
+        found = true;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    return found;
 }
@@ -10,6 +10,48 @@
 
 void bthome_observer_init(settings_t *settings, httpd_handle_t server);
 
+// Devices whose reception is tracked; only MACs enabled in mac_filters count
+#define BTHOME_DEVICE_STATS_MAX 32
+
+typedef struct {
+    uint32_t advertisements;    // BTHome packets passed to the callback
+    uint32_t rejected_no_time;  // Dropped because NTP hadn't synced yet
+    uint32_t filtered;          // From MACs not enabled in mac_filters
+    uint32_t cache_hits;        // Packets from a MAC already in the packet cache
+    uint32_t cache_misses;
+    uint32_t cache_evictions;   // Cache entries replaced by another MAC
+    uint32_t cache_errors;      // Packets that failed to copy into the cache
+    uint32_t callback_count;
+    uint64_t callback_us;       // Time spent in the packet callback
+    uint32_t callback_max_us;
+} bthome_stats_t;
+
+typedef struct {
+    esp_bd_addr_t addr;
+    char name[32];              // Name from mac_filters
+    int rssi;                   // RSSI of the last packet
+    uint32_t packets;
+    uint32_t duplicates;        // Packets repeating the previous packet ID
+    uint32_t lost;              // Packet IDs skipped
+    int16_t last_packet_id;     // -1 until a packet with an ID is seen
+} bthome_device_stats_t;
+
+/**
+ * @brief Get a consistent snapshot of the ingestion counters
+ *
+ * @param stats Receives the counters
+ */
+void bthome_get_stats(bthome_stats_t *stats);
+
+/**
+ * @brief Get reception statistics of one tracked device
+ *
+ * @param index Device index, from 0
+ * @param stats Receives the statistics
+ * @return true if index names a device
+ */
+bool bthome_get_device_stats(int index, bthome_device_stats_t *stats);
+
 // Callback function type for iterating cached packets
 // Returns true to continue iteration, false to stop
 typedef bool (*bthome_cache_iterator_t)(const esp_bd_addr_t addr, int rssi, 
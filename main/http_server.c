@@ -1,13 +1,18 @@
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_http_server.h>
 #include "esp_check.h"
 #include "esp_tls_crypto.h"
 #include "esp_tls.h"
 #include "settings.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
+#include "http_server.h"
 
 
 // Shamelessly borrowed from https://github.com/espressif/esp-idf/blob/v5.5.1/examples/protocols/http_server/simple/main/main.c
@@ -20,8 +25,21 @@ typedef struct {
     void *user_ctx;
 } basic_auth_wrap_t;
 
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+    http_uri_stats_t stats;
+} http_uri_wrap_t;
+
 #define HTTPD_401      "401 UNAUTHORIZED"           /*!< HTTP Response 401 */
 
+const double http_latency_buckets_seconds[HTTP_LATENCY_BUCKETS] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+static http_uri_wrap_t uri_wraps[HTTP_SERVER_MAX_URI_HANDLERS];
+static int uri_wrap_count = 0;
+
 static char *http_auth_basic(const char *username, const char *password)
 {
     size_t out;
@@ -38,21 +56,19 @@ static char *http_auth_basic(const char *username, const char *password)
         ESP_LOGE(TAG, "No enough memory for user information");
         return NULL;
     }
-    atomic_fetch_add(&malloc_count_http_server, 1); //asprintf for user_info
+    tracked_adopt(ALLOC_HTTP_SERVER, user_info);
     esp_crypto_base64_encode(NULL, 0, &n, (const unsigned char *)user_info, strlen(user_info));
 
     /* 6: The length of the "Basic " string
      * n: Number of bytes for a base64 encode format
      * 1: Number of bytes for a reserved which be used to fill zero
     */
-    digest = calloc(1, 6 + n + 1);
-    atomic_fetch_add(&malloc_count_http_server, 1);
+    digest = tracked_calloc(ALLOC_HTTP_SERVER, 1, 6 + n + 1);
     if (digest) {
         strcpy(digest, "Basic ");
         esp_crypto_base64_encode((unsigned char *)digest + 6, n, &out, (const unsigned char *)user_info, strlen(user_info));
     }
-    free(user_info);
-    atomic_fetch_add(&free_count_http_server, 1);
+    tracked_free(ALLOC_HTTP_SERVER, user_info);
     return digest;
 }
 
@@ -66,8 +82,7 @@ static esp_err_t basic_auth_get_handler(httpd_req_t *req)
 
     buf_len = httpd_req_get_hdr_value_len(req, "Authorization") + 1;
     if (buf_len > 1) {
-        buf = calloc(1, buf_len);
-        atomic_fetch_add(&malloc_count_http_server, 1);
+        buf = tracked_calloc(ALLOC_HTTP_SERVER, 1, buf_len);
         if (!buf) {
             ESP_LOGE(TAG, "No enough memory for basic authorization");
             return ESP_ERR_NO_MEM;
@@ -85,8 +100,7 @@ static esp_err_t basic_auth_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "password: %s", wrapper->settings->password);
         if (!auth_credentials) {
             ESP_LOGE(TAG, "No enough memory for basic authorization credentials");
-            free(buf);
-            atomic_fetch_add(&free_count_http_server, 1);
+            tracked_free(ALLOC_HTTP_SERVER, buf);
             return ESP_ERR_NO_MEM;
         }
 
@@ -99,16 +113,12 @@ static esp_err_t basic_auth_get_handler(httpd_req_t *req)
         } else {
             ESP_LOGI(TAG, "Authenticated!");
             req->user_ctx = wrapper->user_ctx;
-            free(auth_credentials);
-            atomic_fetch_add(&free_count_http_server, 1);
-            free(buf);
-            atomic_fetch_add(&free_count_http_server, 1);
+            tracked_free(ALLOC_HTTP_SERVER, auth_credentials);
+            tracked_free(ALLOC_HTTP_SERVER, buf);
             return wrapper->handler(req);
         }
-        free(auth_credentials);
-        atomic_fetch_add(&free_count_http_server, 1);
-        free(buf);
-        atomic_fetch_add(&free_count_http_server, 1);
+        tracked_free(ALLOC_HTTP_SERVER, auth_credentials);
+        tracked_free(ALLOC_HTTP_SERVER, buf);
     } else {
         ESP_LOGE(TAG, "No auth header received");
         httpd_resp_set_status(req, HTTPD_401);
@@ -124,8 +134,7 @@ esp_err_t httpd_register_uri_handler_with_basic_auth(void *settings_ptr, httpd_h
 {
     settings_t *settings = (settings_t *)settings_ptr;
     ESP_LOGI(TAG, "httpd_register_uri_handler_with_basic_auth settings ptr %p", settings);
-    basic_auth_wrap_t *wrapper = malloc(sizeof(basic_auth_wrap_t));
-    atomic_fetch_add(&malloc_count_http_server, 1);
+    basic_auth_wrap_t *wrapper = tracked_malloc(ALLOC_HTTP_SERVER, sizeof(basic_auth_wrap_t));
     if (!wrapper) {
         ESP_LOGE(TAG, "No enough memory for basic auth wrapper");
         return ESP_ERR_NO_MEM;
@@ -135,19 +144,122 @@ esp_err_t httpd_register_uri_handler_with_basic_auth(void *settings_ptr, httpd_h
     wrapper->user_ctx = uri_handler->user_ctx;
     wrapper->settings = settings;
 
-    httpd_uri_t *wrapped_uri_handler = malloc(sizeof(httpd_uri_t));
-    atomic_fetch_add(&malloc_count_http_server, 1);
+    httpd_uri_t *wrapped_uri_handler = tracked_malloc(ALLOC_HTTP_SERVER, sizeof(httpd_uri_t));
     if (!wrapped_uri_handler) {
         ESP_LOGE(TAG, "No enough memory for wrapped URI handler");
-        free(wrapper);
-        atomic_fetch_add(&free_count_http_server, 1);
+        tracked_free(ALLOC_HTTP_SERVER, wrapper);
         return ESP_ERR_NO_MEM;
     }
     memcpy(wrapped_uri_handler, uri_handler, sizeof(httpd_uri_t));
     wrapped_uri_handler->user_ctx = wrapper;
     wrapped_uri_handler->handler = basic_auth_get_handler;
 
-    return httpd_register_uri_handler(server, wrapped_uri_handler);
+    return http_server_register_uri_handler(server, wrapped_uri_handler);
+}
+
+// Same as the default httpd send
+static int http_plain_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    int ret = send(sockfd, buf, buf_len, flags);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return HTTPD_SOCK_ERR_TIMEOUT;
+        }
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    return ret;
+}
+
+// Plus counting bytes against the stats in the session's transport context,
+// set only while the httpd task runs the session's handler
+static int http_counting_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    int ret = http_plain_send(hd, sockfd, buf, buf_len, flags);
+    http_uri_stats_t *stats = httpd_sess_get_transport_ctx(hd, sockfd);
+    if (ret > 0 && stats != NULL) {
+        stats->bytes += ret;
+    }
+    return ret;
+}
+
+// The stats live in uri_wraps, so the session has nothing to free
+static void http_stats_ctx_free(void *ctx)
+{
+}
+
+static void http_count_session(httpd_req_t *req, http_uri_stats_t *stats)
+{
+    int sockfd = httpd_req_to_sockfd(req);
+    httpd_sess_set_transport_ctx(req->handle, sockfd, stats, http_stats_ctx_free);
+    httpd_sess_set_send_override(req->handle, sockfd, stats != NULL ? http_counting_send : http_plain_send);
+}
+
+esp_err_t http_server_req_async_begin(httpd_req_t *req, httpd_req_t **out)
+{
+    // The async request sends from other tasks, which mustn't touch stats
+    http_count_session(req, NULL);
+    return httpd_req_async_handler_begin(req, out);
+}
+
+static esp_err_t http_timed_handler(httpd_req_t *req)
+{
+    http_uri_wrap_t *wrap = req->user_ctx;
+    http_uri_stats_t *stats = &wrap->stats;
+    req->user_ctx = wrap->user_ctx;
+
+    http_count_session(req, stats);
+
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = wrap->handler(req);
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    // Stop counting; the session may already have been handed to another task
+    http_count_session(req, NULL);
+
+    stats->count++;
+    stats->total_us += elapsed_us;
+    int bucket = 0;
+    while (bucket < HTTP_LATENCY_BUCKETS && elapsed_us > http_latency_buckets_seconds[bucket] * 1000000) {
+        bucket++;
+    }
+    stats->buckets[bucket]++;
+    if (elapsed_us > 1000000) {
+        ESP_LOGW(TAG, "%s %s took %" PRId64 " ms", http_method_str(req->method), stats->uri, elapsed_us / 1000);
+    }
+    return err;
+}
+
+esp_err_t http_server_register_uri_handler(httpd_handle_t server, const httpd_uri_t *uri_handler)
+{
+    if (uri_wrap_count >= HTTP_SERVER_MAX_URI_HANDLERS) {
+        ESP_LOGE(TAG, "No free URI handler slot for %s", uri_handler->uri);
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    http_uri_wrap_t *wrap = &uri_wraps[uri_wrap_count];
+    memset(wrap, 0, sizeof(http_uri_wrap_t));
+    wrap->handler = uri_handler->handler;
+    wrap->user_ctx = uri_handler->user_ctx;
+    wrap->stats.uri = uri_handler->uri;
+    wrap->stats.method = uri_handler->method;
+
+    // httpd copies the struct, so this can live on the stack
+    httpd_uri_t timed_uri_handler = *uri_handler;
+    timed_uri_handler.handler = http_timed_handler;
+    timed_uri_handler.user_ctx = wrap;
+
+    esp_err_t err = httpd_register_uri_handler(server, &timed_uri_handler);
+    if (err == ESP_OK) {
+        uri_wrap_count++;
+    }
+    return err;
+}
+
+const http_uri_stats_t *http_server_get_uri_stats(int index)
+{
+    if (index < 0 || index >= uri_wrap_count) {
+        return NULL;
+    }
+    return &uri_wraps[index].stats;
 }
 
 httpd_handle_t http_server_init(void)
@@ -155,7 +267,10 @@ httpd_handle_t http_server_init(void)
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.lru_purge_enable = true;
-    config.max_uri_handlers = 16;
+    config.max_uri_handlers = HTTP_SERVER_MAX_URI_HANDLERS;
+    // Long-polls and event streams each hold a socket open; needs
+    // CONFIG_LWIP_MAX_SOCKETS >= max_open_sockets + 3
+    config.max_open_sockets = 10;
     
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
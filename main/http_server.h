@@ -1,10 +1,64 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
+#include <stdint.h>
 #include <esp_http_server.h>
 
+#define HTTP_SERVER_MAX_URI_HANDLERS 20
+
+// Upper bounds of the handler latency histogram buckets; a final +Inf bucket
+// catches the rest
+#define HTTP_LATENCY_BUCKETS 11
+extern const double http_latency_buckets_seconds[HTTP_LATENCY_BUCKETS];
+
+// Per URI+method request statistics. Only the httpd task updates or reads
+// these, so they're unlocked.
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    uint32_t count;
+    uint64_t bytes;                             // Response bytes, headers included
+    uint64_t total_us;                          // Time spent in the handler
+    uint32_t buckets[HTTP_LATENCY_BUCKETS + 1]; // Non-cumulative; last is +Inf
+} http_uri_stats_t;
+
 httpd_handle_t http_server_init();
 
+/**
+ * @brief Register a URI handler, recording its latency, request count and response bytes
+ *
+ * Handlers that hand the request off must use http_server_req_async_begin,
+ * and are only timed until they return; bytes sent from other tasks aren't
+ * counted.
+ *
+ * @param server HTTP server handle
+ * @param uri_handler URI handler; the uri string must outlive the server
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t http_server_register_uri_handler(httpd_handle_t server, const httpd_uri_t *uri_handler);
+
+/**
+ * @brief Hand a request off to another task, as httpd_req_async_handler_begin
+ *
+ * Also stops counting the session's response bytes, which the other task
+ * would otherwise update concurrently with the httpd task.
+ *
+ * @param req Request passed to the handler
+ * @param out Copy of the request for the other task
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t http_server_req_async_begin(httpd_req_t *req, httpd_req_t **out);
+
 esp_err_t httpd_register_uri_handler_with_basic_auth(void *settings, httpd_handle_t handle, httpd_uri_t *uri_handler);
 
-#endif // HTTP_SERVER_H
\ No newline at end of file
+/**
+ * @brief Get the statistics of a registered URI handler
+ *
+ * Must be called from an HTTP handler.
+ *
+ * @param index Registration index, starting at 0
+ * @return const http_uri_stats_t* Statistics, or NULL past the last handler
+ */
+const http_uri_stats_t *http_server_get_uri_stats(int index);
+
+#endif // HTTP_SERVER_H
@@ -14,6 +14,8 @@
 #include "settings.h"
 #include "http_server.h"
 #include "metrics.h"
+#include "remote_write.h"
+#include "tracked_alloc.h"
 #include "mqtt_publisher.h"
 #include <esp_log.h>
 #include "bthome_observer.h"
@@ -22,6 +24,7 @@
 #include "driver/i2c_master.h"
 #include "pump.h"
 #include "syslog.h"
+#include "task_stats.h"
 
 bool g_ntp_initialized = false;
 
@@ -36,9 +39,9 @@ void app_main(void)
     ESP_ERROR_CHECK(ret);
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    task_stats_init();
     
-    settings_t *settings = malloc(sizeof(settings_t));
-    atomic_fetch_add(&malloc_count_main, 1);
+    settings_t *settings = tracked_malloc(ALLOC_MAIN, sizeof(settings_t));
     ESP_LOGI("main", "app_main settings ptr %p", settings);
 
     ESP_ERROR_CHECK(settings_init(settings));
@@ -68,4 +71,7 @@ void app_main(void)
     
     ota_init(settings, http_server);
     metrics_init(settings, http_server);
+    if (!ota_mode) {
+        remote_write_init(settings, http_server);
+    }
 }
@@ -1,50 +1,269 @@
 #include "metrics.h"
 #include "wifi.h"
 #include "sensors.h"
+#include "mqtt_publisher.h"
+#include "string_pool.h"
+#include "metrics_writer.h"
+#include "http_server.h"
+#include "task_stats.h"
+#include "bthome_observer.h"
+#include "tracked_alloc.h"
+#include "tracked_mutex.h"
+#include "remote_write.h"
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <esp_heap_caps.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
 #include <sys/time.h>
 
 static const char *TAG = "metrics";
 
-// Define atomic malloc counters
-atomic_uint_fast32_t malloc_count_settings = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_metrics = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_sensors = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_pump = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_main = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_http_server = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_syslog = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t malloc_count_mqtt_publisher = ATOMIC_VAR_INIT(0);
-
-// Define atomic free counters
-atomic_uint_fast32_t free_count_settings = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_metrics = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_sensors = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_pump = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_main = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_http_server = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_syslog = ATOMIC_VAR_INIT(0);
-atomic_uint_fast32_t free_count_mqtt_publisher = ATOMIC_VAR_INIT(0);
+// Pre-rendered exposition for sensor series. Names, units and labels only
+// change when sensors register, so each family's HELP/TYPE block and each
+// series' "name{labels}" prefix are rendered once into cache_text, and scrapes
+// only format values. Only the httpd task touches the cache.
+#define METRICS_CACHE_INITIAL_SIZE 2048
+#define METRICS_HOSTNAME_MAX_LEN 64    // Longer hostnames rebuild on every scrape
 
-static esp_err_t metrics_handler(httpd_req_t *req) {
-    settings_t *settings = (settings_t *)req->user_ctx;
+typedef struct {
+    uint16_t header_offset;     // HELP/TYPE block opening a family
+    uint16_t header_len;        // 0 if the series continues the previous family
+    uint16_t help_offset;       // Help text within the header, for protobuf
+    uint16_t help_len;
+    uint16_t prefix_offset;     // "name{labels}"; the name is also used for protobuf
+    uint16_t prefix_len;
+    uint8_t name_len;
+    uint8_t sensor_id;
+} metrics_series_t;
+
+static char *cache_text = NULL;
+static size_t cache_text_size = 0;
+static size_t cache_text_used = 0;
+static metrics_series_t cache_series[MAX_SENSORS];
+static int cache_series_count = 0;
+static bool cache_valid = false;
+static uint32_t cache_meta_generation = 0;
+static int cache_sensor_count = 0;
+static char cache_hostname[METRICS_HOSTNAME_MAX_LEN];
+
+// Scrape timing and size. Render time excludes time spent sending, to show
+// what the cache saves.
+static uint32_t render_count = 0;
+static uint64_t render_total_us = 0;
+static uint32_t render_max_us = 0;
+static uint64_t scrape_total_us = 0;
+static uint32_t scrape_max_us = 0;
+static size_t scrape_last_bytes = 0;
+static size_t scrape_max_bytes = 0;
+static uint32_t cache_rebuilds = 0;
+
+// Append to cache_text, growing it as needed. Returns false if out of memory.
+static bool cache_appendf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static bool cache_appendf(const char *fmt, ...) {
+    while (1) {
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(cache_text + cache_text_used, cache_text_size - cache_text_used, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return false;
+        }
+        if (cache_text_used + len < cache_text_size) {
+            cache_text_used += len;
+            return true;
+        }
+        size_t new_size = cache_text_size * 2;
+        if (new_size > UINT16_MAX) {
+            return false;
+        }
+        char *grown = tracked_realloc(ALLOC_METRICS, cache_text, new_size);
+        if (grown == NULL) {
+            return false;
+        }
+        cache_text = grown;
+        cache_text_size = new_size;
+    }
+}
+
+// Append a label value, escaped as the exposition format requires
+static bool cache_append_label_value(const char *value) {
+    for (const char *p = value; *p; p++) {
+        bool ok;
+        if (*p == '\\' || *p == '"') {
+            ok = cache_appendf("\\%c", *p);
+        } else if (*p == '\n') {
+            ok = cache_appendf("\\n");
+        } else {
+            ok = cache_appendf("%c", *p);
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool metrics_cache_add_series(const sensor_data_t *sensor, int sensor_id, bool new_family, const char *hostname) {
+    metrics_series_t *series = &cache_series[cache_series_count];
+    series->sensor_id = (uint8_t)sensor_id;
+    series->header_len = 0;
     
-    // Allocate larger buffer for BTHome metrics
-    size_t response_size = 8192;
-    char *response = malloc(response_size);
-    atomic_fetch_add(&malloc_count_metrics, 1);
-    if (response == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for metrics response");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    if (new_family) {
+        size_t start = cache_text_used;
+        if (!cache_appendf("# HELP %s ", sensor->metric_name)) {
+            return false;
+        }
+        size_t help_start = cache_text_used;
+        if (!cache_appendf("%s", sensor->display_name) ||
+            (sensor->unit[0] != '\0' && !cache_appendf(" in %s", sensor->unit))) {
+            return false;
+        }
+        series->help_offset = (uint16_t)help_start;
+        series->help_len = (uint16_t)(cache_text_used - help_start);
+        if (!cache_appendf("\n# TYPE %s gauge\n", sensor->metric_name)) {
+            return false;
+        }
+        series->header_offset = (uint16_t)start;
+        series->header_len = (uint16_t)(cache_text_used - start);
     }
     
-    int offset = 0;
+    size_t start = cache_text_used;
+    if (!cache_appendf("%s{hostname=\"", sensor->metric_name) || !cache_append_label_value(hostname)) {
+        return false;
+    }
+    if (sensor->device_name[0] != '\0' &&
+        (!cache_appendf("\",device_name=\"") || !cache_append_label_value(sensor->device_name))) {
+        return false;
+    }
+    if (sensor->device_id[0] != '\0' &&
+        (!cache_appendf("\",device_id=\"") || !cache_append_label_value(sensor->device_id))) {
+        return false;
+    }
+    if (!cache_appendf("\"}")) {
+        return false;
+    }
+    series->prefix_offset = (uint16_t)start;
+    series->prefix_len = (uint16_t)(cache_text_used - start);
+    series->name_len = (uint8_t)strlen(sensor->metric_name);
+    cache_series_count++;
+    return true;
+}
+
+// Rebuild the cache if sensors were added or renamed, or the hostname changed
+static bool metrics_cache_refresh(const char *hostname) {
+    uint32_t generation = sensors_get_meta_generation();
+    int sensor_count = sensors_get_count();
+    if (cache_valid && generation == cache_meta_generation && sensor_count == cache_sensor_count &&
+        strcmp(hostname, cache_hostname) == 0) {
+        return true;
+    }
+    
+    if (cache_text == NULL) {
+        cache_text = tracked_malloc(ALLOC_METRICS, METRICS_CACHE_INITIAL_SIZE);
+        if (cache_text == NULL) {
+            return false;
+        }
+        cache_text_size = METRICS_CACHE_INITIAL_SIZE;
+    }
+    cache_text_used = 0;
+    cache_text[0] = '\0';
+    cache_series_count = 0;
+    cache_valid = false;
+    
+    // Group series by metric name so each family gets one HELP/TYPE block.
+    // Names are interned, so equal names share a pointer.
+    bool grouped[MAX_SENSORS] = {false};
+    for (int i = 0; i < sensor_count; i++) {
+        sensor_data_t family;
+        if (grouped[i] || !sensors_read_snapshot(i, &family) || family.metric_name[0] == '\0') {
+            continue;
+        }
+        if (!metrics_cache_add_series(&family, i, true, hostname)) {
+            ESP_LOGE(TAG, "Failed to build metrics cache");
+            return false;
+        }
+        for (int j = i + 1; j < sensor_count; j++) {
+            sensor_data_t sensor;
+            if (grouped[j] || !sensors_read_snapshot(j, &sensor) || sensor.metric_name != family.metric_name) {
+                continue;
+            }
+            grouped[j] = true;
+            if (!metrics_cache_add_series(&sensor, j, false, hostname)) {
+                ESP_LOGE(TAG, "Failed to build metrics cache");
+                return false;
+            }
+        }
+    }
     
+    snprintf(cache_hostname, sizeof(cache_hostname), "%s", hostname);
+    cache_meta_generation = generation;
+    cache_sensor_count = sensor_count;
+    cache_valid = true;
+    cache_rebuilds++;
+    return true;
+}
+
+// Render sensor series from the cache; only values and timestamps are formatted
+static void metrics_render_sensors(metrics_writer_t *w) {
+    for (int i = 0; i < cache_series_count; i++) {
+        const metrics_series_t *series = &cache_series[i];
+        sensor_data_t sensor;
+        if (!sensors_read_snapshot(series->sensor_id, &sensor)) {
+            continue;
+        }
+        bool has_value = sensor.available && sensor.updated_us > 0;
+        
+        if (w->format == METRICS_FORMAT_PROTOBUF || w->format == METRICS_FORMAT_REMOTE_WRITE) {
+            if (series->header_len > 0) {
+                metrics_family_pb(w, cache_text + series->prefix_offset, series->name_len,
+                                  cache_text + series->help_offset, series->help_len);
+            }
+            if (has_value) {
+                metrics_label_t labels[] = {
+                    { "hostname", w->hostname },
+                    { "device_name", sensor.device_name },
+                    { "device_id", sensor.device_id },
+                };
+                metrics_pb_gauge(w, labels, 3, sensor.value, sensor.last_updated_ms);
+            }
+            continue;
+        }
+        
+        metrics_write(w, cache_text + series->header_offset, series->header_len);
+        if (!has_value) {
+            continue;
+        }
+        
+        metrics_write(w, cache_text + series->prefix_offset, series->prefix_len);
+        // Timestamps are omitted until the clock is set. Prometheus text uses
+        // milliseconds, OpenMetrics seconds.
+        if (sensor.last_updated_ms <= 0) {
+            metrics_printf(w, " %.2f\n", sensor.value);
+        } else if (w->format == METRICS_FORMAT_OPENMETRICS) {
+            metrics_printf(w, " %.2f %" PRId64 ".%03d\n", sensor.value,
+                           sensor.last_updated_ms / 1000, (int)(sensor.last_updated_ms % 1000));
+        } else {
+            metrics_printf(w, " %.2f %" PRId64 "\n", sensor.value, sensor.last_updated_ms);
+        }
+    }
+}
+
+// Same form as the device_id label of BTHome sensor series
+static void metrics_format_mac(char *out, const uint8_t *addr) {
+    snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X",
+             addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+}
+
+static const char *metrics_hostname(settings_t *settings) {
+    return (settings->hostname != NULL && settings->hostname[0] != '\0')
+           ? settings->hostname : "weight-station";
+}
+
+// Render every metric family; the caller begins and ends the writer
+static void metrics_render(metrics_writer_t *w) {
     // Get uptime in seconds
     int64_t uptime_us = esp_timer_get_time();
     int64_t uptime_seconds = uptime_us / 1000000;
@@ -52,158 +271,445 @@ static esp_err_t metrics_handler(httpd_req_t *req) {
     // Get WiFi RSSI
     int8_t rssi = wifi_get_rssi();
     
-    // Get hostname for labels
-    const char *hostname = (settings->hostname != NULL && settings->hostname[0] != '\0') 
-                            ? settings->hostname : "weight-station";
+    // Sensor series from the pre-rendered cache
+    if (metrics_cache_refresh(w->hostname)) {
+        metrics_render_sensors(w);
+    }
+    
+    // WiFi RSSI metric
+    metrics_family(w, "wifi_rssi_dbm", METRIC_GAUGE, NULL, "WiFi signal strength in dBm");
+    if (rssi != 0) {
+        metrics_value(w, NULL, NULL, rssi);
+    }
+    
+    // Uptime metric
+    metrics_family(w, "uptime_seconds", METRIC_COUNTER, "seconds", "System uptime in seconds");
+    metrics_value(w, NULL, NULL, uptime_seconds);
+    
+    // Heap memory metrics
+    metrics_family(w, "heap_free_bytes", METRIC_GAUGE, "bytes", "Current free heap memory in bytes");
+    metrics_value(w, NULL, NULL, esp_get_free_heap_size());
+    metrics_family(w, "heap_min_free_bytes", METRIC_GAUGE, "bytes", "Minimum free heap memory ever reached in bytes");
+    metrics_value(w, NULL, NULL, esp_get_minimum_free_heap_size());
+    metrics_family(w, "heap_largest_free_block_bytes", METRIC_GAUGE, "bytes", "Largest contiguous free memory block in bytes");
+    metrics_value(w, NULL, NULL, heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+    
+    // Sensor publish policy metrics
+    uint32_t published, suppressed_deadband, suppressed_interval;
+    sensors_get_publish_stats(&published, &suppressed_deadband, &suppressed_interval);
+    metrics_family(w, "sensor_publish_total", METRIC_COUNTER, NULL, "Sensor updates pushed to MQTT");
+    metrics_value(w, NULL, NULL, published);
+    metrics_family(w, "sensor_publish_suppressed_total", METRIC_COUNTER, NULL, "Sensor updates not pushed due to publish policy");
+    metrics_value(w, "reason", "deadband", suppressed_deadband);
+    metrics_value(w, "reason", "min_interval", suppressed_interval);
     
-    // Build Prometheus text format response
+    // Sensor update event metrics
+    sensor_event_stats_t event_stats;
+    sensors_get_event_stats(&event_stats);
+    metrics_family(w, "sensor_events_total", METRIC_COUNTER, NULL, "Sensor update events by outcome");
+    metrics_value(w, "result", "enqueued", event_stats.enqueued);
+    metrics_value(w, "result", "coalesced", event_stats.coalesced);
+    metrics_value(w, "result", "dropped", event_stats.dropped);
+    metrics_value(w, "result", "dispatched", event_stats.dispatched);
+    metrics_family(w, "sensor_update_duration_seconds", METRIC_SUMMARY, "seconds", "Time producers spend in sensor updates");
+    metrics_summary(w, event_stats.update_count, event_stats.update_total_us / 1e6);
+    metrics_family(w, "sensor_update_duration_max_seconds", METRIC_GAUGE, "seconds", "Longest time a producer spent in a sensor update");
+    metrics_value(w, NULL, NULL, event_stats.update_max_us / 1e6);
+    metrics_family(w, "sensor_stale_total", METRIC_COUNTER, NULL, "Sensors marked unavailable for missing their update deadline");
+    metrics_value(w, NULL, NULL, event_stats.stale);
     
-    // Get all sensors from sensors.c
+    // Sensor data path throughput
+    metrics_family(w, "sensor_updates_total", METRIC_COUNTER, NULL, "Sensor updates received per sensor");
     int sensor_count = sensors_get_count();
     for (int i = 0; i < sensor_count; i++) {
-        const sensor_data_t *sensor = sensors_get_by_index(i);
-        if (sensor == NULL || sensor->metric_name[0] == '\0') {
+        sensor_data_t sensor;
+        if (!sensors_read_snapshot(i, &sensor)) {
             continue;
         }
-        
-        // Output HELP and TYPE for this sensor
-        offset += snprintf(response + offset, response_size - offset,
-                          "# HELP %s %s", sensor->metric_name, sensor->display_name);
-        
-        if (sensor->unit[0] != '\0') {
-            offset += snprintf(response + offset, response_size - offset,
-                              " in %s", sensor->unit);
+        char sensor_id[12];
+        snprintf(sensor_id, sizeof(sensor_id), "%d", i);
+        metrics_label_t labels[] = {
+            { "sensor_id", sensor_id },
+            { "metric", sensor.metric_name },
+            { "device_id", sensor.device_id },
+        };
+        metrics_value_labels(w, labels, 3, sensors_get_update_count(i));
+    }
+    metrics_family(w, "sensor_producer_updates_total", METRIC_COUNTER, NULL, "Sensor updates received per producer");
+    for (int i = 0; i < SENSOR_PRODUCER_COUNT; i++) {
+        metrics_value(w, "producer", sensor_producer_name(i), sensors_get_producer_update_count(i));
+    }
+    
+    // MQTT publish throughput
+    static const char *mqtt_publish_kinds[MQTT_PUBLISH_KIND_COUNT] = {
+        [MQTT_PUBLISH_SENSOR] = "sensor",
+        [MQTT_PUBLISH_STATUS] = "status",
+        [MQTT_PUBLISH_BATCH] = "batch",
+        [MQTT_PUBLISH_REPLAY] = "replay",
+        [MQTT_PUBLISH_DESCRIPTOR] = "descriptor",
+    };
+    mqtt_publish_stats_t mqtt_stats[MQTT_PUBLISH_KIND_COUNT];
+    for (int i = 0; i < MQTT_PUBLISH_KIND_COUNT; i++) {
+        mqtt_get_publish_stats(i, &mqtt_stats[i]);
+    }
+    metrics_family(w, "mqtt_publish_attempts_total", METRIC_COUNTER, NULL, "MQTT messages built for publishing");
+    for (int i = 0; i < MQTT_PUBLISH_KIND_COUNT; i++) {
+        metrics_value(w, "type", mqtt_publish_kinds[i], mqtt_stats[i].attempted);
+    }
+    metrics_family(w, "mqtt_publish_total", METRIC_COUNTER, NULL, "MQTT publishes by outcome");
+    for (int i = 0; i < MQTT_PUBLISH_KIND_COUNT; i++) {
+        metrics_label_t succeeded[] = { { "type", mqtt_publish_kinds[i] }, { "result", "succeeded" } };
+        metrics_label_t failed[] = { { "type", mqtt_publish_kinds[i] }, { "result", "failed" } };
+        metrics_value_labels(w, succeeded, 2, mqtt_stats[i].succeeded);
+        metrics_value_labels(w, failed, 2, mqtt_stats[i].failed);
+    }
+    metrics_family(w, "mqtt_published_bytes_total", METRIC_COUNTER, "bytes", "MQTT payload bytes published");
+    for (int i = 0; i < MQTT_PUBLISH_KIND_COUNT; i++) {
+        metrics_value(w, "type", mqtt_publish_kinds[i], mqtt_stats[i].bytes);
+    }
+    mqtt_batch_stats_t batch_stats;
+    mqtt_get_batch_stats(&batch_stats);
+    metrics_family(w, "mqtt_batch_flushes_total", METRIC_COUNTER, NULL, "Batched MQTT sends by trigger");
+    metrics_value(w, "reason", "window", batch_stats.flushes_window);
+    metrics_value(w, "reason", "size", batch_stats.flushes_size);
+    metrics_family(w, "mqtt_batch_sensors_total", METRIC_COUNTER, NULL, "Sensor readings published in batched MQTT messages");
+    metrics_value(w, NULL, NULL, batch_stats.sensors);
+    metrics_family(w, "mqtt_batch_coalesced_total", METRIC_COUNTER, NULL, "Sensor updates merged into one already queued for the batch");
+    metrics_value(w, NULL, NULL, batch_stats.coalesced);
+    metrics_family(w, "mqtt_batch_dropped_total", METRIC_COUNTER, NULL, "Sensor updates dropped because the batch was full");
+    metrics_value(w, NULL, NULL, batch_stats.dropped);
+    mqtt_offline_stats_t offline_stats;
+    mqtt_get_offline_stats(&offline_stats);
+    metrics_family(w, "mqtt_offline_buffered_total", METRIC_COUNTER, NULL, "Sensor readings buffered while the MQTT broker was unreachable or the QoS 1 window was full");
+    metrics_value(w, NULL, NULL, offline_stats.buffered);
+    metrics_family(w, "mqtt_offline_replayed_total", METRIC_COUNTER, NULL, "Buffered sensor readings published later");
+    metrics_value(w, NULL, NULL, offline_stats.replayed);
+    metrics_family(w, "mqtt_offline_dropped_total", METRIC_COUNTER, NULL, "Buffered sensor readings overwritten because the buffer was full");
+    metrics_value(w, NULL, NULL, offline_stats.dropped);
+    metrics_family(w, "mqtt_offline_readings", METRIC_GAUGE, NULL, "Sensor readings in the MQTT offline buffer");
+    metrics_value(w, "state", "pending", offline_stats.pending);
+    metrics_value(w, "state", "capacity", offline_stats.capacity);
+    mqtt_encode_stats_t encode_stats;
+    mqtt_get_encode_stats(&encode_stats);
+    metrics_family(w, "mqtt_encode_buffers", METRIC_GAUGE, NULL, "MQTT message encode buffers");
+    metrics_value(w, "state", "in_use", encode_stats.in_use);
+    metrics_value(w, "state", "capacity", encode_stats.buffers);
+    metrics_family(w, "mqtt_encode_buffer_acquisitions_total", METRIC_COUNTER, NULL, "MQTT encode buffers handed out");
+    metrics_value(w, NULL, NULL, encode_stats.acquisitions);
+    metrics_family(w, "mqtt_encode_buffer_exhausted_total", METRIC_COUNTER, NULL, "MQTT encode buffer requests that found every buffer in use");
+    metrics_value(w, "result", "waited", encode_stats.exhausted - encode_stats.timeouts);
+    metrics_value(w, "result", "timeout", encode_stats.timeouts);
+    metrics_family(w, "mqtt_encode_buffer_wait_seconds", METRIC_SUMMARY, "seconds", "Time spent waiting for an MQTT encode buffer");
+    metrics_summary(w, encode_stats.exhausted, encode_stats.wait_us / 1e6);
+    metrics_family(w, "mqtt_encode_buffer_wait_max_seconds", METRIC_GAUGE, "seconds", "Longest wait for an MQTT encode buffer");
+    metrics_value(w, NULL, NULL, encode_stats.wait_max_us / 1e6);
+    mqtt_qos_stats_t qos_stats;
+    mqtt_get_qos_stats(&qos_stats);
+    metrics_family(w, "mqtt_inflight_messages", METRIC_GAUGE, NULL, "QoS 1 MQTT messages awaiting PUBACK");
+    metrics_value(w, "state", "in_flight", qos_stats.in_flight);
+    metrics_value(w, "state", "window", qos_stats.window);
+    metrics_family(w, "mqtt_puback_latency_seconds", METRIC_SUMMARY, "seconds", "Time from publishing a QoS 1 MQTT message to its PUBACK");
+    metrics_summary(w, qos_stats.acked, qos_stats.ack_us / 1e6);
+    metrics_family(w, "mqtt_puback_latency_max_seconds", METRIC_GAUGE, "seconds", "Longest wait for a PUBACK");
+    metrics_value(w, NULL, NULL, qos_stats.ack_max_us / 1e6);
+    metrics_family(w, "mqtt_inflight_expired_total", METRIC_COUNTER, NULL, "QoS 1 MQTT messages given up on without a PUBACK");
+    metrics_value(w, NULL, NULL, qos_stats.expired);
+    metrics_family(w, "mqtt_inflight_window_full_total", METRIC_COUNTER, NULL, "MQTT publishes that found the QoS 1 window full");
+    metrics_value(w, NULL, NULL, qos_stats.window_full);
+    metrics_family(w, "mqtt_puback_late_total", METRIC_COUNTER, NULL, "PUBACKs that arrived after the retransmit timeout");
+    metrics_value(w, NULL, NULL, qos_stats.late_acks);
+    metrics_family(w, "mqtt_outbox_bytes", METRIC_GAUGE, "bytes", "Unacknowledged MQTT messages held in the client outbox");
+    metrics_value(w, NULL, NULL, qos_stats.outbox_bytes);
+    
+    // Sensor stream (SSE) metrics
+    sensor_stream_stats_t stream_stats;
+    sensors_get_stream_stats(&stream_stats);
+    metrics_family(w, "sensor_stream_clients", METRIC_GAUGE, NULL, "Connected /sensors/stream clients");
+    metrics_value(w, NULL, NULL, stream_stats.clients);
+    metrics_family(w, "sensor_stream_clients_max", METRIC_GAUGE, NULL, "Maximum concurrent /sensors/stream clients");
+    metrics_value(w, NULL, NULL, stream_stats.max_clients);
+    metrics_family(w, "sensor_stream_connections_total", METRIC_COUNTER, NULL, "/sensors/stream connection attempts by outcome");
+    metrics_value(w, "result", "accepted", stream_stats.accepted);
+    metrics_value(w, "result", "rejected", stream_stats.rejected);
+    metrics_family(w, "sensor_stream_events_total", METRIC_COUNTER, NULL, "Sensor updates written to /sensors/stream clients");
+    metrics_value(w, NULL, NULL, stream_stats.events_sent);
+    
+    // Sensor string pool metrics
+    size_t pool_used, pool_capacity, pool_strings;
+    string_pool_get_stats(&pool_used, &pool_capacity, &pool_strings);
+    metrics_family(w, "sensor_string_pool_bytes", METRIC_GAUGE, "bytes", "Interned sensor string pool usage in bytes");
+    metrics_value(w, "state", "used", pool_used);
+    metrics_value(w, "state", "capacity", pool_capacity);
+    metrics_family(w, "sensor_string_pool_strings", METRIC_GAUGE, NULL, "Distinct interned sensor strings");
+    metrics_value(w, NULL, NULL, pool_strings);
+    
+    // Render timing and cache metrics
+    metrics_family(w, "metrics_render_duration_seconds", METRIC_SUMMARY, "seconds", "Time spent rendering /metrics, excluding time spent sending");
+    metrics_summary(w, render_count, render_total_us / 1e6);
+    metrics_family(w, "metrics_render_duration_max_seconds", METRIC_GAUGE, "seconds", "Longest /metrics render");
+    metrics_value(w, NULL, NULL, render_max_us / 1e6);
+    metrics_family(w, "metrics_scrape_duration_seconds", METRIC_SUMMARY, "seconds", "Time spent serving /metrics, including sending");
+    metrics_summary(w, render_count, scrape_total_us / 1e6);
+    metrics_family(w, "metrics_scrape_duration_max_seconds", METRIC_GAUGE, "seconds", "Longest /metrics scrape");
+    metrics_value(w, NULL, NULL, scrape_max_us / 1e6);
+    metrics_family(w, "metrics_scrape_size_bytes", METRIC_GAUGE, "bytes", "Size of /metrics responses");
+    metrics_value(w, "scrape", "last", scrape_last_bytes);
+    metrics_value(w, "scrape", "max", scrape_max_bytes);
+    metrics_family(w, "metrics_cache_rebuilds_total", METRIC_COUNTER, NULL, "Rebuilds of the pre-rendered sensor series");
+    metrics_value(w, NULL, NULL, cache_rebuilds);
+    
+    // Per-handler HTTP request metrics
+    const http_uri_stats_t *uri_stats;
+    metrics_family(w, "http_request_duration_seconds", METRIC_HISTOGRAM, "seconds", "Time spent in HTTP handlers");
+    for (int i = 0; (uri_stats = http_server_get_uri_stats(i)) != NULL; i++) {
+        metrics_label_t labels[] = {
+            { "uri", uri_stats->uri },
+            { "method", http_method_str(uri_stats->method) },
+        };
+        uint64_t cumulative[HTTP_LATENCY_BUCKETS];
+        uint64_t below = 0;
+        for (int b = 0; b < HTTP_LATENCY_BUCKETS; b++) {
+            below += uri_stats->buckets[b];
+            cumulative[b] = below;
         }
-        
-        offset += snprintf(response + offset, response_size - offset, "\n");
-        offset += snprintf(response + offset, response_size - offset,
-                          "# TYPE %s gauge\n", sensor->metric_name);
-        
-        // Output value if available
-        if (sensor->available && sensor->last_updated > 0) {
-            // Convert timestamp to milliseconds for Prometheus
-            int64_t timestamp_ms = (int64_t)sensor->last_updated * 1000;
-            
-            offset += snprintf(response + offset, response_size - offset,
-                              "%s{hostname=\"%s\"%s%s%s%s%s%s} %.2f %lld\n", 
-                              sensor->metric_name, hostname, 
-
-                              sensor->device_name[0] != '\0' ? ",device_name=\"" : "",
-                              sensor->device_name[0] != '\0' ? sensor->device_name : "",
-                              sensor->device_name[0] != '\0' ? "\"" : "",
-
-                              sensor->device_id[0] != '\0' ? ",device_id=\"" : "",
-                              sensor->device_id[0] != '\0' ? sensor->device_id : "",
-                              sensor->device_id[0] != '\0' ? "\"" : "",
-
-                              sensor->value, timestamp_ms);
+        metrics_histogram(w, labels, 2, http_latency_buckets_seconds, cumulative, HTTP_LATENCY_BUCKETS,
+                          uri_stats->count, uri_stats->total_us / 1e6);
+    }
+    metrics_family(w, "http_requests_total", METRIC_COUNTER, NULL, "HTTP requests handled");
+    for (int i = 0; (uri_stats = http_server_get_uri_stats(i)) != NULL; i++) {
+        metrics_label_t labels[] = {
+            { "uri", uri_stats->uri },
+            { "method", http_method_str(uri_stats->method) },
+        };
+        metrics_value_labels(w, labels, 2, uri_stats->count);
+    }
+    metrics_family(w, "http_response_bytes_total", METRIC_COUNTER, "bytes", "HTTP response bytes sent by handlers, headers included");
+    for (int i = 0; (uri_stats = http_server_get_uri_stats(i)) != NULL; i++) {
+        metrics_label_t labels[] = {
+            { "uri", uri_stats->uri },
+            { "method", http_method_str(uri_stats->method) },
+        };
+        metrics_value_labels(w, labels, 2, uri_stats->bytes);
+    }
+    
+    // FreeRTOS task metrics, from the last task_stats sample
+    task_stats_t task;
+    metrics_family(w, "task_count", METRIC_GAUGE, NULL, "Number of FreeRTOS tasks");
+    metrics_value(w, NULL, NULL, task_stats_count());
+    metrics_family(w, "task_cpu_percent", METRIC_GAUGE, NULL, "Task CPU use over the last sampling interval, percent of one core");
+    for (int i = 0; task_stats_get(i, &task); i++) {
+        metrics_value(w, "task", task.name, task.cpu_percent);
+    }
+    metrics_family(w, "task_runtime_seconds_total", METRIC_COUNTER, "seconds", "Task CPU time since boot");
+    for (int i = 0; task_stats_get(i, &task); i++) {
+        metrics_value(w, "task", task.name, task.runtime_us / 1e6);
+    }
+    metrics_family(w, "task_stack_free_min_bytes", METRIC_GAUGE, "bytes", "Stack high-water mark: least free stack space seen");
+    for (int i = 0; task_stats_get(i, &task); i++) {
+        metrics_value(w, "task", task.name, task.stack_free_min);
+    }
+    metrics_family(w, "task_priority", METRIC_GAUGE, NULL, "Task priority");
+    for (int i = 0; task_stats_get(i, &task); i++) {
+        metrics_value(w, "task", task.name, task.priority);
+    }
+    metrics_family(w, "task_core_id", METRIC_GAUGE, NULL, "Core the task is pinned to, -1 if it can run on either");
+    for (int i = 0; task_stats_get(i, &task); i++) {
+        metrics_value(w, "task", task.name, task.core);
+    }
+    
+    // Heap use per module, from tracked_alloc
+    alloc_stats_t alloc;
+    char alloc_file[32];
+    metrics_family(w, "malloc_count_total", METRIC_COUNTER, NULL, "Total number of malloc calls per source file");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        snprintf(alloc_file, sizeof(alloc_file), "%s.c", tracked_alloc_module_name(i));
+        metrics_value(w, "file", alloc_file, alloc.allocs);
+    }
+    metrics_family(w, "free_count_total", METRIC_COUNTER, NULL, "Total number of free calls per source file");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        snprintf(alloc_file, sizeof(alloc_file), "%s.c", tracked_alloc_module_name(i));
+        metrics_value(w, "file", alloc_file, alloc.frees);
+    }
+    metrics_family(w, "alloc_bytes_total", METRIC_COUNTER, "bytes", "Heap bytes allocated per module");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        metrics_value(w, "module", tracked_alloc_module_name(i), alloc.bytes);
+    }
+    metrics_family(w, "alloc_live_bytes", METRIC_GAUGE, "bytes", "Heap bytes currently allocated per module");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        metrics_value(w, "module", tracked_alloc_module_name(i), alloc.live_bytes);
+    }
+    metrics_family(w, "alloc_peak_live_bytes", METRIC_GAUGE, "bytes", "Most heap bytes allocated at once per module");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        metrics_value(w, "module", tracked_alloc_module_name(i), alloc.peak_live_bytes);
+    }
+    double alloc_bounds[ALLOC_SIZE_BUCKETS];
+    for (int b = 0; b < ALLOC_SIZE_BUCKETS; b++) {
+        alloc_bounds[b] = alloc_size_buckets_bytes[b];
+    }
+    metrics_family(w, "alloc_size_bytes", METRIC_HISTOGRAM, "bytes", "Requested allocation sizes per module");
+    for (int i = 0; i < ALLOC_MODULE_COUNT; i++) {
+        tracked_alloc_get_stats(i, &alloc);
+        metrics_label_t labels[] = { { "module", tracked_alloc_module_name(i) } };
+        uint64_t cumulative[ALLOC_SIZE_BUCKETS];
+        uint64_t below = 0;
+        for (int b = 0; b < ALLOC_SIZE_BUCKETS; b++) {
+            below += alloc.size_buckets[b];
+            cumulative[b] = below;
         }
+        metrics_histogram(w, labels, 1, alloc_bounds, cumulative, ALLOC_SIZE_BUCKETS,
+                          below + alloc.size_buckets[ALLOC_SIZE_BUCKETS], alloc.requested_bytes);
     }
     
-    // WiFi RSSI metric
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP wifi_rssi_dbm WiFi signal strength in dBm\n"
-                      "# TYPE wifi_rssi_dbm gauge\n");
+    // BTHome ingestion
+    bthome_stats_t bthome;
+    bthome_get_stats(&bthome);
+    metrics_family(w, "bthome_advertisements_total", METRIC_COUNTER, NULL, "BTHome advertisements received");
+    metrics_value(w, NULL, NULL, bthome.advertisements);
+    metrics_family(w, "bthome_packets_ignored_total", METRIC_COUNTER, NULL, "BTHome advertisements not turned into sensor updates");
+    metrics_value(w, "reason", "clock_not_set", bthome.rejected_no_time);
+    metrics_value(w, "reason", "mac_not_enabled", bthome.filtered);
+    metrics_family(w, "bthome_cache_lookups_total", METRIC_COUNTER, NULL, "BTHome packet cache lookups by MAC");
+    metrics_value(w, "result", "hit", bthome.cache_hits);
+    metrics_value(w, "result", "miss", bthome.cache_misses);
+    metrics_family(w, "bthome_cache_evictions_total", METRIC_COUNTER, NULL, "BTHome packet cache entries replaced by another MAC");
+    metrics_value(w, NULL, NULL, bthome.cache_evictions);
+    metrics_family(w, "bthome_cache_errors_total", METRIC_COUNTER, NULL, "BTHome packets that failed to copy into the cache");
+    metrics_value(w, NULL, NULL, bthome.cache_errors);
+    metrics_family(w, "bthome_callback_duration_seconds", METRIC_SUMMARY, "seconds", "Time spent handling each BTHome advertisement");
+    metrics_summary(w, bthome.callback_count, bthome.callback_us / 1e6);
+    metrics_family(w, "bthome_callback_duration_max_seconds", METRIC_GAUGE, "seconds", "Longest time spent handling a BTHome advertisement");
+    metrics_value(w, NULL, NULL, bthome.callback_max_us / 1e6);
     
-    if (rssi != 0) {
-        offset += snprintf(response + offset, response_size - offset,
-                          "wifi_rssi_dbm{hostname=\"%s\"} %d\n", hostname, rssi);
+    bthome_device_stats_t device;
+    char device_id[18];
+    metrics_label_t device_labels[] = {
+        { "device_id", device_id },
+        { "device_name", device.name },
+    };
+    metrics_family(w, "bthome_device_rssi_dbm", METRIC_GAUGE, NULL, "RSSI of the last packet from each enabled BTHome device");
+    for (int i = 0; bthome_get_device_stats(i, &device); i++) {
+        metrics_format_mac(device_id, device.addr);
+        metrics_value_labels(w, device_labels, 2, device.rssi);
+    }
+    metrics_family(w, "bthome_device_packets_total", METRIC_COUNTER, NULL, "Packets received from each enabled BTHome device");
+    for (int i = 0; bthome_get_device_stats(i, &device); i++) {
+        metrics_format_mac(device_id, device.addr);
+        metrics_value_labels(w, device_labels, 2, device.packets);
+    }
+    metrics_family(w, "bthome_device_duplicate_packets_total", METRIC_COUNTER, NULL, "Packets repeating the previous packet ID");
+    for (int i = 0; bthome_get_device_stats(i, &device); i++) {
+        metrics_format_mac(device_id, device.addr);
+        metrics_value_labels(w, device_labels, 2, device.duplicates);
+    }
+    metrics_family(w, "bthome_device_lost_packets_total", METRIC_COUNTER, NULL, "Packet IDs skipped, i.e. readings never received");
+    for (int i = 0; bthome_get_device_stats(i, &device); i++) {
+        metrics_format_mac(device_id, device.addr);
+        metrics_value_labels(w, device_labels, 2, device.lost);
     }
     
-    // Uptime metric
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP uptime_seconds System uptime in seconds\n"
-                      "# TYPE uptime_seconds counter\n"
-                      "uptime_seconds{hostname=\"%s\"} %lld\n", hostname, uptime_seconds);
+    // Lock contention, from tracked_mutex
+    tracked_mutex_stats_t lock;
+    metrics_family(w, "lock_acquisitions_total", METRIC_COUNTER, NULL, "Successful takes of each named lock");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.acquisitions);
+    }
+    metrics_family(w, "lock_contended_total", METRIC_COUNTER, NULL, "Takes that found the lock held and had to wait");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.contended);
+    }
+    metrics_family(w, "lock_timeouts_total", METRIC_COUNTER, NULL, "Takes that gave up waiting");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.timeouts);
+    }
+    metrics_family(w, "lock_wait_seconds_total", METRIC_COUNTER, "seconds", "Time spent waiting for each lock");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.wait_us / 1e6);
+    }
+    metrics_family(w, "lock_wait_max_seconds", METRIC_GAUGE, "seconds", "Longest wait for each lock");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.wait_max_us / 1e6);
+    }
+    metrics_family(w, "lock_hold_seconds_total", METRIC_COUNTER, "seconds", "Time each lock was held");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.hold_us / 1e6);
+    }
+    metrics_family(w, "lock_hold_max_seconds", METRIC_GAUGE, "seconds", "Longest time each lock was held");
+    for (int i = 0; tracked_mutex_get_stats(i, &lock); i++) {
+        metrics_value(w, "lock", lock.name, lock.hold_max_us / 1e6);
+    }
     
-    // Heap memory metrics
-    uint32_t free_heap = esp_get_free_heap_size();
-    uint32_t min_free_heap = esp_get_minimum_free_heap_size();
-    
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP heap_free_bytes Current free heap memory in bytes\n"
-                      "# TYPE heap_free_bytes gauge\n"
-                      "heap_free_bytes{hostname=\"%s\"} %lu\n", hostname, free_heap);
-    
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP heap_min_free_bytes Minimum free heap memory ever reached in bytes\n"
-                      "# TYPE heap_min_free_bytes gauge\n"
-                      "heap_min_free_bytes{hostname=\"%s\"} %lu\n", hostname, min_free_heap);
-    
-    uint32_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP heap_largest_free_block_bytes Largest contiguous free memory block in bytes\n"
-                      "# TYPE heap_largest_free_block_bytes gauge\n"
-                      "heap_largest_free_block_bytes{hostname=\"%s\"} %lu\n", hostname, largest_free_block);
-    
-    // Malloc count metrics
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP malloc_count_total Total number of malloc calls per source file\n"
-                      "# TYPE malloc_count_total counter\n");
-    
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"settings.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_settings));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"metrics.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_metrics));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"sensors.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_sensors));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"pump.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_pump));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"main.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_main));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"http_server.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_http_server));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"syslog.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_syslog));
-    offset += snprintf(response + offset, response_size - offset,
-                      "malloc_count_total{hostname=\"%s\",file=\"mqtt_publisher.c\"} %u\n", 
-                      hostname, atomic_load(&malloc_count_mqtt_publisher));
-    
-    // Free count metrics
-    offset += snprintf(response + offset, response_size - offset,
-                      "# HELP free_count_total Total number of free calls per source file\n"
-                      "# TYPE free_count_total counter\n");
-    
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"settings.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_settings));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"metrics.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_metrics));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"sensors.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_sensors));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"pump.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_pump));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"main.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_main));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"http_server.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_http_server));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"syslog.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_syslog));
-    offset += snprintf(response + offset, response_size - offset,
-                      "free_count_total{hostname=\"%s\",file=\"mqtt_publisher.c\"} %u\n", 
-                      hostname, atomic_load(&free_count_mqtt_publisher));
-    
-    // Set response headers and send
-    httpd_resp_set_status(req, HTTPD_200);
-    httpd_resp_set_type(req, "text/plain; version=0.0.4");
-    httpd_resp_set_hdr(req, "Connection", "keep-alive");
-    httpd_resp_send(req, response, offset);
-    
-    free(response);
-    atomic_fetch_add(&free_count_metrics, 1);
+    // Remote write push metrics
+    remote_write_stats_t rw_stats;
+    remote_write_get_stats(&rw_stats);
+    metrics_family(w, "remote_write_requests_total", METRIC_COUNTER, NULL, "Remote write POSTs by result");
+    metrics_value(w, "result", "success", rw_stats.succeeded);
+    metrics_value(w, "result", "retry", rw_stats.retried);
+    metrics_value(w, "result", "rejected", rw_stats.rejected);
+    metrics_family(w, "remote_write_samples_total", METRIC_COUNTER, NULL, "Samples delivered by remote write");
+    metrics_value(w, NULL, NULL, rw_stats.samples);
+    metrics_family(w, "remote_write_sent_bytes_total", METRIC_COUNTER, "bytes", "Compressed remote write bytes delivered");
+    metrics_value(w, NULL, NULL, rw_stats.bytes);
+    metrics_family(w, "remote_write_batches_dropped_total", METRIC_COUNTER, NULL, "Remote write batches dropped");
+    metrics_value(w, "reason", "queue_full", rw_stats.dropped_full);
+    metrics_value(w, "reason", "rejected", rw_stats.rejected);
+    metrics_family(w, "remote_write_pending_batches", METRIC_GAUGE, NULL, "Remote write batches waiting to be sent");
+    metrics_value(w, NULL, NULL, rw_stats.pending);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    settings_t *settings = (settings_t *)req->user_ctx;
+    int64_t scrape_start_us = esp_timer_get_time();
+    
+    metrics_writer_t writer;
+    metrics_writer_t *w = &writer;
+    metrics_writer_begin(w, req, metrics_negotiate_format(req), metrics_hostname(settings));
+    metrics_render(w);
+    esp_err_t err = metrics_writer_end(w);
+    
+    // Counted from the next scrape on
+    uint32_t scrape_us = (uint32_t)(esp_timer_get_time() - scrape_start_us);
+    uint32_t render_us = scrape_us - (uint32_t)writer.send_us;
+    render_count++;
+    render_total_us += render_us;
+    if (render_us > render_max_us) {
+        render_max_us = render_us;
+    }
+    scrape_total_us += scrape_us;
+    if (scrape_us > scrape_max_us) {
+        scrape_max_us = scrape_us;
+    }
+    scrape_last_bytes = writer.total;
+    if (writer.total > scrape_max_bytes) {
+        scrape_max_bytes = writer.total;
+    }
+    
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send metrics (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t metrics_render_buffer(settings_t *settings, metrics_format_t format,
+                                uint8_t **out, size_t *out_len, uint32_t *samples) {
+    metrics_writer_t w;
+    metrics_writer_begin_buffer(&w, format, metrics_hostname(settings));
+    metrics_render(&w);
+    esp_err_t err = metrics_writer_end(&w);
+    if (err != ESP_OK) {
+        tracked_free(ALLOC_METRICS, w.buf);
+        return err;
+    }
+    *out = w.buf;
+    *out_len = w.total;
+    if (samples != NULL) {
+        *samples = w.samples;
+    }
     return ESP_OK;
 }
 
@@ -216,7 +722,7 @@ static httpd_uri_t metrics_uri = {
 
 void metrics_init(settings_t *settings, httpd_handle_t server) {
     metrics_uri.user_ctx = settings;
-    esp_err_t err = httpd_register_uri_handler(server, &metrics_uri);
+    esp_err_t err = http_server_register_uri_handler(server, &metrics_uri);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) registering metrics handler!", esp_err_to_name(err));
     } else {
@@ -2,29 +2,25 @@
 #define METRICS_H
 
 #include "settings.h"
+#include "metrics_writer.h"
 #include <esp_http_server.h>
-#include <stdatomic.h>
-
-// Atomic malloc counters per source file
-extern atomic_uint_fast32_t malloc_count_settings;
-extern atomic_uint_fast32_t malloc_count_metrics;
-extern atomic_uint_fast32_t malloc_count_sensors;
-extern atomic_uint_fast32_t malloc_count_pump;
-extern atomic_uint_fast32_t malloc_count_main;
-extern atomic_uint_fast32_t malloc_count_http_server;
-extern atomic_uint_fast32_t malloc_count_syslog;
-extern atomic_uint_fast32_t malloc_count_mqtt_publisher;
-
-// Atomic free counters per source file
-extern atomic_uint_fast32_t free_count_settings;
-extern atomic_uint_fast32_t free_count_metrics;
-extern atomic_uint_fast32_t free_count_sensors;
-extern atomic_uint_fast32_t free_count_pump;
-extern atomic_uint_fast32_t free_count_main;
-extern atomic_uint_fast32_t free_count_http_server;
-extern atomic_uint_fast32_t free_count_syslog;
-extern atomic_uint_fast32_t free_count_mqtt_publisher;
 
 void metrics_init(settings_t *settings, httpd_handle_t server);
 
+/**
+ * @brief Render all metrics into a heap buffer
+ *
+ * Must run on the httpd task (e.g. from httpd_queue_work), which owns the
+ * writer's static buffers and the sensor series cache.
+ *
+ * @param settings Settings, for the hostname label
+ * @param format Exposition format
+ * @param out Rendered bytes; free with tracked_free(ALLOC_METRICS, ...)
+ * @param out_len Length of out
+ * @param samples Samples written in remote_write format (can be NULL)
+ * @return esp_err_t ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t metrics_render_buffer(settings_t *settings, metrics_format_t format,
+                                uint8_t **out, size_t *out_len, uint32_t *samples);
+
 #endif // METRICS_H
@@ -0,0 +1,659 @@
+#include "metrics_writer.h"
+#include "tracked_alloc.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+static const char *TAG = "metrics";
+extern bool g_ntp_initialized;
+
+#define METRICS_CHUNK_SIZE 1024
+#define METRICS_ACCEPT_MAX_LEN 256
+#define METRICS_PB_INITIAL_SIZE 512
+
+static char metrics_chunk[METRICS_CHUNK_SIZE];
+
+// Protobuf MetricFamily being built. Families are length-prefixed, so each is
+// encoded here in full before it is written.
+static uint8_t *pb_family = NULL;
+static size_t pb_family_size = 0;
+static size_t pb_family_len = 0;
+
+static const char *metric_type_names[] = {
+    [METRIC_COUNTER] = "counter",
+    [METRIC_GAUGE] = "gauge",
+    [METRIC_SUMMARY] = "summary",
+    [METRIC_HISTOGRAM] = "histogram",
+};
+
+metrics_format_t metrics_negotiate_format(httpd_req_t *req) {
+    char accept[METRICS_ACCEPT_MAX_LEN];
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept));
+    if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return METRICS_FORMAT_TEXT;
+    }
+
+    // Pick the accepted format with the highest q-value; earlier entries win ties
+    metrics_format_t best = METRICS_FORMAT_TEXT;
+    float best_q = 0.0f;
+    char *saveptr = NULL;
+    for (char *entry = strtok_r(accept, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr)) {
+        metrics_format_t format;
+        if (strstr(entry, "application/vnd.google.protobuf") != NULL &&
+            strstr(entry, "proto=io.prometheus.client.MetricFamily") != NULL &&
+            strstr(entry, "encoding=delimited") != NULL) {
+            format = METRICS_FORMAT_PROTOBUF;
+        } else if (strstr(entry, "application/openmetrics-text") != NULL) {
+            format = METRICS_FORMAT_OPENMETRICS;
+        } else if (strstr(entry, "text/plain") != NULL || strstr(entry, "*/*") != NULL) {
+            format = METRICS_FORMAT_TEXT;
+        } else {
+            continue;
+        }
+
+        float q = 1.0f;
+        for (char *p = entry; (p = strstr(p, "q=")) != NULL; p++) {
+            if (p > entry && (p[-1] == ';' || p[-1] == ' ')) {
+                q = strtof(p + 2, NULL);
+                break;
+            }
+        }
+        if (q > best_q) {
+            best = format;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+static void metrics_send(metrics_writer_t *w, const char *data, size_t len) {
+    if (w->err != ESP_OK || len == 0) {
+        return;
+    }
+    if (w->req == NULL) {
+        if (w->total + len > w->buf_size) {
+            size_t new_size = w->buf_size > 0 ? w->buf_size : METRICS_CHUNK_SIZE * 4;
+            while (new_size < w->total + len) {
+                new_size *= 2;
+            }
+            uint8_t *grown = tracked_realloc(ALLOC_METRICS, w->buf, new_size);
+            if (grown == NULL) {
+                ESP_LOGE(TAG, "Failed to grow metrics buffer to %u bytes", (unsigned)new_size);
+                w->err = ESP_ERR_NO_MEM;
+                return;
+            }
+            w->buf = grown;
+            w->buf_size = new_size;
+        }
+        memcpy(w->buf + w->total, data, len);
+        w->total += len;
+        return;
+    }
+    int64_t start_us = esp_timer_get_time();
+    w->err = httpd_resp_send_chunk(w->req, data, len);
+    w->send_us += esp_timer_get_time() - start_us;
+    w->total += len;
+}
+
+static void metrics_flush(metrics_writer_t *w) {
+    metrics_send(w, metrics_chunk, w->len);
+    w->len = 0;
+}
+
+void metrics_write(metrics_writer_t *w, const char *data, size_t len) {
+    if (w->len + len > METRICS_CHUNK_SIZE) {
+        metrics_flush(w);
+        if (len > METRICS_CHUNK_SIZE) {
+            metrics_send(w, data, len);
+            return;
+        }
+    }
+    memcpy(metrics_chunk + w->len, data, len);
+    w->len += len;
+}
+
+void metrics_printf(metrics_writer_t *w, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(metrics_chunk + w->len, METRICS_CHUNK_SIZE - w->len, fmt, args);
+    va_end(args);
+    if (len < 0 || w->len + len < METRICS_CHUNK_SIZE) {
+        w->len += len > 0 ? len : 0;
+        return;
+    }
+
+    // Didn't fit; send what was buffered before it and format again
+    metrics_flush(w);
+    va_start(args, fmt);
+    len = vsnprintf(metrics_chunk, METRICS_CHUNK_SIZE, fmt, args);
+    va_end(args);
+    if (len >= METRICS_CHUNK_SIZE) {
+        ESP_LOGW(TAG, "Metrics line longer than %d bytes truncated", METRICS_CHUNK_SIZE);
+        len = METRICS_CHUNK_SIZE - 1;
+    }
+    w->len = len > 0 ? len : 0;
+}
+
+static bool pb_reserve(metrics_writer_t *w, size_t len) {
+    if (pb_family_len + len <= pb_family_size) {
+        return true;
+    }
+    size_t new_size = pb_family_size > 0 ? pb_family_size : METRICS_PB_INITIAL_SIZE;
+    while (new_size < pb_family_len + len) {
+        new_size *= 2;
+    }
+    uint8_t *grown = tracked_realloc(ALLOC_METRICS, pb_family, new_size);
+    if (grown == NULL) {
+        ESP_LOGE(TAG, "Failed to grow protobuf buffer to %u bytes", (unsigned)new_size);
+        w->err = ESP_ERR_NO_MEM;
+        return false;
+    }
+    pb_family = grown;
+    pb_family_size = new_size;
+    return true;
+}
+
+static size_t pb_varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Size of a length-delimited field with a one-byte tag
+static size_t pb_len_field_size(size_t len) {
+    return 1 + pb_varint_size(len) + len;
+}
+
+// The pb_put_* functions assume space was reserved
+static void pb_put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        pb_family[pb_family_len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    pb_family[pb_family_len++] = (uint8_t)value;
+}
+
+static void pb_put_tag(int field, int wire_type) {
+    pb_put_varint((uint64_t)((field << 3) | wire_type));
+}
+
+static void pb_put_bytes(int field, const void *data, size_t len) {
+    pb_put_tag(field, 2);
+    pb_put_varint(len);
+    memcpy(pb_family + pb_family_len, data, len);
+    pb_family_len += len;
+}
+
+static void pb_put_double(int field, double value) {
+    // Fixed 64-bit fields are little-endian, as is the ESP32
+    pb_put_tag(field, 1);
+    memcpy(pb_family + pb_family_len, &value, sizeof(value));
+    pb_family_len += sizeof(value);
+}
+
+static void pb_family_begin(metrics_writer_t *w, const char *name, size_t name_len,
+                            const char *help, size_t help_len, metric_type_t type) {
+    pb_family_len = 0;
+    if (!pb_reserve(w, pb_len_field_size(name_len) + pb_len_field_size(help_len) + 2)) {
+        return;
+    }
+    pb_put_bytes(1, name, name_len);
+    pb_put_bytes(2, help, help_len);
+    pb_put_tag(3, 0);
+    pb_put_varint(type);
+}
+
+// Size of the Metric.label fields; labels with empty values are skipped
+static size_t pb_labels_size(const metrics_label_t *labels, int label_count) {
+    size_t size = 0;
+    for (int i = 0; i < label_count; i++) {
+        if (labels[i].value[0] != '\0') {
+            size += pb_len_field_size(pb_len_field_size(strlen(labels[i].name)) +
+                                      pb_len_field_size(strlen(labels[i].value)));
+        }
+    }
+    return size;
+}
+
+static void pb_put_labels(const metrics_label_t *labels, int label_count) {
+    for (int i = 0; i < label_count; i++) {
+        if (labels[i].value[0] == '\0') {
+            continue;
+        }
+        size_t name_len = strlen(labels[i].name);
+        size_t value_len = strlen(labels[i].value);
+        pb_put_tag(1, 2);
+        pb_put_varint(pb_len_field_size(name_len) + pb_len_field_size(value_len));
+        pb_put_bytes(1, labels[i].name, name_len);
+        pb_put_bytes(2, labels[i].value, value_len);
+    }
+}
+
+// Append a Metric to the family. For summaries value is the sample sum.
+static void pb_metric(metrics_writer_t *w, const metrics_label_t *labels, int label_count,
+                      metric_type_t type, double value, uint64_t count, int64_t timestamp_ms) {
+    size_t size = pb_labels_size(labels, label_count);
+    size_t value_size = 1 + sizeof(double);
+    if (type == METRIC_SUMMARY) {
+        value_size += 1 + pb_varint_size(count);
+    }
+    size += pb_len_field_size(value_size);
+    if (timestamp_ms > 0) {
+        size += 1 + pb_varint_size(timestamp_ms);
+    }
+
+    if (!pb_reserve(w, pb_len_field_size(size))) {
+        return;
+    }
+    pb_put_tag(4, 2);
+    pb_put_varint(size);
+    pb_put_labels(labels, label_count);
+
+    // Metric.gauge = 2, Metric.counter = 3, Metric.summary = 4
+    pb_put_tag(type == METRIC_GAUGE ? 2 : type == METRIC_COUNTER ? 3 : 4, 2);
+    pb_put_varint(value_size);
+    if (type == METRIC_SUMMARY) {
+        pb_put_tag(1, 0);
+        pb_put_varint(count);
+        pb_put_double(2, value);
+    } else {
+        pb_put_double(1, value);
+    }
+
+    if (timestamp_ms > 0) {
+        pb_put_tag(6, 0);
+        pb_put_varint((uint64_t)timestamp_ms);
+    }
+}
+
+// Append a Metric.histogram (field 7); the +Inf bucket is implied by sample_count
+static void pb_histogram(metrics_writer_t *w, const metrics_label_t *labels, int label_count,
+                         const double *bounds, const uint64_t *cumulative, int bucket_count,
+                         uint64_t count, double sum) {
+    size_t histogram_size = 1 + pb_varint_size(count) + 1 + sizeof(double);
+    for (int i = 0; i < bucket_count; i++) {
+        histogram_size += pb_len_field_size(1 + pb_varint_size(cumulative[i]) + 1 + sizeof(double));
+    }
+    size_t size = pb_labels_size(labels, label_count) + pb_len_field_size(histogram_size);
+
+    if (!pb_reserve(w, pb_len_field_size(size))) {
+        return;
+    }
+    pb_put_tag(4, 2);
+    pb_put_varint(size);
+    pb_put_labels(labels, label_count);
+
+    pb_put_tag(7, 2);
+    pb_put_varint(histogram_size);
+    pb_put_tag(1, 0);
+    pb_put_varint(count);
+    pb_put_double(2, sum);
+    for (int i = 0; i < bucket_count; i++) {
+        pb_put_tag(3, 2);
+        pb_put_varint(1 + pb_varint_size(cumulative[i]) + 1 + sizeof(double));
+        pb_put_tag(1, 0);
+        pb_put_varint(cumulative[i]);
+        pb_put_double(2, bounds[i]);
+    }
+}
+
+// Write a remote_write TimeSeries (WriteRequest field 1) with one sample.
+// Labels must be sorted by name: __name__ sorts first and the rest are
+// sorted here.
+static void rw_series(metrics_writer_t *w, const char *suffix, const metrics_label_t *labels, int label_count,
+                      bool add_hostname, const char *le, double value, int64_t timestamp_ms) {
+    metrics_label_t sorted[METRICS_MAX_LABELS + 3];
+    int count = 0;
+    if (add_hostname) {
+        sorted[count++] = (metrics_label_t){ "hostname", w->hostname };
+    }
+    for (int i = 0; i < label_count && count < METRICS_MAX_LABELS + 2; i++) {
+        sorted[count++] = labels[i];
+    }
+    if (le != NULL) {
+        sorted[count++] = (metrics_label_t){ "le", le };
+    }
+    for (int i = 1; i < count; i++) {
+        metrics_label_t label = sorted[i];
+        int j = i;
+        for (; j > 0 && strcmp(sorted[j - 1].name, label.name) > 0; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = label;
+    }
+
+    size_t suffix_len = strlen(suffix);
+    size_t name_len = w->family_len + suffix_len;
+    size_t name_label_size = pb_len_field_size(8) + pb_len_field_size(name_len);
+    size_t sample_size = 1 + sizeof(double) + 1 + pb_varint_size((uint64_t)timestamp_ms);
+    size_t size = pb_len_field_size(name_label_size) + pb_labels_size(sorted, count) + pb_len_field_size(sample_size);
+
+    pb_family_len = 0;
+    if (!pb_reserve(w, pb_len_field_size(size))) {
+        return;
+    }
+    pb_put_tag(1, 2);
+    pb_put_varint(size);
+
+    pb_put_tag(1, 2);
+    pb_put_varint(name_label_size);
+    pb_put_bytes(1, "__name__", 8);
+    pb_put_tag(2, 2);
+    pb_put_varint(name_len);
+    memcpy(pb_family + pb_family_len, w->family, w->family_len);
+    memcpy(pb_family + pb_family_len + w->family_len, suffix, suffix_len);
+    pb_family_len += name_len;
+    pb_put_labels(sorted, count);
+
+    pb_put_tag(2, 2);
+    pb_put_varint(sample_size);
+    pb_put_double(1, value);
+    pb_put_tag(2, 0);
+    pb_put_varint((uint64_t)timestamp_ms);
+
+    metrics_write(w, (const char *)pb_family, pb_family_len);
+    w->samples++;
+}
+
+static void metrics_family_end(metrics_writer_t *w) {
+    if (!w->family_open) {
+        return;
+    }
+    w->family_open = false;
+    if (w->format == METRICS_FORMAT_PROTOBUF && w->err == ESP_OK) {
+        uint8_t prefix[10];
+        size_t prefix_len = 0;
+        for (uint64_t len = pb_family_len; ; len >>= 7) {
+            prefix[prefix_len++] = (uint8_t)(len < 0x80 ? len : (len & 0x7F) | 0x80);
+            if (len < 0x80) {
+                break;
+            }
+        }
+        metrics_write(w, (const char *)prefix, prefix_len);
+        metrics_write(w, (const char *)pb_family, pb_family_len);
+    }
+}
+
+void metrics_writer_begin(metrics_writer_t *w, httpd_req_t *req, metrics_format_t format, const char *hostname) {
+    memset(w, 0, sizeof(*w));
+    w->req = req;
+    w->format = format;
+    w->hostname = hostname;
+    w->err = ESP_OK;
+
+    // Every counter here starts at boot
+    if (g_ntp_initialized) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        w->created_s = tv.tv_sec - esp_timer_get_time() / 1000000;
+    }
+
+    httpd_resp_set_status(req, HTTPD_200);
+    switch (format) {
+    case METRICS_FORMAT_OPENMETRICS:
+        httpd_resp_set_type(req, "application/openmetrics-text; version=1.0.0; charset=utf-8");
+        break;
+    case METRICS_FORMAT_PROTOBUF:
+        httpd_resp_set_type(req, "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited");
+        break;
+    default:
+        httpd_resp_set_type(req, "text/plain; version=0.0.4");
+        break;
+    }
+    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+}
+
+void metrics_writer_begin_buffer(metrics_writer_t *w, metrics_format_t format, const char *hostname) {
+    memset(w, 0, sizeof(*w));
+    w->format = format;
+    w->hostname = hostname;
+    w->err = ESP_OK;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    w->timestamp_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    if (g_ntp_initialized) {
+        w->created_s = tv.tv_sec - esp_timer_get_time() / 1000000;
+    }
+}
+
+void metrics_family(metrics_writer_t *w, const char *name, metric_type_t type, const char *unit, const char *help) {
+    metrics_family_end(w);
+    w->family = name;
+    w->family_len = strlen(name);
+    w->type = type;
+    w->family_open = true;
+
+    switch (w->format) {
+    case METRICS_FORMAT_PROTOBUF:
+        pb_family_begin(w, name, w->family_len, help, strlen(help), type);
+        break;
+    case METRICS_FORMAT_REMOTE_WRITE:
+        // remote_write has no metadata; each series carries the name
+        break;
+    case METRICS_FORMAT_OPENMETRICS:
+        // OpenMetrics counter families are named without the _total suffix
+        if (type == METRIC_COUNTER && w->family_len > 6 && strcmp(name + w->family_len - 6, "_total") == 0) {
+            w->family_len -= 6;
+        }
+        metrics_printf(w, "# HELP %.*s %s\n# TYPE %.*s %s\n",
+                       (int)w->family_len, name, help, (int)w->family_len, name, metric_type_names[type]);
+        if (unit != NULL) {
+            metrics_printf(w, "# UNIT %.*s %s\n", (int)w->family_len, name, unit);
+        }
+        break;
+    default:
+        metrics_printf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, metric_type_names[type]);
+        break;
+    }
+}
+
+void metrics_family_pb(metrics_writer_t *w, const char *name, size_t name_len, const char *help, size_t help_len) {
+    metrics_family_end(w);
+    w->family = name;
+    w->family_len = name_len;
+    w->type = METRIC_GAUGE;
+    w->family_open = true;
+    if (w->format == METRICS_FORMAT_PROTOBUF) {
+        pb_family_begin(w, name, name_len, help, help_len, METRIC_GAUGE);
+    }
+}
+
+// Write name="value", escaping the value as the exposition format requires.
+// Values include free text such as BTHome device names.
+static void metrics_text_label(metrics_writer_t *w, const char *sep, const char *name, const char *value) {
+    metrics_printf(w, "%s%s=\"", sep, name);
+    const char *run = value;
+    for (const char *p = value; *p; p++) {
+        const char *escape = *p == '\\' ? "\\\\" : *p == '"' ? "\\\"" : *p == '\n' ? "\\n" : NULL;
+        if (escape != NULL) {
+            metrics_write(w, run, p - run);
+            metrics_write(w, escape, 2);
+            run = p + 1;
+        }
+    }
+    metrics_write(w, run, strlen(run));
+    metrics_write(w, "\"", 1);
+}
+
+static void metrics_text_series(metrics_writer_t *w, const char *suffix, const char *label_name, const char *label_value) {
+    metrics_printf(w, "%.*s%s{", (int)w->family_len, w->family, suffix);
+    metrics_text_label(w, "", "hostname", w->hostname);
+    if (label_name != NULL) {
+        metrics_text_label(w, ",", label_name, label_value);
+    }
+    metrics_write(w, "} ", 2);
+}
+
+// Series with any number of labels after hostname, plus an le label for histogram buckets
+static void metrics_text_labels(metrics_writer_t *w, const char *suffix, const metrics_label_t *labels,
+                                int label_count, const char *le) {
+    metrics_printf(w, "%.*s%s{", (int)w->family_len, w->family, suffix);
+    metrics_text_label(w, "", "hostname", w->hostname);
+    for (int i = 0; i < label_count; i++) {
+        metrics_text_label(w, ",", labels[i].name, labels[i].value);
+    }
+    if (le != NULL) {
+        metrics_printf(w, ",le=\"%s\"", le);
+    }
+    metrics_write(w, "} ", 2);
+}
+
+// Integers (counts, bytes) are written exactly, fractions with microsecond precision
+// Histogram bound in canonical float form, so le="1.0" matches across scrapers
+static void metrics_format_le(char *le, size_t size, double bound) {
+    int len = snprintf(le, size, "%g", bound);
+    if (strpbrk(le, ".e") == NULL && len + 2 < (int)size) {
+        strcat(le, ".0");
+    }
+}
+
+static void metrics_text_number(metrics_writer_t *w, double value) {
+    if (fabs(value) < 1e15 && value == floor(value)) {
+        metrics_printf(w, "%" PRId64 "\n", (int64_t)value);
+    } else {
+        metrics_printf(w, "%.6f\n", value);
+    }
+}
+
+void metrics_value(metrics_writer_t *w, const char *label_name, const char *label_value, double value) {
+    if (w->format == METRICS_FORMAT_PROTOBUF) {
+        metrics_label_t labels[] = {
+            { "hostname", w->hostname },
+            { label_name, label_value },
+        };
+        pb_metric(w, labels, label_name != NULL ? 2 : 1, w->type, value, 0, 0);
+        return;
+    }
+    if (w->format == METRICS_FORMAT_REMOTE_WRITE) {
+        metrics_label_t labels[] = { { label_name, label_value } };
+        rw_series(w, "", labels, label_name != NULL ? 1 : 0, true, NULL, value, w->timestamp_ms);
+        return;
+    }
+
+    if (w->format == METRICS_FORMAT_OPENMETRICS && w->type == METRIC_COUNTER) {
+        metrics_text_series(w, "_total", label_name, label_value);
+        metrics_text_number(w, value);
+        if (w->created_s > 0) {
+            metrics_text_series(w, "_created", label_name, label_value);
+            metrics_printf(w, "%" PRId64 "\n", w->created_s);
+        }
+        return;
+    }
+
+    metrics_text_series(w, "", label_name, label_value);
+    metrics_text_number(w, value);
+}
+
+void metrics_summary(metrics_writer_t *w, uint64_t count, double sum) {
+    if (w->format == METRICS_FORMAT_PROTOBUF) {
+        metrics_label_t labels[] = { { "hostname", w->hostname } };
+        pb_metric(w, labels, 1, METRIC_SUMMARY, sum, count, 0);
+        return;
+    }
+    if (w->format == METRICS_FORMAT_REMOTE_WRITE) {
+        rw_series(w, "_sum", NULL, 0, true, NULL, sum, w->timestamp_ms);
+        rw_series(w, "_count", NULL, 0, true, NULL, count, w->timestamp_ms);
+        return;
+    }
+    metrics_text_series(w, "_sum", NULL, NULL);
+    metrics_printf(w, "%.6f\n", sum);
+    metrics_text_series(w, "_count", NULL, NULL);
+    metrics_printf(w, "%" PRIu64 "\n", count);
+}
+
+void metrics_value_labels(metrics_writer_t *w, const metrics_label_t *labels, int label_count, double value) {
+    if (w->format == METRICS_FORMAT_PROTOBUF) {
+        metrics_label_t pb_labels[METRICS_MAX_LABELS + 1] = { { "hostname", w->hostname } };
+        label_count = label_count < METRICS_MAX_LABELS ? label_count : METRICS_MAX_LABELS;
+        memcpy(&pb_labels[1], labels, label_count * sizeof(metrics_label_t));
+        pb_metric(w, pb_labels, label_count + 1, w->type, value, 0, 0);
+        return;
+    }
+    if (w->format == METRICS_FORMAT_REMOTE_WRITE) {
+        rw_series(w, "", labels, label_count, true, NULL, value, w->timestamp_ms);
+        return;
+    }
+
+    if (w->format == METRICS_FORMAT_OPENMETRICS && w->type == METRIC_COUNTER) {
+        metrics_text_labels(w, "_total", labels, label_count, NULL);
+        metrics_text_number(w, value);
+        if (w->created_s > 0) {
+            metrics_text_labels(w, "_created", labels, label_count, NULL);
+            metrics_printf(w, "%" PRId64 "\n", w->created_s);
+        }
+        return;
+    }
+
+    metrics_text_labels(w, "", labels, label_count, NULL);
+    metrics_text_number(w, value);
+}
+
+void metrics_histogram(metrics_writer_t *w, const metrics_label_t *labels, int label_count,
+                       const double *bounds, const uint64_t *cumulative, int bucket_count,
+                       uint64_t count, double sum) {
+    if (w->format == METRICS_FORMAT_PROTOBUF) {
+        metrics_label_t pb_labels[METRICS_MAX_LABELS + 1] = { { "hostname", w->hostname } };
+        label_count = label_count < METRICS_MAX_LABELS ? label_count : METRICS_MAX_LABELS;
+        memcpy(&pb_labels[1], labels, label_count * sizeof(metrics_label_t));
+        pb_histogram(w, pb_labels, label_count + 1, bounds, cumulative, bucket_count, count, sum);
+        return;
+    }
+
+    char le[16];
+    if (w->format == METRICS_FORMAT_REMOTE_WRITE) {
+        for (int i = 0; i < bucket_count; i++) {
+            metrics_format_le(le, sizeof(le), bounds[i]);
+            rw_series(w, "_bucket", labels, label_count, true, le, cumulative[i], w->timestamp_ms);
+        }
+        rw_series(w, "_bucket", labels, label_count, true, "+Inf", count, w->timestamp_ms);
+        rw_series(w, "_sum", labels, label_count, true, NULL, sum, w->timestamp_ms);
+        rw_series(w, "_count", labels, label_count, true, NULL, count, w->timestamp_ms);
+        return;
+    }
+
+    for (int i = 0; i < bucket_count; i++) {
+        metrics_format_le(le, sizeof(le), bounds[i]);
+        metrics_text_labels(w, "_bucket", labels, label_count, le);
+        metrics_printf(w, "%" PRIu64 "\n", cumulative[i]);
+    }
+    metrics_text_labels(w, "_bucket", labels, label_count, "+Inf");
+    metrics_printf(w, "%" PRIu64 "\n", count);
+    metrics_text_labels(w, "_sum", labels, label_count, NULL);
+    metrics_printf(w, "%.6f\n", sum);
+    metrics_text_labels(w, "_count", labels, label_count, NULL);
+    metrics_printf(w, "%" PRIu64 "\n", count);
+    if (w->format == METRICS_FORMAT_OPENMETRICS && w->created_s > 0) {
+        metrics_text_labels(w, "_created", labels, label_count, NULL);
+        metrics_printf(w, "%" PRId64 "\n", w->created_s);
+    }
+}
+
+void metrics_pb_gauge(metrics_writer_t *w, const metrics_label_t *labels, int label_count, double value, int64_t timestamp_ms) {
+    if (w->format == METRICS_FORMAT_REMOTE_WRITE) {
+        rw_series(w, "", labels, label_count, false, NULL, value, timestamp_ms > 0 ? timestamp_ms : w->timestamp_ms);
+        return;
+    }
+    pb_metric(w, labels, label_count, METRIC_GAUGE, value, 0, timestamp_ms);
+}
+
+esp_err_t metrics_writer_end(metrics_writer_t *w) {
+    metrics_family_end(w);
+    if (w->format == METRICS_FORMAT_OPENMETRICS) {
+        metrics_write(w, "# EOF\n", 6);
+    }
+    metrics_flush(w);
+    if (w->err == ESP_OK && w->req != NULL) {
+        w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+    }
+    return w->err;
+}
@@ -0,0 +1,193 @@
+#ifndef METRICS_WRITER_H
+#define METRICS_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// Exposition formats served on /metrics, chosen from the Accept header
+typedef enum {
+    METRICS_FORMAT_TEXT,            // Prometheus text 0.0.4
+    METRICS_FORMAT_OPENMETRICS,     // OpenMetrics text 1.0.0
+    METRICS_FORMAT_PROTOBUF,        // io.prometheus.client.MetricFamily, varint-delimited
+    METRICS_FORMAT_REMOTE_WRITE,    // prometheus.WriteRequest, uncompressed; buffer writers only
+} metrics_format_t;
+
+// Values match the protobuf MetricType enum
+typedef enum {
+    METRIC_COUNTER = 0,
+    METRIC_GAUGE = 1,
+    METRIC_SUMMARY = 2,
+    METRIC_HISTOGRAM = 4,
+} metric_type_t;
+
+// Most labels a series can have besides hostname
+#define METRICS_MAX_LABELS 4
+
+typedef struct {
+    const char *name;
+    const char *value;
+} metrics_label_t;
+
+// Streams one /metrics response with chunked encoding through a small static
+// buffer, or collects the output in a heap buffer. Only the httpd task renders
+// metrics, so there is one writer at a time.
+typedef struct {
+    httpd_req_t *req;           // NULL when writing to buf
+    metrics_format_t format;
+    const char *hostname;
+    int64_t created_s;          // Unix time the counters started (boot), 0 if the clock isn't set
+    const char *family;         // Current family name, as in the text format
+    size_t family_len;          // Length of the family name in OpenMetrics (counters drop _total)
+    metric_type_t type;
+    bool family_open;
+    size_t len;                 // Bytes buffered
+    size_t total;               // Bytes sent so far
+    int64_t send_us;            // Time spent in httpd_resp_send_chunk
+    esp_err_t err;              // First send error; later writes are dropped
+    uint8_t *buf;               // Output of buffer writers, allocated with ALLOC_METRICS
+    size_t buf_size;
+    int64_t timestamp_ms;       // remote_write sample time
+    uint32_t samples;           // remote_write samples written
+} metrics_writer_t;
+
+/**
+ * @brief Pick the exposition format from the request's Accept header
+ *
+ * Honors q-values; the text format is used when nothing better is accepted.
+ *
+ * @param req HTTP request
+ * @return metrics_format_t Format to respond with
+ */
+metrics_format_t metrics_negotiate_format(httpd_req_t *req);
+
+/**
+ * @brief Start a response: set status and content type for the format
+ *
+ * @param w Writer to initialize
+ * @param req HTTP request
+ * @param format Exposition format
+ * @param hostname Value of the hostname label on every series
+ */
+void metrics_writer_begin(metrics_writer_t *w, httpd_req_t *req, metrics_format_t format, const char *hostname);
+
+/**
+ * @brief Start rendering into a heap buffer instead of a response
+ *
+ * After metrics_writer_end the output is in w->buf (w->total bytes), which the
+ * caller frees with tracked_free(ALLOC_METRICS, ...).
+ *
+ * @param w Writer to initialize
+ * @param format Exposition format
+ * @param hostname Value of the hostname label on every series
+ */
+void metrics_writer_begin_buffer(metrics_writer_t *w, metrics_format_t format, const char *hostname);
+
+/**
+ * @brief Start a metric family; ends the previous one
+ *
+ * @param w Writer
+ * @param name Family name as in the Prometheus text format (counters may end in _total)
+ * @param type Metric type
+ * @param unit OpenMetrics unit; must be a suffix of the name, or NULL
+ * @param help Help text
+ */
+void metrics_family(metrics_writer_t *w, const char *name, metric_type_t type, const char *unit, const char *help);
+
+/**
+ * @brief Start a metric family whose name and help are not NUL-terminated
+ *
+ * Only used for protobuf; the text formats copy pre-rendered HELP/TYPE lines.
+ *
+ * @param w Writer
+ * @param name Family name
+ * @param name_len Length of name
+ * @param help Help text
+ * @param help_len Length of help
+ */
+void metrics_family_pb(metrics_writer_t *w, const char *name, size_t name_len, const char *help, size_t help_len);
+
+/**
+ * @brief Write a gauge or counter sample in the current family
+ *
+ * @param w Writer
+ * @param label_name Optional extra label besides hostname (can be NULL)
+ * @param label_value Value of the extra label
+ * @param value Sample value
+ */
+void metrics_value(metrics_writer_t *w, const char *label_name, const char *label_value, double value);
+
+/**
+ * @brief Write a summary without quantiles in the current family
+ *
+ * @param w Writer
+ * @param count Number of observations
+ * @param sum Sum of observations
+ */
+void metrics_summary(metrics_writer_t *w, uint64_t count, double sum);
+
+/**
+ * @brief Write a gauge or counter sample with several labels besides hostname
+ *
+ * @param w Writer
+ * @param labels Labels (at most METRICS_MAX_LABELS)
+ * @param label_count Number of labels
+ * @param value Sample value
+ */
+void metrics_value_labels(metrics_writer_t *w, const metrics_label_t *labels, int label_count, double value);
+
+/**
+ * @brief Write a histogram in the current family
+ *
+ * @param w Writer
+ * @param labels Labels besides hostname (at most METRICS_MAX_LABELS)
+ * @param label_count Number of labels
+ * @param bounds Upper bounds of the buckets, excluding +Inf
+ * @param cumulative Observations less than or equal to each bound
+ * @param bucket_count Number of bounds
+ * @param count Number of observations
+ * @param sum Sum of observations
+ */
+void metrics_histogram(metrics_writer_t *w, const metrics_label_t *labels, int label_count,
+                       const double *bounds, const uint64_t *cumulative, int bucket_count,
+                       uint64_t count, double sum);
+
+/**
+ * @brief Write a protobuf gauge sample with arbitrary labels
+ *
+ * @param w Writer
+ * @param labels Labels (values may be empty, those are skipped)
+ * @param label_count Number of labels
+ * @param value Sample value
+ * @param timestamp_ms Unix time in ms, or 0 for none
+ */
+void metrics_pb_gauge(metrics_writer_t *w, const metrics_label_t *labels, int label_count, double value, int64_t timestamp_ms);
+
+/**
+ * @brief Write raw bytes
+ *
+ * @param w Writer
+ * @param data Data
+ * @param len Length of data
+ */
+void metrics_write(metrics_writer_t *w, const char *data, size_t len);
+
+/**
+ * @brief Write formatted text
+ *
+ * @param w Writer
+ * @param fmt printf-style format
+ */
+void metrics_printf(metrics_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief End the last family and the response
+ *
+ * @param w Writer
+ * @return esp_err_t ESP_OK, or the first error sending the response
+ */
+esp_err_t metrics_writer_end(metrics_writer_t *w);
+
+#endif // METRICS_WRITER_H
@@ -0,0 +1,251 @@
+#include "mqtt_payload.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// CBOR major types and simple values
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_FLOAT32 0xfa
+#define CBOR_INDEFINITE 0x1f
+#define CBOR_BREAK 0xff
+
+// Kept free of ESP-IDF dependencies so tools/mqtt_payload_bench.c can build
+// it on the host.
+
+void mqtt_payload_begin(mqtt_payload_t *p, void *buf, size_t size, mqtt_format_t format) {
+    p->buf = buf;
+    p->size = size;
+    p->len = 0;
+    p->format = format;
+    p->need_comma = false;
+}
+
+bool mqtt_payload_ok(const mqtt_payload_t *p) {
+    // JSON needs room for snprintf's terminator
+    return p->len < p->size;
+}
+
+static void put_bytes(mqtt_payload_t *p, const void *data, size_t len) {
+    if (p->len + len <= p->size) {
+        memcpy(p->buf + p->len, data, len);
+    }
+    p->len += len;
+}
+
+static void put_byte(mqtt_payload_t *p, uint8_t byte) {
+    put_bytes(p, &byte, 1);
+}
+
+static void json_printf(mqtt_payload_t *p, const char *fmt, ...) {
+    if (p->len >= p->size) {
+        p->len++;
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    p->len += vsnprintf((char *)p->buf + p->len, p->size - p->len, fmt, args);
+    va_end(args);
+}
+
+static void json_string(mqtt_payload_t *p, const char *value);
+
+// Comma and "key": before a JSON value
+static void json_key(mqtt_payload_t *p, const char *key) {
+    if (p->need_comma) {
+        json_printf(p, ",");
+    }
+    if (key != NULL) {
+        json_string(p, key);
+        put_byte(p, ':');
+    }
+    p->need_comma = true;
+}
+
+static void cbor_head(mqtt_payload_t *p, int major, uint64_t value) {
+    uint8_t head[9];
+    size_t len;
+    head[0] = major << 5;
+    if (value < 24) {
+        head[0] |= value;
+        len = 1;
+    } else if (value <= UINT8_MAX) {
+        head[0] |= 24;
+        head[1] = value;
+        len = 2;
+    } else if (value <= UINT16_MAX) {
+        head[0] |= 25;
+        head[1] = value >> 8;
+        head[2] = value;
+        len = 3;
+    } else if (value <= UINT32_MAX) {
+        head[0] |= 26;
+        for (int i = 0; i < 4; i++) {
+            head[1 + i] = value >> (24 - 8 * i);
+        }
+        len = 5;
+    } else {
+        head[0] |= 27;
+        for (int i = 0; i < 8; i++) {
+            head[1 + i] = value >> (56 - 8 * i);
+        }
+        len = 9;
+    }
+    put_bytes(p, head, len);
+}
+
+static void cbor_text(mqtt_payload_t *p, const char *text) {
+    size_t len = strlen(text);
+    cbor_head(p, CBOR_TEXT, len);
+    put_bytes(p, text, len);
+}
+
+static void cbor_key(mqtt_payload_t *p, const char *key) {
+    if (key != NULL) {
+        cbor_text(p, key);
+    }
+}
+
+void mqtt_payload_object_begin(mqtt_payload_t *p, const char *key) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        cbor_key(p, key);
+        put_byte(p, (CBOR_MAP << 5) | CBOR_INDEFINITE);
+        return;
+    }
+    json_key(p, key);
+    json_printf(p, "{");
+    p->need_comma = false;
+}
+
+void mqtt_payload_object_end(mqtt_payload_t *p) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        put_byte(p, CBOR_BREAK);
+        return;
+    }
+    json_printf(p, "}");
+    p->need_comma = true;
+}
+
+void mqtt_payload_array_begin(mqtt_payload_t *p, const char *key) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        cbor_key(p, key);
+        put_byte(p, (CBOR_ARRAY << 5) | CBOR_INDEFINITE);
+        return;
+    }
+    json_key(p, key);
+    json_printf(p, "[");
+    p->need_comma = false;
+}
+
+void mqtt_payload_array_end(mqtt_payload_t *p) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        put_byte(p, CBOR_BREAK);
+        return;
+    }
+    json_printf(p, "]");
+    p->need_comma = true;
+}
+
+// Quoted JSON string; ", \ and control characters are escaped, as device
+// names are free text
+static void json_string(mqtt_payload_t *p, const char *value) {
+    put_byte(p, '"');
+    const char *run = value;
+    for (const char *c = value; *c; c++) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch != '"' && ch != '\\' && ch >= 0x20) {
+            continue;
+        }
+        put_bytes(p, run, c - run);
+        run = c + 1;
+        if (ch == '"' || ch == '\\') {
+            char escaped[2] = { '\\', (char)ch };
+            put_bytes(p, escaped, sizeof(escaped));
+        } else if (ch == '\n') {
+            put_bytes(p, "\\n", 2);
+        } else {
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+            put_bytes(p, escaped, 6);
+        }
+    }
+    put_bytes(p, run, strlen(run));
+    put_byte(p, '"');
+}
+
+void mqtt_payload_string(mqtt_payload_t *p, const char *key, const char *value) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        cbor_key(p, key);
+        cbor_text(p, value);
+        return;
+    }
+    json_key(p, key);
+    json_string(p, value);
+}
+
+void mqtt_payload_int(mqtt_payload_t *p, const char *key, int64_t value) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        cbor_key(p, key);
+        if (value >= 0) {
+            cbor_head(p, CBOR_UINT, (uint64_t)value);
+        } else {
+            cbor_head(p, CBOR_NEGINT, (uint64_t)(-1 - value));
+        }
+        return;
+    }
+    json_key(p, key);
+    json_printf(p, "%lld", (long long)value);
+}
+
+void mqtt_payload_float(mqtt_payload_t *p, const char *key, float value) {
+    if (p->format == MQTT_FORMAT_CBOR) {
+        cbor_key(p, key);
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint8_t encoded[5] = { CBOR_FLOAT32, bits >> 24, bits >> 16, bits >> 8, bits };
+        put_bytes(p, encoded, sizeof(encoded));
+        return;
+    }
+    json_key(p, key);
+    json_printf(p, "%.2f", value);
+}
+
+void mqtt_payload_sensor(mqtt_payload_t *p, const char *key,
+                         const mqtt_payload_sensor_t *sensor, bool metadata) {
+    mqtt_payload_object_begin(p, key);
+    if (sensor->timestamp_ms > 0) {
+        mqtt_payload_int(p, "timestamp_ms", sensor->timestamp_ms);
+    }
+    mqtt_payload_string(p, "metric_name", sensor->metric_name);
+    if (metadata) {
+        mqtt_payload_string(p, "display_name", sensor->display_name);
+        mqtt_payload_string(p, "unit", sensor->unit);
+    }
+    mqtt_payload_float(p, "value", sensor->value);
+
+    // Add optional device name and ID
+    if (metadata && sensor->device_name[0] != '\0') {
+        mqtt_payload_string(p, "device_name", sensor->device_name);
+    }
+    if (sensor->device_id[0] != '\0') {
+        mqtt_payload_string(p, "device_id", sensor->device_id);
+    }
+    mqtt_payload_object_end(p);
+}
+
+void mqtt_payload_descriptor(mqtt_payload_t *p, const mqtt_payload_sensor_t *sensor) {
+    mqtt_payload_object_begin(p, NULL);
+    mqtt_payload_string(p, "metric_name", sensor->metric_name);
+    mqtt_payload_string(p, "display_name", sensor->display_name);
+    mqtt_payload_string(p, "unit", sensor->unit);
+    if (sensor->device_name[0] != '\0') {
+        mqtt_payload_string(p, "device_name", sensor->device_name);
+    }
+    if (sensor->device_id[0] != '\0') {
+        mqtt_payload_string(p, "device_id", sensor->device_id);
+    }
+    mqtt_payload_object_end(p);
+}
@@ -0,0 +1,102 @@
+#ifndef MQTT_PAYLOAD_H
+#define MQTT_PAYLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Encodings for MQTT message payloads
+typedef enum {
+    MQTT_FORMAT_JSON,
+    MQTT_FORMAT_CBOR,           // RFC 8949; maps and arrays are indefinite-length
+    MQTT_FORMAT_COUNT
+} mqtt_format_t;
+
+// Writes one message as JSON or CBOR. Nothing is written past the buffer;
+// once it's full len grows past size, which mqtt_payload_ok detects.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    mqtt_format_t format;
+    bool need_comma;            // JSON: a value precedes this one at the same level
+} mqtt_payload_t;
+
+// Fields of a sensor reading; strings may be "" but not NULL
+typedef struct {
+    const char *metric_name;
+    const char *display_name;
+    const char *unit;
+    const char *device_name;
+    const char *device_id;
+    float value;
+    int64_t timestamp_ms;       // Unix time in ms (0 = omit)
+} mqtt_payload_sensor_t;
+
+/**
+ * @brief Start a payload in buf
+ *
+ * @param p Payload
+ * @param buf Destination buffer
+ * @param size Buffer size
+ * @param format Encoding
+ */
+void mqtt_payload_begin(mqtt_payload_t *p, void *buf, size_t size, mqtt_format_t format);
+
+/**
+ * @brief Check that everything written so far fit in the buffer
+ *
+ * @param p Payload
+ * @return true if p->len bytes of buf are a valid prefix of the message
+ */
+bool mqtt_payload_ok(const mqtt_payload_t *p);
+
+/**
+ * @brief Open an object, as a member of the enclosing object if key is set
+ *
+ * @param p Payload
+ * @param key Member name, or NULL at top level or in an array
+ */
+void mqtt_payload_object_begin(mqtt_payload_t *p, const char *key);
+void mqtt_payload_object_end(mqtt_payload_t *p);
+
+/**
+ * @brief Open an array, as a member of the enclosing object if key is set
+ *
+ * @param p Payload
+ * @param key Member name, or NULL at top level or in an array
+ */
+void mqtt_payload_array_begin(mqtt_payload_t *p, const char *key);
+void mqtt_payload_array_end(mqtt_payload_t *p);
+
+// Scalar members; key is NULL for array elements. JSON strings are escaped,
+// as device names are free text.
+void mqtt_payload_string(mqtt_payload_t *p, const char *key, const char *value);
+void mqtt_payload_int(mqtt_payload_t *p, const char *key, int64_t value);
+
+/**
+ * @brief Write a float: two decimals in JSON, single precision in CBOR
+ */
+void mqtt_payload_float(mqtt_payload_t *p, const char *key, float value);
+
+/**
+ * @brief Write a sensor reading object
+ *
+ * @param p Payload
+ * @param key Member name, or NULL in an array
+ * @param sensor Reading
+ * @param metadata Include display name, unit and device name; without them
+ *                 the reading is identified by metric name and device ID only
+ */
+void mqtt_payload_sensor(mqtt_payload_t *p, const char *key,
+                         const mqtt_payload_sensor_t *sensor, bool metadata);
+
+/**
+ * @brief Write a sensor's descriptor: the static fields of its readings
+ *
+ * @param p Payload
+ * @param sensor Sensor; value and timestamp are ignored
+ */
+void mqtt_payload_descriptor(mqtt_payload_t *p, const mqtt_payload_sensor_t *sensor);
+
+#endif // MQTT_PAYLOAD_H
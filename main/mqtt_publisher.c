@@ -1,9 +1,12 @@
 #include "mqtt_publisher.h"
 #include "sensors.h"
 #include "wifi.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
+#include "tracked_mutex.h"
+#include "mqtt_payload.h"
 #include <esp_log.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <esp_timer.h>
@@ -18,13 +21,331 @@ static const char *TAG = "mqtt_publisher";
 static esp_mqtt_client_handle_t mqtt_client = NULL;
 static settings_t *mqtt_settings = NULL;
 static bool mqtt_connected = false;
-static char *json_buffer = NULL;
-static size_t json_buffer_size = 1024;
-static SemaphoreHandle_t json_mutex = NULL;
 static char last_error[256] = "";
-static SemaphoreHandle_t error_mutex = NULL;
+static tracked_mutex_t *error_mutex = NULL;
 static TaskHandle_t mqtt_status_task_handle = NULL;
 
+// Publish counters per kind of message
+typedef struct {
+    atomic_uint attempted;
+    atomic_uint succeeded;
+    atomic_uint failed;
+    atomic_uint_fast64_t bytes;
+} mqtt_publish_counters_t;
+
+static mqtt_publish_counters_t publish_counters[MQTT_PUBLISH_KIND_COUNT];
+
+// Pool of buffers that sensor, replay and status messages are encoded in.
+// A publisher takes any free buffer, so publishers only wait for each other
+// if more than MQTT_ENCODE_BUFFERS encode at once.
+#define MQTT_ENCODE_BUFFER_SIZE 1024
+static char *encode_buffers[MQTT_ENCODE_BUFFERS];
+static atomic_uint encode_free_mask;           // Bit i set when encode_buffers[i] is free
+static SemaphoreHandle_t encode_free = NULL;   // Counts free buffers
+static mqtt_encode_stats_t encode_stats;
+static portMUX_TYPE encode_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// QoS 1 messages awaiting PUBACK. The semaphore counts free slots in the
+// window: a slot is reserved before publishing and freed by the PUBACK, so
+// esp-mqtt's outbox never holds more than the window.
+#define MQTT_INFLIGHT_EXPIRE_MS 30000      // esp-mqtt's outbox expiry
+#define MQTT_RETRANSMIT_TIMEOUT_MS 1000
+
+typedef struct {
+    int msg_id;                 // 0 = free
+    int64_t sent_us;
+} mqtt_inflight_t;
+
+static mqtt_inflight_t inflight[MQTT_INFLIGHT_MAX];
+
+// PUBACKs handled before mqtt_inflight_sent recorded their message, which
+// can happen as soon as esp_mqtt_client_publish returns. The oldest is
+// overwritten when full.
+typedef struct {
+    int msg_id;                 // 0 = free
+    int64_t acked_us;
+} mqtt_early_ack_t;
+
+static mqtt_early_ack_t early_acks[MQTT_INFLIGHT_MAX];
+static int early_ack_next = 0;
+static SemaphoreHandle_t inflight_free = NULL;
+static uint32_t inflight_window = 0;
+static mqtt_qos_stats_t qos_stats;
+static portMUX_TYPE inflight_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Batched messages are encoded by the batch task alone, in their own buffer
+static char *batch_buffer = NULL;
+static size_t batch_buffer_size = 0;
+
+// Batch buffer space per sensor
+#define MQTT_BATCH_BYTES_PER_SENSOR 256
+
+// Notification bits for the batch task
+#define MQTT_BATCH_STARTED 0x1
+#define MQTT_BATCH_FULL 0x2
+
+// Sensor updates waiting for the next batched message. Each sensor is queued
+// once; its latest value is read when the batch is sent.
+static int batch_ids[MQTT_BATCH_MAX_SENSORS];
+static int batch_len = 0;
+static bool batch_queued[MAX_SENSORS];
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t mqtt_batch_task_handle = NULL;
+
+static struct {
+    atomic_uint flushes_window;
+    atomic_uint flushes_size;
+    atomic_uint coalesced;
+    atomic_uint dropped;
+    atomic_uint_fast64_t sensors;
+} batch_counters;
+
+static void mqtt_batch_flush(bool full);
+
+// A sensor reading kept while the broker is unreachable. Names come from the
+// sensor when it's replayed; the wall clock time is derived from updated_us
+// then, so readings taken before NTP sync still get their original time.
+typedef struct {
+    int64_t updated_us;         // esp_timer time of the reading
+    float value;
+    uint16_t sensor_id;
+} mqtt_offline_reading_t;
+
+// Ring of readings, oldest first; the oldest is overwritten when full. Also
+// the queue QoS 1 sensor readings wait in while the in-flight window is full,
+// so it's allocated with QoS 1 even if offline buffering is off.
+#define MQTT_QOS_QUEUE_READINGS 64
+static mqtt_offline_reading_t *offline_buffer = NULL;
+static uint32_t offline_capacity = 0;
+static uint32_t offline_head = 0;
+static uint32_t offline_count = 0;
+static uint32_t offline_removed = 0;   // Readings ever removed from the head
+static portMUX_TYPE offline_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t mqtt_replay_task_handle = NULL;
+
+// Readings buffered before the broker last connected; only these are
+// replayed at the limited rate
+static atomic_uint replay_backlog;
+
+static struct {
+    atomic_uint buffered;
+    atomic_uint replayed;
+    atomic_uint dropped;
+} offline_counters;
+
+static esp_err_t mqtt_replay_reading(const mqtt_offline_reading_t *reading);
+
+// Retained sensor descriptors: the broker connection they were last
+// published on, so each is sent once per connection
+#define MQTT_DESCRIPTOR_MAX_SIZE 384
+#define MQTT_DESCRIPTOR_TOPIC_MAX_LEN 160
+static atomic_uint connect_generation;
+static atomic_uint sensor_described[MAX_SENSORS];
+
+static mqtt_format_t mqtt_format(void)
+{
+    return mqtt_settings->mqtt_format == MQTT_FORMAT_CBOR ? MQTT_FORMAT_CBOR : MQTT_FORMAT_JSON;
+}
+
+// Take a free encode buffer, waiting up to a second if all are in use
+static char *mqtt_encode_buffer_acquire(void)
+{
+    if (encode_free == NULL) {
+        return NULL;
+    }
+    
+    // Uncontended acquisitions only cost the try
+    if (xSemaphoreTake(encode_free, 0) != pdTRUE) {
+        int64_t start_us = esp_timer_get_time();
+        bool taken = xSemaphoreTake(encode_free, pdMS_TO_TICKS(1000)) == pdTRUE;
+        uint32_t wait_us = (uint32_t)(esp_timer_get_time() - start_us);
+        
+        taskENTER_CRITICAL(&encode_stats_lock);
+        encode_stats.exhausted++;
+        if (!taken) {
+            encode_stats.timeouts++;
+        }
+        encode_stats.wait_us += wait_us;
+        if (wait_us > encode_stats.wait_max_us) {
+            encode_stats.wait_max_us = wait_us;
+        }
+        taskEXIT_CRITICAL(&encode_stats_lock);
+        if (!taken) {
+            return NULL;
+        }
+    }
+    
+    // The semaphore reserved a buffer for this caller; claim a free one
+    unsigned int mask = atomic_load(&encode_free_mask);
+    int index;
+    do {
+        index = __builtin_ctz(mask);
+    } while (!atomic_compare_exchange_weak(&encode_free_mask, &mask, mask & ~(1u << index)));
+    
+    taskENTER_CRITICAL(&encode_stats_lock);
+    encode_stats.acquisitions++;
+    taskEXIT_CRITICAL(&encode_stats_lock);
+    return encode_buffers[index];
+}
+
+static void mqtt_encode_buffer_release(char *buffer)
+{
+    for (int i = 0; i < MQTT_ENCODE_BUFFERS; i++) {
+        if (encode_buffers[i] == buffer) {
+            atomic_fetch_or(&encode_free_mask, 1u << i);
+            xSemaphoreGive(encode_free);
+            return;
+        }
+    }
+}
+
+// QoS for a kind of message
+static int mqtt_qos(mqtt_publish_kind_t kind)
+{
+    if (inflight_free == NULL) {
+        return 0;
+    }
+    uint8_t qos = kind == MQTT_PUBLISH_STATUS ? mqtt_settings->mqtt_status_qos
+                                               : mqtt_settings->mqtt_sensor_qos;
+    return qos > 0 ? 1 : 0;
+}
+
+// Record a PUBACK's latency. Caller must hold inflight_lock.
+static void mqtt_inflight_count_ack(int64_t sent_us, int64_t acked_us)
+{
+    uint32_t ack_us = acked_us > sent_us ? (uint32_t)(acked_us - sent_us) : 0;
+    qos_stats.acked++;
+    qos_stats.ack_us += ack_us;
+    if (ack_us > qos_stats.ack_max_us) {
+        qos_stats.ack_max_us = ack_us;
+    }
+    // Late enough that esp-mqtt may have resent it
+    if (ack_us >= MQTT_RETRANSMIT_TIMEOUT_MS * 1000) {
+        qos_stats.late_acks++;
+    }
+}
+
+// Free a message's window slot; returns false if it isn't in the window
+static bool mqtt_inflight_release(int msg_id, bool acked)
+{
+    bool found = false;
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&inflight_lock);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        if (inflight[i].msg_id != msg_id) {
+            continue;
+        }
+        inflight[i].msg_id = 0;
+        found = true;
+        if (acked) {
+            mqtt_inflight_count_ack(inflight[i].sent_us, now_us);
+        } else {
+            qos_stats.expired++;
+        }
+        break;
+    }
+    if (!found && acked) {
+        // Not recorded yet; mqtt_inflight_sent frees the slot instead
+        early_acks[early_ack_next].msg_id = msg_id;
+        early_acks[early_ack_next].acked_us = now_us;
+        early_ack_next = (early_ack_next + 1) % MQTT_INFLIGHT_MAX;
+    }
+    taskEXIT_CRITICAL(&inflight_lock);
+    
+    if (found) {
+        xSemaphoreGive(inflight_free);
+    }
+    return found;
+}
+
+// Free the slots of messages esp-mqtt has dropped from its outbox by now
+static void mqtt_inflight_expire(void)
+{
+    int64_t cutoff_us = esp_timer_get_time() - MQTT_INFLIGHT_EXPIRE_MS * 1000LL;
+    int expired = 0;
+    taskENTER_CRITICAL(&inflight_lock);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        if (inflight[i].msg_id != 0 && inflight[i].sent_us < cutoff_us) {
+            inflight[i].msg_id = 0;
+            expired++;
+        }
+    }
+    qos_stats.expired += expired;
+    taskEXIT_CRITICAL(&inflight_lock);
+    
+    for (int i = 0; i < expired; i++) {
+        xSemaphoreGive(inflight_free);
+    }
+}
+
+// Reserve a window slot, waiting up to wait for a PUBACK to free one
+static bool mqtt_inflight_reserve(TickType_t wait)
+{
+    if (xSemaphoreTake(inflight_free, 0) == pdTRUE) {
+        return true;
+    }
+    mqtt_inflight_expire();
+    if (xSemaphoreTake(inflight_free, wait) == pdTRUE) {
+        return true;
+    }
+    taskENTER_CRITICAL(&inflight_lock);
+    qos_stats.window_full++;
+    taskEXIT_CRITICAL(&inflight_lock);
+    return false;
+}
+
+// Record a message published in a reserved slot at sent_us, taken just
+// before publishing. Gives the slot back if the publish failed or its PUBACK
+// has already arrived.
+static void mqtt_inflight_sent(int msg_id, int64_t sent_us)
+{
+    if (msg_id <= 0) {
+        xSemaphoreGive(inflight_free);
+        return;
+    }
+    bool acked = false;
+    taskENTER_CRITICAL(&inflight_lock);
+    // An early PUBACK for an earlier message with a reused ID predates sent_us
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        if (early_acks[i].msg_id == msg_id && early_acks[i].acked_us >= sent_us) {
+            early_acks[i].msg_id = 0;
+            mqtt_inflight_count_ack(sent_us, early_acks[i].acked_us);
+            acked = true;
+            break;
+        }
+    }
+    for (int i = 0; i < MQTT_INFLIGHT_MAX && !acked; i++) {
+        if (inflight[i].msg_id == 0) {
+            inflight[i].msg_id = msg_id;
+            inflight[i].sent_us = sent_us;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&inflight_lock);
+    
+    if (acked) {
+        xSemaphoreGive(inflight_free);
+    }
+}
+
+// Publish an encoded message with the QoS configured for its kind. QoS 1
+// messages wait up to wait for room in the in-flight window; returns
+// ESP_ERR_TIMEOUT if there was none.
+static esp_err_t mqtt_send(mqtt_publish_kind_t kind, const char *topic, const mqtt_payload_t *p,
+                           int retain, TickType_t wait, int *msg_id)
+{
+    int qos = mqtt_qos(kind);
+    if (qos > 0 && !mqtt_inflight_reserve(wait)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    int64_t sent_us = esp_timer_get_time();
+    *msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)p->buf, p->len, qos, retain);
+    if (qos > 0) {
+        mqtt_inflight_sent(*msg_id, sent_us);
+    }
+    return *msg_id < 0 ? ESP_FAIL : ESP_OK;
+}
+
 static void mqtt_status_task(void *pvParameters)
 {
     const TickType_t delay = pdMS_TO_TICKS(30000); // 30 seconds
@@ -43,6 +364,145 @@ static void mqtt_status_task(void *pvParameters)
     }
 }
 
+static void mqtt_batch_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "MQTT batch task started (window %u ms, up to %u sensors)",
+             mqtt_settings->mqtt_batch_window_ms, mqtt_settings->mqtt_batch_max);
+    
+    while (1) {
+        // Sleep until the first update of a batch arrives
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        
+        // Then collect updates until the window ends or the batch fills
+        if (!(bits & MQTT_BATCH_FULL)) {
+            bits = 0;
+            xTaskNotifyWait(0, UINT32_MAX, &bits, pdMS_TO_TICKS(mqtt_settings->mqtt_batch_window_ms));
+        }
+        mqtt_batch_flush((bits & MQTT_BATCH_FULL) != 0);
+    }
+}
+
+static uint32_t mqtt_offline_pending(void)
+{
+    taskENTER_CRITICAL(&offline_lock);
+    uint32_t count = offline_count;
+    taskEXIT_CRITICAL(&offline_lock);
+    return count;
+}
+
+// Copy the oldest reading; seq identifies it for mqtt_offline_pop
+static bool mqtt_offline_peek(mqtt_offline_reading_t *reading, uint32_t *seq)
+{
+    bool found = false;
+    taskENTER_CRITICAL(&offline_lock);
+    if (offline_count > 0) {
+        *reading = offline_buffer[offline_head];
+        *seq = offline_removed;
+        found = true;
+    }
+    taskEXIT_CRITICAL(&offline_lock);
+    return found;
+}
+
+// Remove the oldest reading, unless it was already overwritten since the peek
+static void mqtt_offline_pop(uint32_t seq)
+{
+    taskENTER_CRITICAL(&offline_lock);
+    if (offline_count > 0 && offline_removed == seq) {
+        offline_head = (offline_head + 1) % offline_capacity;
+        offline_count--;
+        offline_removed++;
+    }
+    taskEXIT_CRITICAL(&offline_lock);
+}
+
+// Keep a sensor's current reading for replay after reconnecting
+static esp_err_t mqtt_offline_store(int sensor_id)
+{
+    sensor_data_t snapshot;
+    if (!sensors_read_snapshot(sensor_id, &snapshot) || snapshot.metric_name[0] == '\0') {
+        return ESP_FAIL;
+    }
+    if (!snapshot.available || snapshot.updated_us == 0) {
+        return ESP_OK;
+    }
+    
+    bool dropped = false;
+    taskENTER_CRITICAL(&offline_lock);
+    if (offline_count == offline_capacity) {
+        offline_head = (offline_head + 1) % offline_capacity;
+        offline_count--;
+        offline_removed++;
+        dropped = true;
+    }
+    mqtt_offline_reading_t *reading = &offline_buffer[(offline_head + offline_count) % offline_capacity];
+    reading->updated_us = snapshot.updated_us;
+    reading->value = snapshot.value;
+    reading->sensor_id = (uint16_t)sensor_id;
+    offline_count++;
+    taskEXIT_CRITICAL(&offline_lock);
+    
+    atomic_fetch_add(&offline_counters.buffered, 1);
+    if (dropped) {
+        atomic_fetch_add(&offline_counters.dropped, 1);
+    }
+    
+    // Stored behind a replay in progress; make sure it isn't left behind
+    if (mqtt_connected) {
+        xTaskNotifyGive(mqtt_replay_task_handle);
+    }
+    return ESP_OK;
+}
+
+static void mqtt_replay_task(void *pvParameters)
+{
+    TickType_t interval = pdMS_TO_TICKS(1000 / mqtt_settings->mqtt_replay_rate);
+    if (interval == 0) {
+        interval = 1;
+    }
+    
+    ESP_LOGI(TAG, "MQTT replay task started (%u readings buffered at most, %u/s)",
+             mqtt_settings->mqtt_offline_max, mqtt_settings->mqtt_replay_rate);
+    
+    while (1) {
+        // Sleep until the broker connects, or a reading is stored while connected
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        uint32_t backlog = atomic_exchange(&replay_backlog, 0);
+        if (backlog > 0) {
+            ESP_LOGI(TAG, "Replaying %lu buffered sensor readings", (unsigned long)backlog);
+        }
+        
+        TickType_t last_wake = xTaskGetTickCount();
+        mqtt_offline_reading_t reading;
+        uint32_t seq;
+        while (mqtt_connected && mqtt_offline_peek(&reading, &seq)) {
+            esp_err_t err = mqtt_replay_reading(&reading);
+            if (err == ESP_ERR_TIMEOUT) {
+                // The in-flight window stayed full; keep waiting for PUBACKs
+                last_wake = xTaskGetTickCount();
+                continue;
+            }
+            if (err == ESP_FAIL) {
+                // Keep the reading and retry while still connected
+                vTaskDelay(pdMS_TO_TICKS(1000));
+                last_wake = xTaskGetTickCount();
+                continue;
+            }
+            mqtt_offline_pop(seq);
+            if (err == ESP_OK) {
+                atomic_fetch_add(&offline_counters.replayed, 1);
+            }
+            // Spread out the reconnect burst; anything stored since goes at once
+            if (backlog > 0) {
+                backlog--;
+                vTaskDelayUntil(&last_wake, interval);
+            }
+        }
+    }
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, 
                                int32_t event_id, void *event_data)
 {
@@ -52,6 +512,11 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT connected to broker");
             mqtt_connected = true;
+            atomic_fetch_add(&connect_generation, 1);
+            if (mqtt_replay_task_handle != NULL) {
+                atomic_store(&replay_backlog, mqtt_offline_pending());
+                xTaskNotifyGive(mqtt_replay_task_handle);
+            }
             break;
             
         case MQTT_EVENT_DISCONNECTED:
@@ -59,9 +524,22 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
             mqtt_connected = false;
             break;
             
+        case MQTT_EVENT_PUBLISHED:
+            if (inflight_free != NULL) {
+                mqtt_inflight_release(event->msg_id, true);
+            }
+            break;
+            
+        case MQTT_EVENT_DELETED:
+            // Expired from the outbox without a PUBACK
+            if (inflight_free != NULL) {
+                mqtt_inflight_release(event->msg_id, false);
+            }
+            break;
+            
         case MQTT_EVENT_ERROR:
             ESP_LOGE(TAG, "MQTT error occurred");
-            if (error_mutex != NULL && xSemaphoreTake(error_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+            if (error_mutex != NULL && tracked_mutex_take(error_mutex, pdMS_TO_TICKS(100))) {
                 if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
                     snprintf(last_error, sizeof(last_error), "TCP Transport error - errno: %d (%s)",
                             event->error_handle->esp_transport_sock_errno,
@@ -79,7 +557,7 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
                     snprintf(last_error, sizeof(last_error), "MQTT error type: %d",
                             event->error_handle->error_type);
                 }
-                xSemaphoreGive(error_mutex);
+                tracked_mutex_give(error_mutex);
             }
             mqtt_connected = false;
             break;
@@ -104,28 +582,42 @@ esp_err_t mqtt_publisher_init(settings_t *settings)
     
     // Create mutex for error string
     if (error_mutex == NULL) {
-        error_mutex = xSemaphoreCreateMutex();
+        error_mutex = tracked_mutex_create("mqtt_error");
         if (error_mutex == NULL) {
             ESP_LOGE(TAG, "Failed to create error mutex");
             return ESP_FAIL;
         }
     }
     
-    // Create mutex for JSON buffer
-    if (json_mutex == NULL) {
-        json_mutex = xSemaphoreCreateMutex();
-        if (json_mutex == NULL) {
-            ESP_LOGE(TAG, "Failed to create JSON mutex");
+    // Allocate encode buffer pool
+    if (encode_free == NULL) {
+        for (int i = 0; i < MQTT_ENCODE_BUFFERS; i++) {
+            encode_buffers[i] = tracked_malloc(ALLOC_MQTT_PUBLISHER, MQTT_ENCODE_BUFFER_SIZE);
+            if (encode_buffers[i] == NULL) {
+                ESP_LOGE(TAG, "Failed to allocate MQTT encode buffers");
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        encode_free = xSemaphoreCreateCounting(MQTT_ENCODE_BUFFERS, MQTT_ENCODE_BUFFERS);
+        if (encode_free == NULL) {
+            ESP_LOGE(TAG, "Failed to create MQTT encode buffer semaphore");
             return ESP_FAIL;
         }
+        atomic_store(&encode_free_mask, (1u << MQTT_ENCODE_BUFFERS) - 1);
     }
     
-    // Allocate JSON buffer
-    if (json_buffer == NULL) {
-        json_buffer = malloc(json_buffer_size);
-        atomic_fetch_add(&malloc_count_mqtt_publisher, 1);
-        if (json_buffer == NULL) {
-            ESP_LOGE(TAG, "Failed to allocate JSON buffer");
+    // Allocate batch buffer, with room for a whole batch
+    if (settings->mqtt_batch_window_ms > 0 && batch_buffer == NULL) {
+        if (settings->mqtt_batch_max < 2 || settings->mqtt_batch_max > MQTT_BATCH_MAX_SENSORS) {
+            settings->mqtt_batch_max = MQTT_BATCH_MAX_SENSORS;
+        }
+        batch_buffer_size = settings->mqtt_batch_max * MQTT_BATCH_BYTES_PER_SENSOR;
+        if (batch_buffer_size < MQTT_ENCODE_BUFFER_SIZE) {
+            batch_buffer_size = MQTT_ENCODE_BUFFER_SIZE;
+        }
+        batch_buffer = tracked_malloc(ALLOC_MQTT_PUBLISHER, batch_buffer_size);
+        if (batch_buffer == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate MQTT batch buffer");
             return ESP_ERR_NO_MEM;
         }
     }
@@ -135,6 +627,24 @@ esp_err_t mqtt_publisher_init(settings_t *settings)
         .broker.address.uri = settings->mqtt_broker_url,
     };
     
+    // Bound QoS 1 messages awaiting PUBACK, and the outbox holding them
+    if ((settings->mqtt_sensor_qos > 0 || settings->mqtt_status_qos > 0) && inflight_free == NULL) {
+        if (settings->mqtt_inflight_max < 1 || settings->mqtt_inflight_max > MQTT_INFLIGHT_MAX) {
+            settings->mqtt_inflight_max = 8;
+        }
+        inflight_window = settings->mqtt_inflight_max;
+        inflight_free = xSemaphoreCreateCounting(inflight_window, inflight_window);
+        if (inflight_free == NULL) {
+            ESP_LOGE(TAG, "Failed to create MQTT in-flight window semaphore");
+            return ESP_FAIL;
+        }
+        size_t message_max = batch_buffer_size > MQTT_ENCODE_BUFFER_SIZE ? batch_buffer_size : MQTT_ENCODE_BUFFER_SIZE;
+        mqtt_cfg.session.message_retransmit_timeout = MQTT_RETRANSMIT_TIMEOUT_MS;
+        mqtt_cfg.outbox.limit = inflight_window * message_max;
+        ESP_LOGI(TAG, "MQTT QoS 1 window: %lu messages, outbox limit %lu bytes",
+                 (unsigned long)inflight_window, (unsigned long)mqtt_cfg.outbox.limit);
+    }
+    
     // Check if using mqtts:// and enable TLS verification
     if (strncmp(settings->mqtt_broker_url, "mqtts://", 8) == 0) {
         mqtt_cfg.broker.verification.skip_cert_common_name_check = false;
@@ -193,6 +703,60 @@ esp_err_t mqtt_publisher_init(settings_t *settings)
         }
     }
     
+    // Allocate offline buffer and start its replay task
+    bool sensor_qos1 = settings->mqtt_sensor_qos > 0 && inflight_free != NULL;
+    if ((settings->mqtt_offline_max > 0 || sensor_qos1) && offline_buffer == NULL) {
+        if (settings->mqtt_offline_max > MQTT_OFFLINE_MAX_READINGS) {
+            settings->mqtt_offline_max = MQTT_OFFLINE_MAX_READINGS;
+        }
+        if (settings->mqtt_replay_rate == 0) {
+            settings->mqtt_replay_rate = 10;
+        }
+        uint32_t capacity = settings->mqtt_offline_max > 0 ? settings->mqtt_offline_max : MQTT_QOS_QUEUE_READINGS;
+        offline_buffer = tracked_malloc(ALLOC_MQTT_PUBLISHER, capacity * sizeof(mqtt_offline_reading_t));
+        if (offline_buffer == NULL) {
+            ESP_LOGW(TAG, "Failed to allocate MQTT offline buffer; readings will be dropped while disconnected "
+                          "or the QoS 1 window is full");
+        } else {
+            offline_capacity = capacity;
+            offline_head = 0;
+            offline_count = 0;
+            BaseType_t task_created = xTaskCreate(
+                mqtt_replay_task,
+                "mqtt_replay",
+                4096,
+                NULL,
+                4,
+                &mqtt_replay_task_handle
+            );
+            
+            if (task_created != pdPASS) {
+                ESP_LOGE(TAG, "Failed to create MQTT replay task");
+                tracked_free(ALLOC_MQTT_PUBLISHER, offline_buffer);
+                offline_buffer = NULL;
+                offline_capacity = 0;
+                return ESP_FAIL;
+            }
+        }
+    }
+    
+    // Start batch task if sensor updates are batched
+    if (settings->mqtt_batch_window_ms > 0 && mqtt_batch_task_handle == NULL) {
+        BaseType_t task_created = xTaskCreate(
+            mqtt_batch_task,
+            "mqtt_batch",
+            4096,
+            NULL,
+            5,
+            &mqtt_batch_task_handle
+        );
+        
+        if (task_created != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create MQTT batch task");
+            return ESP_FAIL;
+        }
+    }
+    
     ESP_LOGI(TAG, "MQTT client initialized successfully");
     return ESP_OK;
 }
@@ -202,13 +766,18 @@ bool mqtt_is_enabled(void)
     return mqtt_client != NULL && mqtt_connected;
 }
 
+bool mqtt_offline_enabled(void)
+{
+    return mqtt_client != NULL && offline_buffer != NULL && mqtt_settings->mqtt_offline_max > 0;
+}
+
 const char* mqtt_get_last_error(void)
 {
     static char error_copy[256];
-    if (error_mutex != NULL && xSemaphoreTake(error_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+    if (error_mutex != NULL && tracked_mutex_take(error_mutex, pdMS_TO_TICKS(100))) {
         strncpy(error_copy, last_error, sizeof(error_copy) - 1);
         error_copy[sizeof(error_copy) - 1] = '\0';
-        xSemaphoreGive(error_mutex);
+        tracked_mutex_give(error_mutex);
         return error_copy;
     }
     return "";
@@ -219,6 +788,8 @@ esp_err_t mqtt_publish_status(void)
     if (!mqtt_is_enabled()) {
         return ESP_FAIL;
     }
+    mqtt_publish_counters_t *counters = &publish_counters[MQTT_PUBLISH_STATUS];
+    atomic_fetch_add(&counters->attempted, 1);
     
     // Get default topic if not configured
     const char *topic = mqtt_settings->mqtt_status_topic;
@@ -226,166 +797,497 @@ esp_err_t mqtt_publish_status(void)
         topic = "station/status";
     }
     
-    // Take mutex to protect JSON buffer
-    if (json_mutex == NULL || json_buffer == NULL) {
-        ESP_LOGE(TAG, "MQTT client not properly initialized");
+    // Encode into a buffer from the pool
+    char *buffer = mqtt_encode_buffer_acquire();
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "No MQTT encode buffer available");
+        atomic_fetch_add(&counters->failed, 1);
         return ESP_FAIL;
     }
-    
-    if (xSemaphoreTake(json_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to acquire JSON mutex");
-        return ESP_FAIL;
-    }
-    
-    // Use pre-allocated JSON buffer
-    char *json = json_buffer;
-    size_t json_size = json_buffer_size;
-    
-    int offset = 0;
-    offset += snprintf(json + offset, json_size - offset, "{");
+    mqtt_payload_t p;
+    mqtt_payload_begin(&p, buffer, MQTT_ENCODE_BUFFER_SIZE, mqtt_format());
+    mqtt_payload_object_begin(&p, NULL);
     
     // Add timestamp
     struct timeval tv_now;
     gettimeofday(&tv_now, NULL);
     int64_t timestamp_ms = (int64_t)tv_now.tv_sec * 1000LL + (int64_t)tv_now.tv_usec / 1000LL;
-    offset += snprintf(json + offset, json_size - offset, "\"timestamp\":%lld,", timestamp_ms);
+    mqtt_payload_int(&p, "timestamp", timestamp_ms);
     
     // Add hostname
     const char *hostname = (mqtt_settings->hostname != NULL && mqtt_settings->hostname[0] != '\0') 
                             ? mqtt_settings->hostname : "weight-station";
-    offset += snprintf(json + offset, json_size - offset, "\"hostname\":\"%s\",", hostname);
+    mqtt_payload_string(&p, "hostname", hostname);
     
     // Add uptime
     int64_t uptime_us = esp_timer_get_time();
     int64_t uptime_seconds = uptime_us / 1000000;
-    offset += snprintf(json + offset, json_size - offset, "\"uptime_seconds\":%lld,", uptime_seconds);
+    mqtt_payload_int(&p, "uptime_seconds", uptime_seconds);
     
     // Add WiFi RSSI
     int8_t rssi = wifi_get_rssi();
-    offset += snprintf(json + offset, json_size - offset, "\"wifi_rssi_dbm\":%d,", rssi);
+    mqtt_payload_int(&p, "wifi_rssi_dbm", rssi);
     
     // Add heap metrics
     uint32_t free_heap = esp_get_free_heap_size();
     uint32_t min_free_heap = esp_get_minimum_free_heap_size();
     uint32_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
     
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"heap_free_bytes\":%lu,", free_heap);
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"heap_min_free_bytes\":%lu,", min_free_heap);
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"heap_largest_free_block_bytes\":%lu}", largest_free_block);
-        
-    // Publish to MQTT
-    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, json, offset, 0, 0);
+    mqtt_payload_int(&p, "heap_free_bytes", free_heap);
+    mqtt_payload_int(&p, "heap_min_free_bytes", min_free_heap);
+    mqtt_payload_int(&p, "heap_largest_free_block_bytes", largest_free_block);
+    mqtt_payload_object_end(&p);
     
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to publish MQTT message");
-        xSemaphoreGive(json_mutex);
+    if (!mqtt_payload_ok(&p)) {
+        ESP_LOGE(TAG, "MQTT status message doesn't fit in the buffer");
+        mqtt_encode_buffer_release(buffer);
+        atomic_fetch_add(&counters->failed, 1);
         return ESP_FAIL;
     }
+        
+    // Publish to MQTT; skipped if the QoS 1 window is full, as another
+    // status follows shortly
+    int msg_id;
+    esp_err_t err = mqtt_send(MQTT_PUBLISH_STATUS, topic, &p, 0, 0, &msg_id);
+    mqtt_encode_buffer_release(buffer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to publish MQTT message: %s", esp_err_to_name(err));
+        atomic_fetch_add(&counters->failed, 1);
+        return err;
+    }
+    atomic_fetch_add(&counters->succeeded, 1);
+    atomic_fetch_add(&counters->bytes, p.len);
     
     ESP_LOGI(TAG, "Published sensors to MQTT topic '%s' (msg_id=%d, size=%d)", 
-             topic, msg_id, offset);
-    
-    xSemaphoreGive(json_mutex);
+             topic, msg_id, (int)p.len);
     return ESP_OK;
 }
 
-esp_err_t mqtt_publish_single_sensor(int sensor_id)
+static void mqtt_sensor_fields(const sensor_data_t *sensor, bool with_timestamp,
+                               mqtt_payload_sensor_t *fields)
 {
-    if (!mqtt_is_enabled()) {
-        return ESP_FAIL;
+    fields->metric_name = sensor->metric_name;
+    fields->display_name = sensor->display_name;
+    fields->unit = sensor->unit;
+    fields->device_name = sensor->device_name;
+    fields->device_id = sensor->device_id;
+    fields->value = sensor->value;
+    fields->timestamp_ms = with_timestamp ? sensor->last_updated_ms : 0;
+}
+
+// Publish a sensor's retained descriptor, once per connection so a broker
+// that lost it gets it again
+static void mqtt_describe_sensor(int sensor_id, const sensor_data_t *sensor)
+{
+    if (!mqtt_settings->mqtt_descriptors) {
+        return;
+    }
+    unsigned int generation = atomic_load(&connect_generation);
+    if (atomic_exchange(&sensor_described[sensor_id], generation) == generation) {
+        return;
     }
     
-    // Get default topic if not configured
-    const char *topic = mqtt_settings->mqtt_topic;
-    if (!topic || strlen(topic) == 0) {
-        topic = "station/sensor";
+    const char *base = mqtt_settings->mqtt_topic;
+    if (!base || strlen(base) == 0) {
+        base = "station/sensor";
+    }
+    char topic[MQTT_DESCRIPTOR_TOPIC_MAX_LEN];
+    int topic_len = snprintf(topic, sizeof(topic), "%s/meta/%s", base, sensor->metric_name);
+    if (sensor->device_id[0] != '\0' && topic_len < (int)sizeof(topic)) {
+        topic_len += snprintf(topic + topic_len, sizeof(topic) - topic_len, "/%s", sensor->device_id);
     }
     
-    // Take mutex to protect JSON buffer
-    if (json_mutex == NULL || json_buffer == NULL) {
-        ESP_LOGE(TAG, "MQTT client not properly initialized");
-        return ESP_FAIL;
+    mqtt_publish_counters_t *counters = &publish_counters[MQTT_PUBLISH_DESCRIPTOR];
+    atomic_fetch_add(&counters->attempted, 1);
+    uint8_t buffer[MQTT_DESCRIPTOR_MAX_SIZE];
+    mqtt_payload_t p;
+    mqtt_payload_sensor_t fields;
+    mqtt_sensor_fields(sensor, false, &fields);
+    mqtt_payload_begin(&p, buffer, sizeof(buffer), mqtt_format());
+    mqtt_payload_descriptor(&p, &fields);
+    if (topic_len >= (int)sizeof(topic) || !mqtt_payload_ok(&p)) {
+        ESP_LOGE(TAG, "Descriptor for sensor %d (%s) is too long", sensor_id, sensor->metric_name);
+        atomic_fetch_add(&counters->failed, 1);
+        return;
     }
     
-    if (xSemaphoreTake(json_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to acquire JSON mutex");
+    int msg_id;
+    if (mqtt_send(MQTT_PUBLISH_DESCRIPTOR, topic, &p, 1, 0, &msg_id) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to publish descriptor for sensor %d", sensor_id);
+        atomic_fetch_add(&counters->failed, 1);
+        // Retry with the next reading
+        atomic_store(&sensor_described[sensor_id], 0);
+        return;
+    }
+    atomic_fetch_add(&counters->succeeded, 1);
+    atomic_fetch_add(&counters->bytes, p.len);
+    ESP_LOGI(TAG, "Published descriptor to MQTT topic '%s' (msg_id=%d, size=%d)", topic, msg_id, (int)p.len);
+}
+
+// Queue a sensor for the next batched message
+static esp_err_t mqtt_batch_add(int sensor_id)
+{
+    if (sensor_id < 0 || sensor_id >= MAX_SENSORS) {
         return ESP_FAIL;
     }
     
-    // Get the sensor data
-    const sensor_data_t *sensor = sensors_get_by_index(sensor_id);
-    if (sensor == NULL || sensor->metric_name[0] == '\0') {
-        ESP_LOGW(TAG, "Sensor %d not found or has no metric name", sensor_id);
-        xSemaphoreGive(json_mutex);
+    uint32_t notify = 0;
+    bool coalesced = false;
+    bool dropped = false;
+    taskENTER_CRITICAL(&batch_lock);
+    if (batch_queued[sensor_id]) {
+        coalesced = true;
+    } else if (batch_len >= mqtt_settings->mqtt_batch_max) {
+        // The batch task hasn't picked up the full batch yet
+        dropped = true;
+    } else {
+        batch_ids[batch_len++] = sensor_id;
+        batch_queued[sensor_id] = true;
+        if (batch_len == 1) {
+            notify |= MQTT_BATCH_STARTED;
+        }
+        if (batch_len >= mqtt_settings->mqtt_batch_max) {
+            notify |= MQTT_BATCH_FULL;
+        }
+    }
+    taskEXIT_CRITICAL(&batch_lock);
+    
+    if (coalesced) {
+        atomic_fetch_add(&batch_counters.coalesced, 1);
+    }
+    if (dropped) {
+        atomic_fetch_add(&batch_counters.dropped, 1);
         return ESP_FAIL;
     }
+    if (notify != 0) {
+        xTaskNotify(mqtt_batch_task_handle, notify, eSetBits);
+    }
+    return ESP_OK;
+}
+
+// Start a batched message, up to the opening of its "sensors" array
+static void mqtt_batch_begin(mqtt_payload_t *p, int64_t timestamp_ms, const char *hostname)
+{
+    mqtt_payload_begin(p, batch_buffer, batch_buffer_size, mqtt_format());
+    mqtt_payload_object_begin(p, NULL);
+    // Seconds in "timestamp", as in single-sensor messages on the same topic
+    mqtt_payload_int(p, "timestamp", timestamp_ms / 1000);
+    mqtt_payload_int(p, "timestamp_ms", timestamp_ms);
+    mqtt_payload_string(p, "hostname", hostname);
+    mqtt_payload_array_begin(p, "sensors");
+}
+
+// Whether there's still room to close the array and object
+static bool mqtt_batch_fits(const mqtt_payload_t *p)
+{
+    return p->len + 2 < p->size;
+}
+
+// Finish and publish one batched message of the sensors in ids
+static void mqtt_batch_publish(const char *topic, mqtt_payload_t *p, int sensors,
+                               const int *ids, int count)
+{
+    mqtt_payload_array_end(p);
+    mqtt_payload_object_end(p);
     
-    // Only publish if sensor is available
-    if (!sensor->available || sensor->last_updated == 0) {
-        ESP_LOGD(TAG, "Sensor %d is not available, skipping publish", sensor_id);
-        xSemaphoreGive(json_mutex);
-        return ESP_OK;
+    mqtt_publish_counters_t *counters = &publish_counters[MQTT_PUBLISH_BATCH];
+    atomic_fetch_add(&counters->attempted, 1);
+    int msg_id;
+    esp_err_t err = mqtt_send(MQTT_PUBLISH_BATCH, topic, p, 0, 0, &msg_id);
+    if (err == ESP_ERR_TIMEOUT && offline_buffer != NULL) {
+        // The QoS 1 window is full: queue the readings like single updates
+        ESP_LOGD(TAG, "MQTT in-flight window full, queueing batch of %d sensors", sensors);
+        atomic_fetch_add(&counters->failed, 1);
+        for (int i = 0; i < count; i++) {
+            mqtt_offline_store(ids[i]);
+        }
+        return;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to publish MQTT batch of %d sensors: %s", sensors, esp_err_to_name(err));
+        atomic_fetch_add(&counters->failed, 1);
+        return;
+    }
+    atomic_fetch_add(&counters->succeeded, 1);
+    atomic_fetch_add(&counters->bytes, p->len);
+    atomic_fetch_add(&batch_counters.sensors, sensors);
+    ESP_LOGI(TAG, "Published batch of %d sensors to MQTT topic '%s' (msg_id=%d, size=%d)",
+             sensors, topic, msg_id, (int)p->len);
+}
+
+// Send every queued sensor as a "sensors" array, split across messages only
+// if the batch buffer fills
+static void mqtt_batch_flush(bool full)
+{
+    int ids[MQTT_BATCH_MAX_SENSORS];
+    int count;
+    taskENTER_CRITICAL(&batch_lock);
+    count = batch_len;
+    memcpy(ids, batch_ids, count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        batch_queued[ids[i]] = false;
+    }
+    batch_len = 0;
+    taskEXIT_CRITICAL(&batch_lock);
+    
+    if (count == 0) {
+        return;
+    }
+    atomic_fetch_add(full ? &batch_counters.flushes_size : &batch_counters.flushes_window, 1);
+    if (!mqtt_is_enabled() || batch_buffer == NULL) {
+        // The broker dropped during the window; keep the readings for replay
+        if (mqtt_offline_enabled()) {
+            for (int i = 0; i < count; i++) {
+                mqtt_offline_store(ids[i]);
+            }
+        }
+        return;
+    }
+    
+    const char *topic = mqtt_settings->mqtt_topic;
+    if (!topic || strlen(topic) == 0) {
+        topic = "station/sensor";
+    }
+    const char *hostname = (mqtt_settings->hostname != NULL && mqtt_settings->hostname[0] != '\0') 
+                            ? mqtt_settings->hostname : "station";
+    bool metadata = !mqtt_settings->mqtt_descriptors;
+    
+    struct timeval tv_now;
+    gettimeofday(&tv_now, NULL);
+    int64_t timestamp_ms = (int64_t)tv_now.tv_sec * 1000LL + (int64_t)tv_now.tv_usec / 1000LL;
+    mqtt_payload_t p;
+    mqtt_batch_begin(&p, timestamp_ms, hostname);
+    int sensors = 0;
+    int first = 0;      // ids[first..i) are in the message being built
+    
+    for (int i = 0; i < count; i++) {
+        sensor_data_t sensor;
+        if (!sensors_read_snapshot(ids[i], &sensor) || sensor.metric_name[0] == '\0' ||
+            !sensor.available || sensor.updated_us == 0) {
+            continue;
+        }
+        mqtt_describe_sensor(ids[i], &sensor);
+        
+        mqtt_payload_sensor_t fields;
+        mqtt_sensor_fields(&sensor, true, &fields);
+        mqtt_payload_t start = p;
+        mqtt_payload_sensor(&p, NULL, &fields, metadata);
+        if (mqtt_batch_fits(&p)) {
+            sensors++;
+            continue;
+        }
+        
+        // Full: send what we have and start the next message with this sensor
+        p = start;
+        if (sensors > 0) {
+            mqtt_batch_publish(topic, &p, sensors, &ids[first], i - first);
+        }
+        first = i;
+        mqtt_batch_begin(&p, timestamp_ms, hostname);
+        mqtt_payload_sensor(&p, NULL, &fields, metadata);
+        if (!mqtt_batch_fits(&p)) {
+            ESP_LOGW(TAG, "Sensor %d doesn't fit in the batch buffer, skipping", ids[i]);
+            mqtt_batch_begin(&p, timestamp_ms, hostname);
+            sensors = 0;
+            first = i + 1;
+            continue;
+        }
+        sensors = 1;
     }
     
-    // Use pre-allocated JSON buffer
-    char *json = json_buffer;
-    size_t json_size = json_buffer_size;
+    if (sensors > 0) {
+        mqtt_batch_publish(topic, &p, sensors, &ids[first], count - first);
+    }
+}
+
+// Publish one sensor's message, counted as kind, waiting up to wait for
+// room in the QoS 1 window
+static esp_err_t mqtt_publish_sensor_data(int sensor_id, const sensor_data_t *sensor,
+                                          mqtt_publish_kind_t kind, TickType_t wait)
+{
+    // Get default topic if not configured
+    const char *topic = mqtt_settings->mqtt_topic;
+    if (!topic || strlen(topic) == 0) {
+        topic = "station/sensor";
+    }
     
-    int offset = 0;
-    offset += snprintf(json + offset, json_size - offset, "{");
+    mqtt_describe_sensor(sensor_id, sensor);
     
-    // Add timestamp from sensor's last_updated
-    offset += snprintf(json + offset, json_size - offset, "\"timestamp\":%lld,", (long long)sensor->last_updated);
+    mqtt_publish_counters_t *counters = &publish_counters[kind];
+    atomic_fetch_add(&counters->attempted, 1);
+    
+    // Encode into a buffer from the pool
+    char *buffer = mqtt_encode_buffer_acquire();
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "No MQTT encode buffer available");
+        atomic_fetch_add(&counters->failed, 1);
+        return ESP_FAIL;
+    }
+    mqtt_payload_t p;
+    mqtt_payload_begin(&p, buffer, MQTT_ENCODE_BUFFER_SIZE, mqtt_format());
+    mqtt_payload_object_begin(&p, NULL);
+    
+    // Add timestamps from sensor's last update, once the wall clock is known
+    if (sensor->last_updated_ms > 0) {
+        mqtt_payload_int(&p, "timestamp", sensor->last_updated);
+        mqtt_payload_int(&p, "timestamp_ms", sensor->last_updated_ms);
+    }
     
     // Add hostname
     const char *hostname = (mqtt_settings->hostname != NULL && mqtt_settings->hostname[0] != '\0') 
                             ? mqtt_settings->hostname : "station";
-    offset += snprintf(json + offset, json_size - offset, "\"hostname\":\"%s\",", hostname);
+    mqtt_payload_string(&p, "hostname", hostname);
     
-    // Add sensor array with single sensor
-    offset += snprintf(json + offset, json_size - offset, "\"sensor\":");
+    // Add the sensor, without the fields its descriptor carries if enabled
+    mqtt_payload_sensor_t fields;
+    mqtt_sensor_fields(sensor, false, &fields);
+    mqtt_payload_sensor(&p, "sensor", &fields, !mqtt_settings->mqtt_descriptors);
+    mqtt_payload_object_end(&p);
     
-    offset += snprintf(json + offset, json_size - offset, "{");
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"metric_name\":\"%s\",", sensor->metric_name);
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"display_name\":\"%s\",", sensor->display_name);
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"unit\":\"%s\",", sensor->unit);
-    offset += snprintf(json + offset, json_size - offset, 
-                      "\"value\":%.2f", sensor->value);
+    if (!mqtt_payload_ok(&p)) {
+        ESP_LOGE(TAG, "MQTT message for sensor %d doesn't fit in the buffer", sensor_id);
+        mqtt_encode_buffer_release(buffer);
+        atomic_fetch_add(&counters->failed, 1);
+        return ESP_FAIL;
+    }
     
-    // Add optional device name and ID
-    if (sensor->device_name[0] != '\0') {
-        offset += snprintf(json + offset, json_size - offset, 
-                          ",\"device_name\":\"%s\"", sensor->device_name);
+    // Publish to MQTT
+    int msg_id;
+    esp_err_t err = mqtt_send(kind, topic, &p, 0, wait, &msg_id);
+    mqtt_encode_buffer_release(buffer);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_TIMEOUT) {
+            ESP_LOGE(TAG, "Failed to publish MQTT message");
+        }
+        atomic_fetch_add(&counters->failed, 1);
+        return err;
     }
-    if (sensor->device_id[0] != '\0') {
-        offset += snprintf(json + offset, json_size - offset, 
-                          ",\"device_id\":\"%s\"", sensor->device_id);
+    atomic_fetch_add(&counters->succeeded, 1);
+    atomic_fetch_add(&counters->bytes, p.len);
+    
+    ESP_LOGI(TAG, "Published sensor %d (%s) to MQTT topic '%s' (msg_id=%d, size=%d)", 
+             sensor_id, sensor->metric_name, topic, msg_id, (int)p.len);
+    return ESP_OK;
+}
+
+// Publish a buffered reading with its original time. Returns ESP_ERR_NOT_FOUND
+// if the sensor is gone, so the reading can be discarded.
+static esp_err_t mqtt_replay_reading(const mqtt_offline_reading_t *reading)
+{
+    sensor_data_t snapshot;
+    if (!sensors_read_snapshot(reading->sensor_id, &snapshot) || snapshot.metric_name[0] == '\0') {
+        return ESP_ERR_NOT_FOUND;
     }
     
-    offset += snprintf(json + offset, json_size - offset, "}");
+    // Shift the current wall clock time back to when the reading was taken
+    if (snapshot.last_updated_ms > 0) {
+        snapshot.last_updated_ms += (reading->updated_us - snapshot.updated_us) / 1000;
+    }
+    snapshot.last_updated = (time_t)(snapshot.last_updated_ms / 1000);
+    snapshot.updated_us = reading->updated_us;
+    snapshot.value = reading->value;
+    snapshot.available = true;
+    return mqtt_publish_sensor_data(reading->sensor_id, &snapshot, MQTT_PUBLISH_REPLAY, pdMS_TO_TICKS(1000));
+}
+
+esp_err_t mqtt_publish_single_sensor(int sensor_id)
+{
+    // Buffer while disconnected. Once connected, live readings go out as
+    // usual alongside the replay; both carry the time they were taken.
+    if (mqtt_offline_enabled() && !mqtt_connected) {
+        return mqtt_offline_store(sensor_id);
+    }
     
-    offset += snprintf(json + offset, json_size - offset, "}");
+    if (!mqtt_is_enabled()) {
+        return ESP_FAIL;
+    }
     
-    // Publish to MQTT
-    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, json, offset, 0, 0);
+    if (mqtt_batch_task_handle != NULL) {
+        return mqtt_batch_add(sensor_id);
+    }
     
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to publish MQTT message");
-        xSemaphoreGive(json_mutex);
+    // Get a consistent copy of the sensor data
+    sensor_data_t snapshot;
+    if (!sensors_read_snapshot(sensor_id, &snapshot) || snapshot.metric_name[0] == '\0') {
+        ESP_LOGW(TAG, "Sensor %d not found or has no metric name", sensor_id);
+        atomic_fetch_add(&publish_counters[MQTT_PUBLISH_SENSOR].attempted, 1);
+        atomic_fetch_add(&publish_counters[MQTT_PUBLISH_SENSOR].failed, 1);
         return ESP_FAIL;
     }
     
-    ESP_LOGI(TAG, "Published sensor %d (%s) to MQTT topic '%s' (msg_id=%d, size=%d)", 
-             sensor_id, sensor->metric_name, topic, msg_id, offset);
-    
-    xSemaphoreGive(json_mutex);
-    return ESP_OK;
+    // Only publish if sensor is available
+    if (!snapshot.available || snapshot.updated_us == 0) {
+        ESP_LOGD(TAG, "Sensor %d is not available, skipping publish", sensor_id);
+        return ESP_OK;
+    }
+    esp_err_t err = mqtt_publish_sensor_data(sensor_id, &snapshot, MQTT_PUBLISH_SENSOR, 0);
+    if (err == ESP_ERR_TIMEOUT && offline_buffer != NULL) {
+        // The QoS 1 window is full: queue until PUBACKs make room, dropping
+        // the oldest readings first if the queue fills
+        return mqtt_offline_store(sensor_id);
+    }
+    return err;
+}
+
+void mqtt_get_publish_stats(mqtt_publish_kind_t kind, mqtt_publish_stats_t *stats)
+{
+    if (stats == NULL || kind >= MQTT_PUBLISH_KIND_COUNT) {
+        return;
+    }
+    mqtt_publish_counters_t *counters = &publish_counters[kind];
+    stats->attempted = atomic_load(&counters->attempted);
+    stats->succeeded = atomic_load(&counters->succeeded);
+    stats->failed = atomic_load(&counters->failed);
+    stats->bytes = atomic_load(&counters->bytes);
+}
+
+void mqtt_get_batch_stats(mqtt_batch_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->flushes_window = atomic_load(&batch_counters.flushes_window);
+    stats->flushes_size = atomic_load(&batch_counters.flushes_size);
+    stats->coalesced = atomic_load(&batch_counters.coalesced);
+    stats->dropped = atomic_load(&batch_counters.dropped);
+    stats->sensors = atomic_load(&batch_counters.sensors);
+}
+
+void mqtt_get_offline_stats(mqtt_offline_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->buffered = atomic_load(&offline_counters.buffered);
+    stats->replayed = atomic_load(&offline_counters.replayed);
+    stats->dropped = atomic_load(&offline_counters.dropped);
+    stats->pending = offline_buffer != NULL ? mqtt_offline_pending() : 0;
+    stats->capacity = offline_capacity;
+}
+
+void mqtt_get_encode_stats(mqtt_encode_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    taskENTER_CRITICAL(&encode_stats_lock);
+    *stats = encode_stats;
+    taskEXIT_CRITICAL(&encode_stats_lock);
+    stats->buffers = encode_free != NULL ? MQTT_ENCODE_BUFFERS : 0;
+    stats->in_use = encode_free != NULL ? MQTT_ENCODE_BUFFERS - uxSemaphoreGetCount(encode_free) : 0;
+}
+
+void mqtt_get_qos_stats(mqtt_qos_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    taskENTER_CRITICAL(&inflight_lock);
+    *stats = qos_stats;
+    taskEXIT_CRITICAL(&inflight_lock);
+    stats->window = inflight_free != NULL ? inflight_window : 0;
+    stats->in_flight = inflight_free != NULL ? inflight_window - uxSemaphoreGetCount(inflight_free) : 0;
+    stats->outbox_bytes = mqtt_client != NULL ? esp_mqtt_client_get_outbox_size(mqtt_client) : 0;
 }
 
 void mqtt_publisher_cleanup(void)
@@ -397,6 +1299,24 @@ void mqtt_publisher_cleanup(void)
         ESP_LOGI(TAG, "MQTT status task stopped");
     }
     
+    // Stop batch task; queued updates are dropped
+    if (mqtt_batch_task_handle != NULL) {
+        vTaskDelete(mqtt_batch_task_handle);
+        mqtt_batch_task_handle = NULL;
+        taskENTER_CRITICAL(&batch_lock);
+        for (int i = 0; i < batch_len; i++) {
+            batch_queued[batch_ids[i]] = false;
+        }
+        batch_len = 0;
+        taskEXIT_CRITICAL(&batch_lock);
+    }
+    
+    // Stop replay task; buffered readings are dropped
+    if (mqtt_replay_task_handle != NULL) {
+        vTaskDelete(mqtt_replay_task_handle);
+        mqtt_replay_task_handle = NULL;
+    }
+    
     if (mqtt_client != NULL) {
         esp_mqtt_client_stop(mqtt_client);
         esp_mqtt_client_destroy(mqtt_client);
@@ -404,19 +1324,39 @@ void mqtt_publisher_cleanup(void)
         mqtt_connected = false;
     }
     
-    if (json_buffer != NULL) {
-        free(json_buffer);
-        atomic_fetch_add(&free_count_mqtt_publisher, 1);
-        json_buffer = NULL;
+    // Publishers have stopped with the client
+    if (inflight_free != NULL) {
+        vSemaphoreDelete(inflight_free);
+        inflight_free = NULL;
+        memset(inflight, 0, sizeof(inflight));
+        memset(early_acks, 0, sizeof(early_acks));
+    }
+    if (encode_free != NULL) {
+        vSemaphoreDelete(encode_free);
+        encode_free = NULL;
+    }
+    for (int i = 0; i < MQTT_ENCODE_BUFFERS; i++) {
+        tracked_free(ALLOC_MQTT_PUBLISHER, encode_buffers[i]);
+        encode_buffers[i] = NULL;
+    }
+    
+    if (batch_buffer != NULL) {
+        tracked_free(ALLOC_MQTT_PUBLISHER, batch_buffer);
+        batch_buffer = NULL;
     }
     
-    if (json_mutex != NULL) {
-        vSemaphoreDelete(json_mutex);
-        json_mutex = NULL;
+    if (offline_buffer != NULL) {
+        taskENTER_CRITICAL(&offline_lock);
+        mqtt_offline_reading_t *buffer = offline_buffer;
+        offline_buffer = NULL;
+        offline_capacity = 0;
+        offline_count = 0;
+        taskEXIT_CRITICAL(&offline_lock);
+        tracked_free(ALLOC_MQTT_PUBLISHER, buffer);
     }
     
     if (error_mutex != NULL) {
-        vSemaphoreDelete(error_mutex);
+        tracked_mutex_delete(error_mutex);
         error_mutex = NULL;
     }
 }
@@ -5,6 +5,74 @@
 #include "sensors.h"
 #include <esp_err.h>
 
+// Most sensors in one batched message
+#define MQTT_BATCH_MAX_SENSORS 32
+
+// Most readings the offline buffer can be configured to hold
+#define MQTT_OFFLINE_MAX_READINGS 4096
+
+// Buffers messages are encoded in, enough for every publishing task at once:
+// the sensor dispatcher, replay and status tasks, and one to spare
+#define MQTT_ENCODE_BUFFERS 4
+
+// Most QoS 1 messages the in-flight window can be configured to hold
+#define MQTT_INFLIGHT_MAX 32
+
+// Kinds of messages published, for the publish counters
+typedef enum {
+    MQTT_PUBLISH_SENSOR,
+    MQTT_PUBLISH_STATUS,
+    MQTT_PUBLISH_BATCH,
+    MQTT_PUBLISH_REPLAY,
+    MQTT_PUBLISH_DESCRIPTOR,
+    MQTT_PUBLISH_KIND_COUNT
+} mqtt_publish_kind_t;
+
+typedef struct {
+    uint32_t attempted;         // Messages built for publishing while connected
+    uint32_t succeeded;         // Messages handed to the MQTT client
+    uint32_t failed;            // Messages dropped: client busy, rejected, or sensor missing
+    uint64_t bytes;             // Payload bytes of succeeded messages
+} mqtt_publish_stats_t;
+
+typedef struct {
+    uint32_t flushes_window;    // Batches sent because the window ended
+    uint32_t flushes_size;      // Batches sent because they reached mqtt_batch_max
+    uint32_t coalesced;         // Updates to a sensor already waiting in the batch
+    uint32_t dropped;           // Updates that found the batch full
+    uint64_t sensors;           // Sensor readings sent in batched messages
+} mqtt_batch_stats_t;
+
+typedef struct {
+    uint32_t buffered;          // Readings captured while disconnected or the QoS 1 window was full
+    uint32_t replayed;          // Buffered readings published later
+    uint32_t dropped;           // Oldest readings overwritten because the buffer was full
+    uint32_t pending;           // Readings waiting to be replayed
+    uint32_t capacity;          // Buffer size in readings (0 = disabled)
+} mqtt_offline_stats_t;
+
+typedef struct {
+    uint32_t buffers;           // Buffers in the pool
+    uint32_t in_use;            // Buffers held by publishers now
+    uint32_t acquisitions;      // Buffers handed out
+    uint32_t exhausted;         // Acquisitions that found every buffer in use and had to wait
+    uint32_t timeouts;          // Acquisitions that gave up; the message wasn't published
+    uint64_t wait_us;           // Time spent waiting in exhausted acquisitions
+    uint32_t wait_max_us;
+} mqtt_encode_stats_t;
+
+typedef struct {
+    uint32_t window;            // Most QoS 1 messages awaiting PUBACK (0 = QoS 1 unused)
+    uint32_t in_flight;         // QoS 1 messages awaiting PUBACK now
+    uint32_t acked;             // PUBACKs received
+    uint32_t expired;           // Messages given up on without a PUBACK
+    uint32_t window_full;       // Publishes that found no room in the window
+    uint32_t late_acks;         // PUBACKs later than the retransmit timeout
+    uint64_t ack_us;            // Time from publish to PUBACK
+    uint32_t ack_max_us;
+    int outbox_bytes;           // Size of esp-mqtt's outbox of unacknowledged messages
+} mqtt_qos_stats_t;
+
 /**
  * @brief Initialize MQTT client with settings
  * 
@@ -26,10 +94,17 @@ esp_err_t mqtt_publish_status(void);
  * @brief Publish a single sensor to MQTT
  * 
  * Publishes only the specified sensor as JSON to the configured MQTT topic.
- * Only publishes if MQTT is enabled (broker URL is set).
+ * Only publishes if MQTT is enabled (broker URL is set). When a batch window
+ * is configured the sensor is queued instead, and its latest value goes out
+ * with the others in one "sensors" array message when the window ends.
+ * While the broker is unreachable the reading is kept in the offline buffer
+ * instead. A QoS 1 reading that finds the in-flight window full waits in the
+ * same buffer, which then drops the oldest readings first, even if offline
+ * buffering is off.
  * 
  * @param sensor_id Sensor ID to publish
- * @return esp_err_t ESP_OK on success, ESP_FAIL if MQTT not configured or sensor not found
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if MQTT not configured or sensor not found,
+ *         ESP_ERR_TIMEOUT if the in-flight window is full and the buffer couldn't be allocated
  */
 esp_err_t mqtt_publish_single_sensor(int sensor_id);
 
@@ -40,6 +115,13 @@ esp_err_t mqtt_publish_single_sensor(int sensor_id);
  */
 bool mqtt_is_enabled(void);
 
+/**
+ * @brief Check if readings are kept for replay while MQTT is disconnected
+ * 
+ * @return true if MQTT is configured with an offline buffer
+ */
+bool mqtt_offline_enabled(void);
+
 /**
  * @brief Get the last MQTT error message
  * 
@@ -47,6 +129,42 @@ bool mqtt_is_enabled(void);
  */
 const char* mqtt_get_last_error(void);
 
+/**
+ * @brief Get publish counters for one kind of message
+ * 
+ * @param kind Kind of message
+ * @param stats Destination for the counters
+ */
+void mqtt_get_publish_stats(mqtt_publish_kind_t kind, mqtt_publish_stats_t *stats);
+
+/**
+ * @brief Get sensor batching counters
+ * 
+ * @param stats Destination for the counters
+ */
+void mqtt_get_batch_stats(mqtt_batch_stats_t *stats);
+
+/**
+ * @brief Get offline buffer counters
+ * 
+ * @param stats Destination for the counters
+ */
+void mqtt_get_offline_stats(mqtt_offline_stats_t *stats);
+
+/**
+ * @brief Get encode buffer pool counters
+ * 
+ * @param stats Destination for the counters
+ */
+void mqtt_get_encode_stats(mqtt_encode_stats_t *stats);
+
+/**
+ * @brief Get QoS 1 in-flight window counters
+ * 
+ * @param stats Destination for the counters
+ */
+void mqtt_get_qos_stats(mqtt_qos_stats_t *stats);
+
 /**
  * @brief Disconnect and cleanup MQTT client
  */
@@ -1,7 +1,8 @@
 #include "pump.h"
 #include "http_server.h"
 #include "sensors.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
+#include "tracked_mutex.h"
 #include <esp_log.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,7 @@
 #define PUMP_MAX_ATTEMPTS 2
 #define PUMP_ERROR_BUFFER_SIZE 128
 #define PUMP_MAX_LOCK_WAIT_MS 10000 // milliseconds
+#define PUMP_SENSOR_TIMEOUT_SECONDS 60 // polled every 10 seconds
 
 static const char *TAG = "pump";
 static char error_buffer[PUMP_ERROR_BUFFER_SIZE];
@@ -35,7 +37,7 @@ typedef struct {
     char buf[PUMP_BUFFER_SIZE];
     i2c_master_bus_handle_t bus_handle;
     i2c_master_dev_handle_t dev_handle;
-    SemaphoreHandle_t xSemaphore;
+    tracked_mutex_t *mutex;
     int voltage_sensor_id;
     int total_volume_sensor_id;
 } pump_context_t;
@@ -50,15 +52,13 @@ static esp_err_t pump_dispense_ml_param_parser(httpd_req_t *req, int *out_amount
         return ESP_OK;
     }
 
-    char *buf = malloc(buf_len);
-    atomic_fetch_add(&malloc_count_pump, 1);
+    char *buf = tracked_malloc(ALLOC_PUMP, buf_len);
     if (!buf) {
         return ESP_ERR_NO_MEM;
     }
 
     if (httpd_req_get_url_query_str(req, buf, buf_len) != ESP_OK) {
-        free(buf);
-        atomic_fetch_add(&free_count_pump, 1);
+        tracked_free(ALLOC_PUMP, buf);
         httpd_resp_set_status(req, "400 Bad Request");
         httpd_resp_send(req, "Failed to get query string", HTTPD_RESP_USE_STRLEN);
         return ESP_OK;
@@ -67,10 +67,10 @@ static esp_err_t pump_dispense_ml_param_parser(httpd_req_t *req, int *out_amount
     // Parse the 'ml' parameter
     char param[16];
     if (httpd_query_key_value(buf, "ml", param, sizeof(param)) != ESP_OK) {
-        free(buf);
+        tracked_free(ALLOC_PUMP, buf);
         return ESP_OK;
     }
-    free(buf);
+    tracked_free(ALLOC_PUMP, buf);
 
     // Convert to integer and validate range
     *out_amount = atoi(param);
@@ -404,8 +404,7 @@ void pump_init(settings_t *settings, httpd_handle_t server) {
     }
 
     ESP_LOGI(TAG, "Initializing pump on SCL GPIO %d, SDA GPIO %d", settings->pump_scl_gpio, settings->pump_sda_gpio);
-    pump_context_t *pump_ctx = malloc(sizeof(pump_context_t));
-    atomic_fetch_add(&malloc_count_pump, 1);
+    pump_context_t *pump_ctx = tracked_malloc(ALLOC_PUMP, sizeof(pump_context_t));
     if (!pump_ctx) {
         PUMP_ERROR_RETURN("Failed to allocate memory for pump");
         return;
@@ -440,8 +439,8 @@ void pump_init(settings_t *settings, httpd_handle_t server) {
         return;
     }
 
-    pump_ctx->xSemaphore = xSemaphoreCreateMutex();
-    if (pump_ctx->xSemaphore == NULL) {
+    pump_ctx->mutex = tracked_mutex_create("pump");
+    if (pump_ctx->mutex == NULL) {
         PUMP_ERROR_RETURN("Failed to create semaphore for pump");
         return;
     }
@@ -463,6 +462,10 @@ void pump_init(settings_t *settings, httpd_handle_t server) {
     if (pump_ctx->total_volume_sensor_id < 0) {
         ESP_LOGW(TAG, "Failed to register pump total volume sensor");
     }
+    sensors_set_timeout(pump_ctx->voltage_sensor_id, PUMP_SENSOR_TIMEOUT_SECONDS);
+    sensors_set_timeout(pump_ctx->total_volume_sensor_id, PUMP_SENSOR_TIMEOUT_SECONDS);
+    sensors_set_producer(pump_ctx->voltage_sensor_id, SENSOR_PRODUCER_PUMP);
+    sensors_set_producer(pump_ctx->total_volume_sensor_id, SENSOR_PRODUCER_PUMP);
     
     // Create monitoring task
     BaseType_t task_created = xTaskCreate(
@@ -519,13 +522,13 @@ void pump_init(settings_t *settings, httpd_handle_t server) {
 }
 
 char* pump_send_cmd(pump_context_t *pump_ctx, const char *cmd) {
-    if(!xSemaphoreTake(pump_ctx->xSemaphore, pdMS_TO_TICKS(PUMP_MAX_LOCK_WAIT_MS))) {
+    if(!tracked_mutex_take(pump_ctx->mutex, pdMS_TO_TICKS(PUMP_MAX_LOCK_WAIT_MS))) {
         return NULL;
     }
     esp_err_t err = i2c_master_transmit(pump_ctx->dev_handle, (uint8_t*)cmd, strlen(cmd), -1);
     if (err != ESP_OK) {
         PUMP_ERROR_RETURN("Failed to send `%s` command to pump: %s", cmd, esp_err_to_name(err));
-        xSemaphoreGive(pump_ctx->xSemaphore);
+        tracked_mutex_give(pump_ctx->mutex);
         return NULL;
     }
 
@@ -541,29 +544,29 @@ char* pump_send_cmd(pump_context_t *pump_ctx, const char *cmd) {
                 break;
             default:
                 PUMP_ERROR_RETURN("Error receiving pump response: %s", esp_err_to_name(err));
-                xSemaphoreGive(pump_ctx->xSemaphore);
+                tracked_mutex_give(pump_ctx->mutex);
                 return NULL;
         }
         switch (pump_ctx->buf[0]) {
             case 1:
-                xSemaphoreGive(pump_ctx->xSemaphore);
+                tracked_mutex_give(pump_ctx->mutex);
                 return pump_ctx->buf+1;
             case 2:
-                xSemaphoreGive(pump_ctx->xSemaphore);
+                tracked_mutex_give(pump_ctx->mutex);
                 return NULL; // syntax error
             case 254:
                 continue; // still processing; try again
             case 255:
-                xSemaphoreGive(pump_ctx->xSemaphore);
+                tracked_mutex_give(pump_ctx->mutex);
                 return ""; // no data
             default:
                 PUMP_ERROR_RETURN("Pump returned unknown response code: %d", pump_ctx->buf[0]);
-                xSemaphoreGive(pump_ctx->xSemaphore);
+                tracked_mutex_give(pump_ctx->mutex);
                 return NULL;
         }
     }
     // No response after max attempts
     PUMP_ERROR_RETURN("No response from pump after %d attempts", PUMP_MAX_ATTEMPTS);
-    xSemaphoreGive(pump_ctx->xSemaphore);
+    tracked_mutex_give(pump_ctx->mutex);
     return NULL;
 }
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "remote_write.h"
+#include "metrics.h"
+#include "tracked_alloc.h"
+#include <esp_log.h>
+#include <esp_http_client.h>
+#include <esp_crt_bundle.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+
+static const char *TAG = "remote_write";
+extern bool g_ntp_initialized;
+
+#define REMOTE_WRITE_TIMEOUT_MS 10000
+
+// Snappy compression: one hash table slot per 4-byte sequence, positions
+// relative to a 64 KB block so 2-byte copy offsets always reach
+#define SNAPPY_BLOCK_SIZE 65536
+#define SNAPPY_HASH_BITS 12
+
+typedef struct {
+    uint8_t *data;              // Snappy-compressed WriteRequest
+    size_t len;
+    uint32_t samples;
+} remote_write_batch_t;
+
+// Only the remote_write task touches the queue
+static remote_write_batch_t pending[REMOTE_WRITE_MAX_PENDING];
+static int pending_head = 0;
+static int pending_count = 0;
+static size_t pending_bytes = 0;
+
+static settings_t *rw_settings = NULL;
+static httpd_handle_t rw_server = NULL;
+static TaskHandle_t rw_task = NULL;
+static esp_http_client_handle_t rw_client = NULL;
+
+// Handed from the httpd task to the remote_write task
+static uint8_t *collected = NULL;
+static size_t collected_len = 0;
+static uint32_t collected_samples = 0;
+
+static struct {
+    atomic_uint succeeded;
+    atomic_uint retried;
+    atomic_uint rejected;
+    atomic_uint dropped_full;
+    atomic_uint pending;
+    atomic_uint_fast64_t samples;
+    atomic_uint_fast64_t bytes;
+} rw_stats;
+
+static size_t snappy_max_compressed_len(size_t len) {
+    return 32 + len + len / 6;
+}
+
+static uint8_t *snappy_emit_literal(uint8_t *op, const uint8_t *literal, size_t len) {
+    size_t n = len - 1;
+    if (n < 60) {
+        *op++ = (uint8_t)(n << 2);
+    } else if (n < 256) {
+        *op++ = 60 << 2;
+        *op++ = (uint8_t)n;
+    } else {
+        *op++ = 61 << 2;
+        *op++ = (uint8_t)n;
+        *op++ = (uint8_t)(n >> 8);
+    }
+    memcpy(op, literal, len);
+    return op + len;
+}
+
+static uint8_t *snappy_emit_copy(uint8_t *op, size_t offset, size_t len) {
+    // Copies are at most 64 bytes; keep the remainder at least 4
+    while (len >= 68) {
+        *op++ = (63 << 2) | 2;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        len -= 64;
+    }
+    if (len > 64) {
+        *op++ = (59 << 2) | 2;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        len -= 60;
+    }
+    if (len < 12 && offset < 2048) {
+        *op++ = (uint8_t)(((offset >> 8) << 5) | ((len - 4) << 2) | 1);
+        *op++ = (uint8_t)offset;
+    } else {
+        *op++ = (uint8_t)(((len - 1) << 2) | 2);
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+    }
+    return op;
+}
+
+static uint32_t snappy_load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Compress in the Snappy block format. out must hold
+// snappy_max_compressed_len(len) bytes; returns the compressed length.
+static size_t snappy_compress(const uint8_t *in, size_t len, uint8_t *out, uint16_t *table) {
+    uint8_t *op = out;
+    for (size_t v = len; ; v >>= 7) {
+        *op++ = (uint8_t)(v < 0x80 ? v : (v & 0x7F) | 0x80);
+        if (v < 0x80) {
+            break;
+        }
+    }
+
+    for (size_t block_start = 0; block_start < len; block_start += SNAPPY_BLOCK_SIZE) {
+        size_t block_len = len - block_start < SNAPPY_BLOCK_SIZE ? len - block_start : SNAPPY_BLOCK_SIZE;
+        const uint8_t *base = in + block_start;
+        size_t literal_start = 0;
+        size_t i = 0;
+
+        memset(table, 0, sizeof(uint16_t) << SNAPPY_HASH_BITS);
+        while (i + 4 <= block_len) {
+            uint32_t bytes = snappy_load32(base + i);
+            uint32_t hash = (bytes * 0x1e35a7bd) >> (32 - SNAPPY_HASH_BITS);
+            size_t candidate = table[hash];
+            table[hash] = (uint16_t)i;
+            if (candidate >= i || snappy_load32(base + candidate) != bytes) {
+                i++;
+                continue;
+            }
+
+            size_t match = 4;
+            while (i + match < block_len && base[candidate + match] == base[i + match]) {
+                match++;
+            }
+            if (i > literal_start) {
+                op = snappy_emit_literal(op, base + literal_start, i - literal_start);
+            }
+            op = snappy_emit_copy(op, i - candidate, match);
+            i += match;
+            literal_start = i;
+        }
+        if (block_len > literal_start) {
+            op = snappy_emit_literal(op, base + literal_start, block_len - literal_start);
+        }
+    }
+    return op - out;
+}
+
+// Runs on the httpd task, which owns the metrics writer
+static void remote_write_collect(void *arg) {
+    collected = NULL;
+    collected_len = 0;
+    collected_samples = 0;
+    if (metrics_render_buffer(rw_settings, METRICS_FORMAT_REMOTE_WRITE,
+                              &collected, &collected_len, &collected_samples) != ESP_OK) {
+        collected = NULL;
+    }
+    xTaskNotifyGive(rw_task);
+}
+
+static void remote_write_drop_oldest(void) {
+    remote_write_batch_t *batch = &pending[pending_head];
+    pending_bytes -= batch->len;
+    tracked_free(ALLOC_REMOTE_WRITE, batch->data);
+    batch->data = NULL;
+    pending_head = (pending_head + 1) % REMOTE_WRITE_MAX_PENDING;
+    pending_count--;
+    atomic_store(&rw_stats.pending, pending_count);
+}
+
+static void remote_write_enqueue(uint8_t *data, size_t len, uint32_t samples) {
+    while (pending_count > 0 &&
+           (pending_count == REMOTE_WRITE_MAX_PENDING || pending_bytes + len > REMOTE_WRITE_MAX_PENDING_BYTES)) {
+        ESP_LOGW(TAG, "Pending queue full, dropping oldest batch");
+        remote_write_drop_oldest();
+        atomic_fetch_add(&rw_stats.dropped_full, 1);
+    }
+    int tail = (pending_head + pending_count) % REMOTE_WRITE_MAX_PENDING;
+    pending[tail] = (remote_write_batch_t){ .data = data, .len = len, .samples = samples };
+    pending_count++;
+    pending_bytes += len;
+    atomic_store(&rw_stats.pending, pending_count);
+}
+
+// Collect all metrics as one compressed batch and queue it
+static void remote_write_batch(void) {
+    if (httpd_queue_work(rw_server, remote_write_collect, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to queue metrics collection");
+        return;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (collected == NULL) {
+        ESP_LOGW(TAG, "Failed to collect metrics");
+        return;
+    }
+
+    uint8_t *compressed = tracked_malloc(ALLOC_REMOTE_WRITE, snappy_max_compressed_len(collected_len));
+    uint16_t *table = tracked_malloc(ALLOC_REMOTE_WRITE, sizeof(uint16_t) << SNAPPY_HASH_BITS);
+    if (compressed == NULL || table == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate compression buffers");
+        tracked_free(ALLOC_REMOTE_WRITE, compressed);
+        tracked_free(ALLOC_REMOTE_WRITE, table);
+        tracked_free(ALLOC_METRICS, collected);
+        return;
+    }
+    size_t len = snappy_compress(collected, collected_len, compressed, table);
+    tracked_free(ALLOC_REMOTE_WRITE, table);
+    tracked_free(ALLOC_METRICS, collected);
+    collected = NULL;
+
+    // Give back the worst-case slack while the batch waits
+    uint8_t *shrunk = tracked_realloc(ALLOC_REMOTE_WRITE, compressed, len);
+    if (shrunk != NULL) {
+        compressed = shrunk;
+    }
+    ESP_LOGD(TAG, "Batched %" PRIu32 " samples: %u bytes, %u compressed",
+             collected_samples, (unsigned)collected_len, (unsigned)len);
+    remote_write_enqueue(compressed, len, collected_samples);
+}
+
+// POST the oldest batch. Returns false if it should be retried later.
+static bool remote_write_send_oldest(void) {
+    remote_write_batch_t *batch = &pending[pending_head];
+    esp_http_client_set_post_field(rw_client, (const char *)batch->data, batch->len);
+    esp_err_t err = esp_http_client_perform(rw_client);
+    int status = err == ESP_OK ? esp_http_client_get_status_code(rw_client) : 0;
+
+    if (err != ESP_OK || status >= 500 || status == 429) {
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "POST failed (%s), will retry", esp_err_to_name(err));
+            esp_http_client_close(rw_client);
+        } else {
+            ESP_LOGW(TAG, "POST returned %d, will retry", status);
+        }
+        atomic_fetch_add(&rw_stats.retried, 1);
+        return false;
+    }
+
+    if (status >= 200 && status < 300) {
+        atomic_fetch_add(&rw_stats.succeeded, 1);
+        atomic_fetch_add(&rw_stats.samples, batch->samples);
+        atomic_fetch_add(&rw_stats.bytes, batch->len);
+    } else {
+        // The receiver won't take this batch however often it's sent
+        ESP_LOGW(TAG, "POST returned %d, dropping batch", status);
+        atomic_fetch_add(&rw_stats.rejected, 1);
+    }
+    remote_write_drop_oldest();
+    return true;
+}
+
+static void remote_write_task(void *pvParameters) {
+    uint16_t interval = rw_settings->remote_write_interval >= 10 ? rw_settings->remote_write_interval : 60;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(interval * 1000));
+
+        // Samples need wall clock timestamps
+        if (!g_ntp_initialized) {
+            continue;
+        }
+        remote_write_batch();
+        while (pending_count > 0 && remote_write_send_oldest()) {
+        }
+    }
+}
+
+esp_err_t remote_write_init(settings_t *settings, httpd_handle_t server) {
+    if (settings->remote_write_url == NULL || settings->remote_write_url[0] == '\0') {
+        ESP_LOGI(TAG, "Remote write URL not configured, push disabled");
+        return ESP_OK;
+    }
+    if (server == NULL) {
+        ESP_LOGE(TAG, "No HTTP server to collect metrics on");
+        return ESP_ERR_INVALID_ARG;
+    }
+    rw_settings = settings;
+    rw_server = server;
+
+    esp_http_client_config_t config = {
+        .url = settings->remote_write_url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = REMOTE_WRITE_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .keep_alive_enable = true,
+    };
+    rw_client = esp_http_client_init(&config);
+    if (rw_client == NULL) {
+        ESP_LOGE(TAG, "Failed to create HTTP client");
+        return ESP_FAIL;
+    }
+    esp_http_client_set_header(rw_client, "Content-Type", "application/x-protobuf");
+    esp_http_client_set_header(rw_client, "Content-Encoding", "snappy");
+    esp_http_client_set_header(rw_client, "X-Prometheus-Remote-Write-Version", "0.1.0");
+
+    if (xTaskCreate(remote_write_task, "remote_write", 6144, NULL, 2, &rw_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create remote write task");
+        esp_http_client_cleanup(rw_client);
+        rw_client = NULL;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Pushing metrics to %s every %u seconds", settings->remote_write_url,
+             settings->remote_write_interval);
+    return ESP_OK;
+}
+
+void remote_write_get_stats(remote_write_stats_t *stats) {
+    stats->succeeded = atomic_load(&rw_stats.succeeded);
+    stats->retried = atomic_load(&rw_stats.retried);
+    stats->rejected = atomic_load(&rw_stats.rejected);
+    stats->dropped_full = atomic_load(&rw_stats.dropped_full);
+    stats->pending = atomic_load(&rw_stats.pending);
+    stats->samples = atomic_load(&rw_stats.samples);
+    stats->bytes = atomic_load(&rw_stats.bytes);
+}
@@ -0,0 +1,44 @@
+#ifndef REMOTE_WRITE_H
+#define REMOTE_WRITE_H
+
+#include "settings.h"
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// Batches kept for retry while the receiver is unreachable; the oldest is
+// dropped when either limit is hit
+#define REMOTE_WRITE_MAX_PENDING 4
+#define REMOTE_WRITE_MAX_PENDING_BYTES (32 * 1024)
+
+typedef struct {
+    uint32_t succeeded;         // POSTs accepted (2xx)
+    uint32_t retried;           // POSTs that failed and will be retried: network error, 5xx or 429
+    uint32_t rejected;          // POSTs refused with another 4xx; the batch is dropped
+    uint32_t dropped_full;      // Batches dropped because the pending queue was full
+    uint32_t pending;           // Batches waiting to be sent
+    uint64_t samples;           // Samples in accepted batches
+    uint64_t bytes;             // Compressed bytes in accepted batches
+} remote_write_stats_t;
+
+/**
+ * @brief Start pushing metrics to the remote_write URL from settings
+ *
+ * Every remote_write_interval seconds all metrics served on /metrics are
+ * collected into one snappy-compressed WriteRequest and POSTed. Does nothing
+ * if the URL is empty.
+ *
+ * @param settings Pointer to settings structure
+ * @param server HTTP server whose task renders metrics
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t remote_write_init(settings_t *settings, httpd_handle_t server);
+
+/**
+ * @brief Get push counters
+ *
+ * @param stats Receives the counters
+ */
+void remote_write_get_stats(remote_write_stats_t *stats);
+
+#endif // REMOTE_WRITE_H
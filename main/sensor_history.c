@@ -0,0 +1,290 @@
+#include "sensor_history.h"
+#include "sensors.h"
+#include "tracked_alloc.h"
+#include "tracked_mutex.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "sensor_history";
+
+// Worst-case encoded size of one sample: '1111' + 32-bit timestamp
+// delta-of-delta, then '11' + 5-bit leading zeros + 5-bit length + 32 bits
+#define MAX_SAMPLE_BITS (4 + 32 + 2 + 5 + 5 + 32)
+
+// Marks that no XOR window has been established in the current block yet
+#define NO_WINDOW 0xFF
+
+typedef struct {
+    uint32_t start_timestamp;   // First sample, stored uncompressed
+    uint32_t first_value;       // Raw IEEE-754 bits of the first sample
+    uint16_t count;             // Samples in this block, including the first
+    uint16_t bit_len;           // Bits used in data
+    uint8_t data[SENSOR_HISTORY_BLOCK_SIZE];
+} history_block_t;
+
+typedef struct {
+    history_block_t blocks[SENSOR_HISTORY_BLOCKS];
+    uint8_t head;               // Block currently being appended to
+    uint8_t used;               // Number of blocks holding data
+    // Encoder state for the head block
+    uint32_t last_timestamp;
+    int32_t last_delta;
+    uint32_t last_value;
+    uint8_t last_leading;
+    uint8_t last_trailing;
+} sensor_history_t;
+
+// Decoder state, mirrors the encoder fields of sensor_history_t
+typedef struct {
+    const history_block_t *block;
+    uint16_t pos;
+    uint32_t timestamp;
+    int32_t delta;
+    uint32_t value;
+    uint8_t leading;
+    uint8_t trailing;
+} history_reader_t;
+
+static sensor_history_t *histories[MAX_SENSORS];
+static tracked_mutex_t *history_mutex = NULL;
+
+static uint32_t float_to_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_to_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void put_bits(history_block_t *block, uint32_t value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            block->data[block->bit_len >> 3] |= 0x80 >> (block->bit_len & 7);
+        }
+        block->bit_len++;
+    }
+}
+
+static uint32_t get_bits(history_reader_t *reader, int nbits) {
+    uint32_t value = 0;
+    for (int i = 0; i < nbits; i++) {
+        uint8_t byte = reader->block->data[reader->pos >> 3];
+        value = (value << 1) | ((byte >> (7 - (reader->pos & 7))) & 1);
+        reader->pos++;
+    }
+    return value;
+}
+
+static int32_t sign_extend(uint32_t value, int nbits) {
+    return (int32_t)(value << (32 - nbits)) >> (32 - nbits);
+}
+
+static void start_block(sensor_history_t *history, uint32_t timestamp, uint32_t value) {
+    history_block_t *block = &history->blocks[history->head];
+    memset(block, 0, sizeof(*block));
+    block->start_timestamp = timestamp;
+    block->first_value = value;
+    block->count = 1;
+
+    history->last_timestamp = timestamp;
+    history->last_delta = 0;
+    history->last_value = value;
+    history->last_leading = NO_WINDOW;
+    history->last_trailing = 0;
+}
+
+static void encode_timestamp(history_block_t *block, int32_t dod) {
+    if (dod == 0) {
+        put_bits(block, 0x0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        put_bits(block, 0x2, 2);
+        put_bits(block, (uint32_t)dod & 0x7F, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        put_bits(block, 0x6, 3);
+        put_bits(block, (uint32_t)dod & 0x1FF, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        put_bits(block, 0xE, 4);
+        put_bits(block, (uint32_t)dod & 0xFFF, 12);
+    } else {
+        put_bits(block, 0xF, 4);
+        put_bits(block, (uint32_t)dod, 32);
+    }
+}
+
+static int32_t decode_timestamp(history_reader_t *reader) {
+    if (get_bits(reader, 1) == 0) {
+        return 0;
+    }
+    if (get_bits(reader, 1) == 0) {
+        return sign_extend(get_bits(reader, 7), 7);
+    }
+    if (get_bits(reader, 1) == 0) {
+        return sign_extend(get_bits(reader, 9), 9);
+    }
+    if (get_bits(reader, 1) == 0) {
+        return sign_extend(get_bits(reader, 12), 12);
+    }
+    return (int32_t)get_bits(reader, 32);
+}
+
+static void encode_value(sensor_history_t *history, history_block_t *block, uint32_t value) {
+    uint32_t xor = value ^ history->last_value;
+    history->last_value = value;
+
+    if (xor == 0) {
+        put_bits(block, 0x0, 1);
+        return;
+    }
+    put_bits(block, 0x1, 1);
+
+    int leading = __builtin_clz(xor);
+    int trailing = __builtin_ctz(xor);
+
+    // Reuse the previous window of meaningful bits when the new XOR fits in it
+    if (history->last_leading != NO_WINDOW &&
+        leading >= history->last_leading && trailing >= history->last_trailing) {
+        int length = 32 - history->last_leading - history->last_trailing;
+        put_bits(block, 0x0, 1);
+        put_bits(block, xor >> history->last_trailing, length);
+        return;
+    }
+
+    int length = 32 - leading - trailing;
+    put_bits(block, 0x1, 1);
+    put_bits(block, (uint32_t)leading, 5);
+    put_bits(block, (uint32_t)(length - 1), 5);
+    put_bits(block, xor >> trailing, length);
+    history->last_leading = (uint8_t)leading;
+    history->last_trailing = (uint8_t)trailing;
+}
+
+static uint32_t decode_value(history_reader_t *reader) {
+    if (get_bits(reader, 1) == 0) {
+        return reader->value;
+    }
+
+    if (get_bits(reader, 1) == 1) {
+        reader->leading = (uint8_t)get_bits(reader, 5);
+        int length = (int)get_bits(reader, 5) + 1;
+        reader->trailing = (uint8_t)(32 - reader->leading - length);
+    }
+
+    int length = 32 - reader->leading - reader->trailing;
+    reader->value ^= get_bits(reader, length) << reader->trailing;
+    return reader->value;
+}
+
+esp_err_t sensor_history_init(void) {
+    memset(histories, 0, sizeof(histories));
+
+    if (history_mutex == NULL) {
+        history_mutex = tracked_mutex_create("sensor_history");
+        if (history_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create history mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+void sensor_history_record(int sensor_id, uint32_t timestamp, float value) {
+    if (sensor_id < 0 || sensor_id >= MAX_SENSORS || history_mutex == NULL) {
+        return;
+    }
+
+    uint32_t bits = float_to_bits(value);
+
+    tracked_mutex_take(history_mutex, portMAX_DELAY);
+
+    sensor_history_t *history = histories[sensor_id];
+    if (history == NULL) {
+        // First sample for this sensor; allocate its ring once
+        history = tracked_calloc(ALLOC_SENSOR_HISTORY, 1, sizeof(sensor_history_t));
+        if (history == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate history for sensor %d", sensor_id);
+            tracked_mutex_give(history_mutex);
+            return;
+        }
+        history->used = 1;
+        start_block(history, timestamp, bits);
+        histories[sensor_id] = history;
+        tracked_mutex_give(history_mutex);
+        return;
+    }
+
+    if (timestamp < history->last_timestamp + SENSOR_HISTORY_INTERVAL_SECONDS) {
+        tracked_mutex_give(history_mutex);
+        return;
+    }
+
+    history_block_t *block = &history->blocks[history->head];
+    if (block->bit_len + MAX_SAMPLE_BITS > SENSOR_HISTORY_BLOCK_SIZE * 8) {
+        // Head block is full; move on, overwriting the oldest block if needed
+        history->head = (history->head + 1) % SENSOR_HISTORY_BLOCKS;
+        if (history->used < SENSOR_HISTORY_BLOCKS) {
+            history->used++;
+        }
+        start_block(history, timestamp, bits);
+        tracked_mutex_give(history_mutex);
+        return;
+    }
+
+    int32_t delta = (int32_t)(timestamp - history->last_timestamp);
+    encode_timestamp(block, delta - history->last_delta);
+    history->last_delta = delta;
+    history->last_timestamp = timestamp;
+    encode_value(history, block, bits);
+    block->count++;
+
+    tracked_mutex_give(history_mutex);
+}
+
+bool sensor_history_query(int sensor_id, uint32_t since, sensor_history_cb_t callback, void *user_data) {
+    if (sensor_id < 0 || sensor_id >= MAX_SENSORS || history_mutex == NULL || callback == NULL) {
+        return false;
+    }
+
+    // Decode from a private copy so producers aren't held up by slow clients
+    sensor_history_t copy;
+    tracked_mutex_take(history_mutex, portMAX_DELAY);
+    if (histories[sensor_id] == NULL) {
+        tracked_mutex_give(history_mutex);
+        return false;
+    }
+    memcpy(&copy, histories[sensor_id], sizeof(copy));
+    tracked_mutex_give(history_mutex);
+
+    for (int i = 0; i < copy.used; i++) {
+        int idx = (copy.head + SENSOR_HISTORY_BLOCKS - copy.used + 1 + i) % SENSOR_HISTORY_BLOCKS;
+        const history_block_t *block = &copy.blocks[idx];
+
+        history_reader_t reader = {
+            .block = block,
+            .pos = 0,
+            .timestamp = block->start_timestamp,
+            .delta = 0,
+            .value = block->first_value,
+            .leading = 0,
+            .trailing = 0,
+        };
+
+        for (uint16_t n = 0; n < block->count; n++) {
+            if (n > 0) {
+                reader.delta += decode_timestamp(&reader);
+                reader.timestamp += reader.delta;
+                decode_value(&reader);
+            }
+            if (reader.timestamp >= since &&
+                !callback(reader.timestamp, bits_to_float(reader.value), user_data)) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Compressed bytes per history block. Each block starts with an uncompressed
+// sample, so the block size bounds how much is lost when the oldest is evicted.
+#define SENSOR_HISTORY_BLOCK_SIZE 128
+
+// Number of blocks in each sensor's ring buffer
+#define SENSOR_HISTORY_BLOCKS 4
+
+// Minimum spacing between recorded samples; faster updates are skipped
+#define SENSOR_HISTORY_INTERVAL_SECONDS 30
+
+/**
+ * @brief Callback invoked for each sample returned by sensor_history_query
+ *
+ * @param timestamp Sample time in seconds since boot
+ * @param value Sample value
+ * @param user_data User data passed to sensor_history_query
+ * @return true to continue iteration, false to stop
+ */
+typedef bool (*sensor_history_cb_t)(uint32_t timestamp, float value, void *user_data);
+
+/**
+ * @brief Initialize the sensor history store
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t sensor_history_init(void);
+
+/**
+ * @brief Record a sample for a sensor
+ *
+ * Samples are delta-of-delta/XOR compressed (Gorilla-style) into a fixed ring
+ * of blocks per sensor. The ring is allocated on the sensor's first sample and
+ * never freed. Samples closer than SENSOR_HISTORY_INTERVAL_SECONDS to the
+ * previous one are dropped.
+ *
+ * @param sensor_id Sensor ID returned from sensors_register
+ * @param timestamp Sample time in seconds since boot (must not go backwards)
+ * @param value Sample value
+ */
+void sensor_history_record(int sensor_id, uint32_t timestamp, float value);
+
+/**
+ * @brief Iterate a sensor's samples, oldest first
+ *
+ * @param sensor_id Sensor ID returned from sensors_register
+ * @param since Only samples at or after this time (seconds since boot) are returned
+ * @param callback Callback invoked for each sample
+ * @param user_data User data passed to the callback
+ * @return true if the sensor has history, false otherwise
+ */
+bool sensor_history_query(int sensor_id, uint32_t since, sensor_history_cb_t callback, void *user_data);
+
+#endif // SENSOR_HISTORY_H
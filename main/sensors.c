@@ -1,26 +1,213 @@
 #include "sensors.h"
 #include "settings.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
 #include "mqtt_publisher.h"
+#include "http_server.h"
+#include "sensor_history.h"
+#include "string_pool.h"
+#include "tracked_mutex.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_http_server.h>
 #include <esp_app_format.h>
 #include <esp_ota_ops.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/semphr.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <sys/time.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 static const char *TAG = "sensors";
+extern bool g_ntp_initialized;
+
+// Hot per-sensor state, written on every update. Kept dense and separate
+// from the metadata so updates touch as few cache lines as possible.
+typedef struct {
+    float value;
+    int64_t updated_us;             // esp_timer_get_time() at the last update
+    bool available;
+    uint8_t link_slot;              // Index into sensor_links, or SENSOR_NO_LINK
+    string_handle_t link_text;
+} sensor_state_t;
+
+// Cold per-sensor metadata, written only at registration. Strings are
+// interned, so repeated names, units and MACs are stored once.
+typedef struct {
+    string_handle_t display_name;
+    string_handle_t unit;
+    string_handle_t metric_name;
+    string_handle_t device_name;
+    string_handle_t device_id;
+} sensor_meta_t;
+
+// Link URLs change with every reading (e.g. the tare link carries the raw
+// value) so they can't be interned; the few sensors that use them get a slot.
+#define MAX_SENSOR_LINKS 8
+#define SENSOR_NO_LINK 0xFF
 
 // Sensor registry
-static sensor_data_t sensors[MAX_SENSORS];
-static int sensor_count = 0;
-static SemaphoreHandle_t sensors_mutex = NULL;
+static sensor_state_t sensor_state[MAX_SENSORS];
+static sensor_meta_t sensor_meta[MAX_SENSORS];
+static char sensor_links[MAX_SENSOR_LINKS][SENSOR_LINK_URL_MAX_LEN];
+static int sensor_link_count = 0;
+static atomic_int sensor_count = 0;
+// Bumped on every change visible in /sensors/data; used for ETags and long-polls
+static atomic_uint sensors_generation = 0;
+// Bumped when a sensor is registered or its names change
+static atomic_uint sensors_meta_generation = 0;
+// Serializes writers only; readers use the per-sensor sequence counters below
+static tracked_mutex_t *sensors_mutex = NULL;
+
+// Per-sensor sequence counters (seqlock). A writer holding sensors_mutex bumps
+// the counter to an odd value, modifies the slot, then bumps it back to even.
+// Readers copy the slot without locking and retry if the counter was odd or
+// changed while they were copying.
+static atomic_uint sensor_seq[MAX_SENSORS];
+
+// Number of failed snapshot attempts before a reader yields to let a preempted
+// writer on the same core finish its update
+#define SENSOR_SNAPSHOT_SPIN_LIMIT 8
+
+// Staleness deadlines. Each sensor that is available and has a timeout has
+// one entry in a binary min-heap keyed by the time it would go stale. Updates
+// only ever push a deadline later, so they don't touch the heap: an entry is
+// a lower bound, and when it comes due the cleanup task checks the real
+// deadline and either marks the sensor stale or re-keys the entry.
+typedef struct {
+    int64_t deadline_us;
+    uint8_t sensor_id;
+} sensor_deadline_t;
+
+static sensor_deadline_t deadline_heap[MAX_SENSORS];
+static int deadline_heap_size = 0;
+static int16_t deadline_heap_pos[MAX_SENSORS];     // Index in deadline_heap, or -1
+static uint32_t sensor_timeout_s[MAX_SENSORS];     // 0 = never goes stale
+static tracked_mutex_t *deadline_mutex = NULL;
+static TaskHandle_t cleanup_task_handle = NULL;
+static atomic_uint stale_count = 0;
+
+// Long-polls of /sensors/data (?wait=) parked until the data changes. Each
+// holds a socket open, so only a few are allowed at once.
+#define SENSORS_MAX_LONG_POLLS 4
+#define SENSORS_LONG_POLL_MAX_SECONDS 30
+#define SENSORS_ETAG_LEN 24
+
+typedef struct {
+    httpd_req_t *req;
+    int64_t deadline_us;
+    char etag[SENSORS_ETAG_LEN];
+} sensors_long_poll_t;
+
+static sensors_long_poll_t long_polls[SENSORS_MAX_LONG_POLLS];
+static int long_poll_count = 0;
+static tracked_mutex_t *long_poll_mutex = NULL;
+static TaskHandle_t long_poll_task_handle = NULL;
+
+// Server-Sent Events clients of /sensors/stream. Each stream has a bitmap of
+// sensors changed since its last write, so only those are sent. Streams hold
+// a socket open for as long as the page is up, so they are capped too.
+#define SENSORS_MAX_STREAMS 3
+#define SENSORS_STREAM_KEEPALIVE_SECONDS 15
+#define SENSORS_STREAM_BUF_SIZE 1536
+#define SENSOR_DIRTY_WORDS ((MAX_SENSORS + 31) / 32)
+
+typedef struct {
+    httpd_req_t *req;
+    uint32_t dirty[SENSOR_DIRTY_WORDS];
+    bool started;           // Response headers have been sent
+    int64_t last_send_us;
+} sensors_stream_t;
+
+static sensors_stream_t streams[SENSORS_MAX_STREAMS];
+static int stream_count = 0;
+static tracked_mutex_t *stream_mutex = NULL;
+static TaskHandle_t stream_task_handle = NULL;
+static atomic_uint streams_accepted = 0;
+static atomic_uint streams_rejected = 0;
+static atomic_uint stream_events_sent = 0;
+
+// Open-addressing index from sensor_key_t to sensor ID, with linear probing.
+// Sized to a power of two at least twice MAX_SENSORS to keep probes short.
+// Entries hold sensor ID + 1 (0 = empty) and are never removed, so readers
+// probe without locking: a key is stored before its entry is published.
+#define SENSOR_INDEX_SIZE 256
+_Static_assert(SENSOR_INDEX_SIZE >= 2 * MAX_SENSORS, "sensor index too small");
+_Static_assert((SENSOR_INDEX_SIZE & (SENSOR_INDEX_SIZE - 1)) == 0, "sensor index must be a power of two");
+_Static_assert(MAX_SENSORS < 255, "sensor index entries are 8 bits");
 
-#define SENSOR_STALE_TIMEOUT_SECONDS 600  // 10 minutes
+static sensor_key_t sensor_keys[MAX_SENSORS];
+static atomic_uchar sensor_index[SENSOR_INDEX_SIZE];
+
+// Last value pushed to sinks for each sensor, used to apply publish policies.
+// Only touched by the dispatcher task once the sensor is registered.
+typedef struct {
+    float value;
+    int64_t time_us;
+    bool available;
+    bool valid;         // false until the first publish
+} sensor_published_t;
+
+static sensor_published_t sensor_published[MAX_SENSORS];
+static settings_t *g_settings = NULL;
+
+static atomic_uint publish_count = 0;
+static atomic_uint publish_suppressed_deadband = 0;
+static atomic_uint publish_suppressed_interval = 0;
+
+// Update events. Producers mark a sensor pending and push its ID onto a
+// bounded lock-free MPSC ring (Vyukov-style, one sequence number per cell);
+// the dispatcher task drains it and fans the latest snapshot out to
+// subscribers. A sensor is queued at most once while pending, so repeated
+// updates coalesce and the ring, sized to hold every sensor, cannot overflow.
+#define SENSOR_EVENT_QUEUE_SIZE 128
+_Static_assert(SENSOR_EVENT_QUEUE_SIZE >= MAX_SENSORS, "event queue must hold every sensor");
+_Static_assert((SENSOR_EVENT_QUEUE_SIZE & (SENSOR_EVENT_QUEUE_SIZE - 1)) == 0, "event queue size must be a power of two");
+
+typedef struct {
+    atomic_uint seq;
+    uint8_t sensor_id;
+} sensor_event_cell_t;
+
+static sensor_event_cell_t event_queue[SENSOR_EVENT_QUEUE_SIZE];
+static atomic_uint event_enqueue_pos = 0;
+static atomic_uint event_dequeue_pos = 0;
+static atomic_bool sensor_pending[MAX_SENSORS];
+static TaskHandle_t dispatcher_task_handle = NULL;
+
+#define MAX_SENSOR_SUBSCRIBERS 8
+
+typedef struct {
+    sensor_subscriber_cb_t callback;
+    void *user_data;
+} sensor_subscriber_t;
+
+static sensor_subscriber_t subscribers[MAX_SENSOR_SUBSCRIBERS];
+static atomic_int subscriber_count = 0;
+
+// Event and producer latency counters
+static atomic_uint events_enqueued = 0;
+static atomic_uint events_coalesced = 0;
+static atomic_uint events_dropped = 0;
+static atomic_uint events_dispatched = 0;
+static atomic_uint update_count = 0;
+static atomic_uint update_max_us = 0;
+static atomic_uint_fast64_t update_total_us = 0;
+
+// Throughput counters per sensor and per producer
+static atomic_uint sensor_update_counts[MAX_SENSORS];
+static atomic_uint producer_update_counts[SENSOR_PRODUCER_COUNT];
+static uint8_t sensor_producer[MAX_SENSORS];    // sensor_producer_t
+
+static const char *sensor_producer_names[SENSOR_PRODUCER_COUNT] = {
+    [SENSOR_PRODUCER_OTHER] = "other",
+    [SENSOR_PRODUCER_WEIGHT] = "weight",
+    [SENSOR_PRODUCER_DS18B20] = "ds18b20",
+    [SENSOR_PRODUCER_BTHOME] = "bthome",
+    [SENSOR_PRODUCER_PUMP] = "pump",
+};
 
 static const char *sensors_display_html = ""
     "<!DOCTYPE html>\n"
@@ -65,51 +252,101 @@ static const char *sensors_display_html = ""
     "  if (diff < 86400) return Math.floor(diff / 3600) + 'h ago';\n"
     "  return Math.floor(diff / 86400) + 'd ago';\n"
     "}\n"
+    "var sensorsETag = null;\n"
+    "var sensorsById = {};\n"
+    "function setStatus(text, active) {\n"
+    "  document.getElementById('status').textContent = text;\n"
+    "  document.getElementById('status').className = 'status ' + (active ? 'active' : 'inactive');\n"
+    "}\n"
+    "function renderCard(sensor) {\n"
+    "  const availClass = sensor.available ? '' : 'unavailable';\n"
+    "  const value = sensor.available ? sensor.value.toLocaleString(undefined, {maximumFractionDigits: 2}) : '--';\n"
+    "  const actionBtn = (sensor.link_url && sensor.link_text) ? \n"
+    "    `<div class='sensor-action'><button onclick='sensorAction(\"${sensor.link_url}\")' ${sensor.available ? '' : 'disabled'}>${sensor.link_text}</button></div>` : '';\n"
+    "  return `\n"
+    "    <div id='sensor-${sensor.id}' class='sensor-card ${availClass}'>\n"
+    "      <div class='sensor-name'>${sensor.name}</div>\n"
+    "      <div class='sensor-value'>${value}</div>\n"
+    "      <div class='sensor-unit'>${sensor.unit}</div>\n"
+    "      <div class='sensor-updated' data-updated='${sensor.last_updated}'>${formatTimeAgo(sensor.last_updated)}</div>\n"
+    "      ${actionBtn}\n"
+    "    </div>\n"
+    "  `;\n"
+    "}\n"
+    "function renderSensors() {\n"
+    "  const container = document.getElementById('sensors-container');\n"
+    "  const sensors = Object.values(sensorsById);\n"
+    "  if (sensors.length > 0) {\n"
+    "    container.innerHTML = sensors.map(renderCard).join('');\n"
+    "    setStatus('Active', true);\n"
+    "  } else {\n"
+    "    container.innerHTML = '<p style=\"grid-column: 1/-1; color: #999;\">No sensors registered</p>';\n"
+    "    setStatus('No sensors available', false);\n"
+    "  }\n"
+    "}\n"
+    "// Replace just the card of a sensor pushed over the event stream\n"
+    "function updateSensor(sensor) {\n"
+    "  sensorsById[sensor.id] = sensor;\n"
+    "  const card = document.getElementById('sensor-' + sensor.id);\n"
+    "  if (card) card.outerHTML = renderCard(sensor);\n"
+    "  else renderSensors();\n"
+    "}\n"
+    "// Keep the 'updated ... ago' labels current between changes\n"
+    "function refreshTimes() {\n"
+    "  document.querySelectorAll('.sensor-updated').forEach(el => {\n"
+    "    el.textContent = formatTimeAgo(Number(el.dataset.updated));\n"
+    "  });\n"
+    "}\n"
+    "// Push: the server sends each sensor as it changes\n"
+    "function streamSensors() {\n"
+    "  const source = new EventSource('/sensors/stream');\n"
+    "  source.addEventListener('sensor', e => updateSensor(JSON.parse(e.data)));\n"
+    "  source.onopen = () => setStatus('Active', true);\n"
+    "  source.onerror = () => {\n"
+    "    if (source.readyState === EventSource.CLOSED) {\n"
+    "      // Refused (stream limit reached); fall back to long-polling\n"
+    "      source.close();\n"
+    "      pollSensors();\n"
+    "    } else {\n"
+    "      setStatus('Reconnecting...', false);\n"
+    "    }\n"
+    "  };\n"
+    "}\n"
+    "// Long-poll: the server holds the request until the data changes (or\n"
+    "// answers 304 after the wait), so an idle dashboard costs almost nothing\n"
     "function updateSensors() {\n"
-    "  fetch('/sensors/data')\n"
-    "    .then(response => response.json())\n"
-    "    .then(data => {\n"
-    "      const container = document.getElementById('sensors-container');\n"
-    "      if (data.sensors && data.sensors.length > 0) {\n"
-    "        container.innerHTML = data.sensors.map(sensor => {\n"
-    "          const availClass = sensor.available ? '' : 'unavailable';\n"
-    "          const value = sensor.available ? sensor.value.toLocaleString(undefined, {maximumFractionDigits: 2}) : '--';\n"
-    "          const updated = formatTimeAgo(sensor.last_updated);\n"
-    "          const actionBtn = (sensor.link_url && sensor.link_text) ? \n"
-    "            `<div class='sensor-action'><button onclick='sensorAction(\"${sensor.link_url}\")' ${sensor.available ? '' : 'disabled'}>${sensor.link_text}</button></div>` : '';\n"
-    "          return `\n"
-    "            <div class='sensor-card ${availClass}'>\n"
-    "              <div class='sensor-name'>${sensor.name}</div>\n"
-    "              <div class='sensor-value'>${value}</div>\n"
-    "              <div class='sensor-unit'>${sensor.unit}</div>\n"
-    "              <div class='sensor-updated'>${updated}</div>\n"
-    "              ${actionBtn}\n"
-    "            </div>\n"
-    "          `;\n"
-    "        }).join('');\n"
-    "        document.getElementById('status').textContent = 'Active';\n"
-    "        document.getElementById('status').className = 'status active';\n"
-    "      } else {\n"
-    "        container.innerHTML = '<p style=\"grid-column: 1/-1; color: #999;\">No sensors registered</p>';\n"
-    "        document.getElementById('status').textContent = 'No sensors available';\n"
-    "        document.getElementById('status').className = 'status inactive';\n"
-    "      }\n"
-    "    })\n"
+    "  const headers = sensorsETag ? {'If-None-Match': sensorsETag} : {};\n"
+    "  return fetch('/sensors/data' + (sensorsETag ? '?wait=25' : ''), {headers: headers, cache: 'no-store'})\n"
+    "    .then(response => {\n"
+    "      if (response.status === 304) return;\n"
+    "      if (!response.ok) throw new Error(response.status);\n"
+    "      sensorsETag = response.headers.get('ETag');\n"
+    "      return response.json().then(data => {\n"
+    "        sensorsById = {};\n"
+    "        (data.sensors || []).forEach(sensor => { sensorsById[sensor.id] = sensor; });\n"
+    "        renderSensors();\n"
+    "      });\n"
+    "    });\n"
+    "}\n"
+    "function pollSensors() {\n"
+    "  updateSensors()\n"
+    "    .then(() => pollSensors())\n"
     "    .catch(error => {\n"
-    "      document.getElementById('status').textContent = 'Error: ' + error;\n"
-    "      document.getElementById('status').className = 'status inactive';\n"
+    "      sensorsETag = null;\n"
+    "      setStatus('Error: ' + error, false);\n"
+    "      setTimeout(pollSensors, 1000);\n"
     "    });\n"
     "}\n"
     "function sensorAction(url) {\n"
     "  fetch(url, {method: 'POST'})\n"
     "    .then(response => {\n"
-    "      if (response.ok) updateSensors();\n"
-    "      else alert('Action failed');\n"
+    "      if (!response.ok) alert('Action failed');\n"
     "    })\n"
     "    .catch(error => alert('Action error: ' + error));\n"
     "}\n"
-    "updateSensors();\n"
-    "setInterval(updateSensors, 1000);\n"
+    "if (window.EventSource) streamSensors();\n"
+    "else pollSensors();\n"
+    "setInterval(refreshTimes, 1000);\n"
     "</script>\n"
     "<footer style='margin-top: 40px; padding-top: 20px; border-top: 1px solid #ddd; text-align: center; color: #999; font-size: 12px;'>\n"
     "<div id='version'>Loading version...</div>\n"
@@ -128,14 +365,22 @@ static const char *sensors_display_html = ""
     "</body>\n"
     "</html>\n";
 
+static inline void sensor_write_begin(int sensor_id) {
+    atomic_fetch_add_explicit(&sensor_seq[sensor_id], 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void sensor_write_end(int sensor_id) {
+    atomic_fetch_add_explicit(&sensor_seq[sensor_id], 1, memory_order_release);
+}
+
 static esp_err_t sensors_display_handler(httpd_req_t *req) {
     settings_t *settings = (settings_t *)req->user_ctx;
     const char *hostname = (settings->hostname != NULL && settings->hostname[0] != '\0') 
                             ? settings->hostname : "unknown";
     
     // Create a buffer for the complete HTML with hostname
-    char *html_with_hostname = malloc(strlen(sensors_display_html) + strlen(hostname) + 32);
-    atomic_fetch_add(&malloc_count_sensors, 1);
+    char *html_with_hostname = tracked_malloc(ALLOC_SENSORS, strlen(sensors_display_html) + strlen(hostname) + 32);
     if (html_with_hostname == NULL) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
@@ -160,71 +405,452 @@ static esp_err_t sensors_display_handler(httpd_req_t *req) {
     httpd_resp_set_type(req, "text/html");
     httpd_resp_set_hdr(req, "Connection", "keep-alive");
     httpd_resp_send(req, html_with_hostname, strlen(html_with_hostname));
-    free(html_with_hostname);
-    atomic_fetch_add(&free_count_sensors, 1);
+    tracked_free(ALLOC_SENSORS, html_with_hostname);
     return ESP_OK;
 }
 
-static esp_err_t sensors_data_handler(httpd_req_t *req) {
-    // Build JSON response with all sensors
-    char *json_buf = malloc(2048); // Allocate buffer for JSON
-    atomic_fetch_add(&malloc_count_sensors, 1);
-    if (json_buf == NULL) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+// Format one sensor as the JSON object used by /sensors/data and /sensors/stream
+static int sensor_format_json(int sensor_id, const sensor_data_t *sensor, char *buf, size_t len) {
+    int pos = snprintf(buf, len,
+                   "{\"id\":%d,\"name\":\"%s\",\"unit\":\"%s\",\"value\":%.2f,\"last_updated\":%" PRId64 ",\"last_updated_ms\":%" PRId64 ",\"available\":%s",
+                   sensor_id,
+                   sensor->display_name,
+                   sensor->unit,
+                   sensor->value,
+                   (int64_t)sensor->last_updated,
+                   sensor->last_updated_ms,
+                   sensor->available ? "true" : "false");
+    
+    // Add optional link fields if present
+    if (sensor->link_url[0] != '\0' && sensor->link_text[0] != '\0' && pos < (int)len) {
+        pos += snprintf(buf + pos, len - pos,
+                       ",\"link_url\":\"%s\",\"link_text\":\"%s\"",
+                       sensor->link_url,
+                       sensor->link_text);
     }
     
-    if (sensors_mutex != NULL) {
-        xSemaphoreTake(sensors_mutex, portMAX_DELAY);
+    if (pos < (int)len) {
+        pos += snprintf(buf + pos, len - pos, "}");
     }
+    // Truncated output is still NUL-terminated within buf
+    return pos < (int)len ? pos : (int)len - 1;
+}
+
+// ETag for the current /sensors/data contents. Wall-clock timestamps appear
+// once SNTP sets the clock, which changes the body without an update.
+static void sensors_data_etag(char *etag, size_t len) {
+    snprintf(etag, len, "\"%u-%d\"", atomic_load(&sensors_generation), g_ntp_initialized ? 1 : 0);
+}
+
+// Send the full /sensors/data JSON with its ETag
+static esp_err_t sensors_data_send(httpd_req_t *req) {
+    char etag[SENSORS_ETAG_LEN];
+    sensors_data_etag(etag, sizeof(etag));
     
-    int pos = snprintf(json_buf, 2048, "{\"sensors\":[");
+    httpd_resp_set_status(req, HTTPD_200);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    
+    // Stream one chunk per sensor, so the body is complete however many
+    // sensors there are
+    esp_err_t err = httpd_resp_send_chunk(req, "{\"sensors\":[", HTTPD_RESP_USE_STRLEN);
     
-    for (int i = 0; i < sensor_count && pos < 2000; i++) {
-        if (sensors[i].display_name[0] == '\0' || sensors[i].unit[0] == '\0') {
+    int count = sensors_get_count();
+    bool first = true;
+    for (int i = 0; i < count && err == ESP_OK; i++) {
+        sensor_data_t sensor;
+        if (!sensors_read_snapshot(i, &sensor)) {
             continue;
         }
-        if (i > 0) {
-            pos += snprintf(json_buf + pos, 2048 - pos, ",");
+        if (sensor.display_name[0] == '\0' || sensor.unit[0] == '\0') {
+            continue;
         }
         
-        // Build JSON object for this sensor
+        // Leading comma, then the sensor
         char sensor_json[512];
-        int spos = snprintf(sensor_json, sizeof(sensor_json),
-                       "{\"name\":\"%s\",\"unit\":\"%s\",\"value\":%.2f,\"last_updated\":%" PRId64 ",\"available\":%s",
-                       sensors[i].display_name,
-                       sensors[i].unit,
-                       sensors[i].value,
-                       (int64_t)sensors[i].last_updated,
-                       sensors[i].available ? "true" : "false");
+        sensor_json[0] = ',';
+        int len = sensor_format_json(i, &sensor, sensor_json + 1, sizeof(sensor_json) - 1);
+        err = first ? httpd_resp_send_chunk(req, sensor_json + 1, len)
+                    : httpd_resp_send_chunk(req, sensor_json, len + 1);
+        first = false;
+    }
+    
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, "]}", HTTPD_RESP_USE_STRLEN);
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return err;
+}
+
+static esp_err_t sensors_data_send_not_modified(httpd_req_t *req, const char *etag) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// Answer parked long-polls whose data changed or whose wait expired
+static void sensors_long_poll_task(void *pvParameters) {
+    while (1) {
+        TickType_t wait_ticks = portMAX_DELAY;
+        int64_t now_us = esp_timer_get_time();
         
-        // Add optional link fields if present
-        if (sensors[i].link_url[0] != '\0' && sensors[i].link_text[0] != '\0') {
-            spos += snprintf(sensor_json + spos, sizeof(sensor_json) - spos,
-                           ",\"link_url\":\"%s\",\"link_text\":\"%s\"",
-                           sensors[i].link_url,
-                           sensors[i].link_text);
+        tracked_mutex_take(long_poll_mutex, portMAX_DELAY);
+        for (int i = 0; i < long_poll_count; i++) {
+            int64_t remaining_us = long_polls[i].deadline_us - now_us;
+            TickType_t ticks = remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 0;
+            if (ticks < wait_ticks) {
+                wait_ticks = ticks;
+            }
         }
+        tracked_mutex_give(long_poll_mutex);
+        
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
         
-        spos += snprintf(sensor_json + spos, sizeof(sensor_json) - spos, "}");
+        // Pull out ready requests under the lock, respond outside it
+        sensors_long_poll_t ready[SENSORS_MAX_LONG_POLLS];
+        int ready_count = 0;
+        char etag[SENSORS_ETAG_LEN];
+        sensors_data_etag(etag, sizeof(etag));
+        now_us = esp_timer_get_time();
         
-        // Append to main buffer
-        pos += snprintf(json_buf + pos, 2048 - pos, "%s", sensor_json);
+        tracked_mutex_take(long_poll_mutex, portMAX_DELAY);
+        for (int i = 0; i < long_poll_count; ) {
+            if (strcmp(long_polls[i].etag, etag) != 0 || now_us >= long_polls[i].deadline_us) {
+                ready[ready_count++] = long_polls[i];
+                long_polls[i] = long_polls[--long_poll_count];
+            } else {
+                i++;
+            }
+        }
+        tracked_mutex_give(long_poll_mutex);
+        
+        for (int i = 0; i < ready_count; i++) {
+            if (strcmp(ready[i].etag, etag) != 0) {
+                sensors_data_send(ready[i].req);
+            } else {
+                sensors_data_send_not_modified(ready[i].req, etag);
+            }
+            httpd_req_async_handler_complete(ready[i].req);
+        }
+    }
+}
+
+static void long_poll_subscriber(int sensor_id, const sensor_data_t *sensor, void *user_data) {
+    if (long_poll_task_handle != NULL && long_poll_count > 0) {
+        xTaskNotifyGive(long_poll_task_handle);
+    }
+}
+
+static esp_err_t sensors_data_handler(httpd_req_t *req) {
+    char etag[SENSORS_ETAG_LEN];
+    sensors_data_etag(etag, sizeof(etag));
+    
+    char if_none_match[SENSORS_ETAG_LEN];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) != ESP_OK ||
+        strcmp(if_none_match, etag) != 0) {
+        return sensors_data_send(req);
     }
     
-    pos += snprintf(json_buf + pos, 2048 - pos, "]}");
+    // Client is up to date; park the request if it asked to wait for a change
+    int wait = 0;
+    char query[32];
+    char param[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "wait", param, sizeof(param)) == ESP_OK) {
+        wait = atoi(param);
+        if (wait > SENSORS_LONG_POLL_MAX_SECONDS) {
+            wait = SENSORS_LONG_POLL_MAX_SECONDS;
+        }
+    }
     
-    if (sensors_mutex != NULL) {
-        xSemaphoreGive(sensors_mutex);
+    if (wait > 0 && long_poll_task_handle != NULL) {
+        tracked_mutex_take(long_poll_mutex, portMAX_DELAY);
+        if (long_poll_count < SENSORS_MAX_LONG_POLLS) {
+            httpd_req_t *async_req = NULL;
+            if (http_server_req_async_begin(req, &async_req) == ESP_OK) {
+                sensors_long_poll_t *poll = &long_polls[long_poll_count++];
+                poll->req = async_req;
+                poll->deadline_us = esp_timer_get_time() + (int64_t)wait * 1000000;
+                strcpy(poll->etag, etag);
+                tracked_mutex_give(long_poll_mutex);
+                // Wake the task so it picks up the new deadline and rechecks the ETag
+                xTaskNotifyGive(long_poll_task_handle);
+                return ESP_OK;
+            }
+        }
+        tracked_mutex_give(long_poll_mutex);
+    }
+    
+    return sensors_data_send_not_modified(req, etag);
+}
+
+// Drop a stream whose client went away. The response never finishes, so the
+// socket is closed rather than left for keep-alive.
+static void sensors_stream_close(httpd_req_t *req) {
+    httpd_handle_t server = req->handle;
+    int sockfd = httpd_req_to_sockfd(req);
+    httpd_req_async_handler_complete(req);
+    httpd_sess_trigger_close(server, sockfd);
+}
+
+// Write pending sensor changes (or a keep-alive comment) to one stream.
+// Returns false if the client is gone.
+static bool sensors_stream_flush(sensors_stream_t *stream, const uint32_t *dirty, char *buf) {
+    httpd_req_t *req = stream->req;
+    int pos = 0;
+    
+    if (!stream->started) {
+        httpd_resp_set_status(req, HTTPD_200);
+        httpd_resp_set_type(req, "text/event-stream");
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        pos += snprintf(buf, SENSORS_STREAM_BUF_SIZE, "retry: 2000\n\n");
+        stream->started = true;
+    }
+    
+    int count = sensors_get_count();
+    for (int i = 0; i < count; i++) {
+        if ((dirty[i / 32] & (1u << (i % 32))) == 0) {
+            continue;
+        }
+        sensor_data_t sensor;
+        if (!sensors_read_snapshot(i, &sensor) || sensor.display_name[0] == '\0' || sensor.unit[0] == '\0') {
+            continue;
+        }
+        
+        char sensor_json[512];
+        int len = sensor_format_json(i, &sensor, sensor_json, sizeof(sensor_json));
+        if (pos + len + 32 > SENSORS_STREAM_BUF_SIZE) {
+            if (httpd_resp_send_chunk(req, buf, pos) != ESP_OK) {
+                return false;
+            }
+            pos = 0;
+        }
+        pos += snprintf(buf + pos, SENSORS_STREAM_BUF_SIZE - pos, "event: sensor\ndata: %s\n\n", sensor_json);
+        atomic_fetch_add(&stream_events_sent, 1);
+    }
+    
+    int64_t now_us = esp_timer_get_time();
+    if (pos == 0) {
+        if (now_us - stream->last_send_us < (int64_t)SENSORS_STREAM_KEEPALIVE_SECONDS * 1000000) {
+            return true;
+        }
+        // Comment line; keeps proxies and the browser from timing out an idle stream
+        pos = snprintf(buf, SENSORS_STREAM_BUF_SIZE, ": keepalive\n\n");
+    }
+    
+    stream->last_send_us = now_us;
+    return httpd_resp_send_chunk(req, buf, pos) == ESP_OK;
+}
+
+// Push changed sensors to /sensors/stream clients. Sends block for at most the
+// server's send timeout, so one stalled client can delay the others briefly.
+static void sensors_stream_task(void *pvParameters) {
+    static char buf[SENSORS_STREAM_BUF_SIZE];
+    
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SENSORS_STREAM_KEEPALIVE_SECONDS * 1000));
+        
+        // The handler only appends and this task is the only one removing, so
+        // streams[i] stays put while it is written outside the lock
+        for (int i = 0; ; ) {
+            uint32_t dirty[SENSOR_DIRTY_WORDS];
+            tracked_mutex_take(stream_mutex, portMAX_DELAY);
+            if (i >= stream_count) {
+                tracked_mutex_give(stream_mutex);
+                break;
+            }
+            sensors_stream_t *stream = &streams[i];
+            memcpy(dirty, stream->dirty, sizeof(dirty));
+            memset(stream->dirty, 0, sizeof(stream->dirty));
+            tracked_mutex_give(stream_mutex);
+            
+            if (sensors_stream_flush(stream, dirty, buf)) {
+                i++;
+                continue;
+            }
+            
+            ESP_LOGI(TAG, "Sensor stream client disconnected");
+            httpd_req_t *req = stream->req;
+            tracked_mutex_take(stream_mutex, portMAX_DELAY);
+            streams[i] = streams[--stream_count];
+            tracked_mutex_give(stream_mutex);
+            sensors_stream_close(req);
+        }
+    }
+}
+
+static void stream_subscriber(int sensor_id, const sensor_data_t *sensor, void *user_data) {
+    if (stream_task_handle == NULL || stream_count == 0) {
+        return;
+    }
+    tracked_mutex_take(stream_mutex, portMAX_DELAY);
+    for (int i = 0; i < stream_count; i++) {
+        streams[i].dirty[sensor_id / 32] |= 1u << (sensor_id % 32);
+    }
+    tracked_mutex_give(stream_mutex);
+    xTaskNotifyGive(stream_task_handle);
+}
+
+static esp_err_t sensors_stream_handler(httpd_req_t *req) {
+    if (stream_task_handle == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Streaming unavailable");
+        return ESP_FAIL;
+    }
+    
+    tracked_mutex_take(stream_mutex, portMAX_DELAY);
+    if (stream_count >= SENSORS_MAX_STREAMS) {
+        tracked_mutex_give(stream_mutex);
+        atomic_fetch_add(&streams_rejected, 1);
+        // Dashboards fall back to long-polling /sensors/data
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "30");
+        httpd_resp_send(req, "Too many streams", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    
+    httpd_req_t *async_req = NULL;
+    if (http_server_req_async_begin(req, &async_req) != ESP_OK) {
+        tracked_mutex_give(stream_mutex);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    
+    // Start with every sensor dirty so the client gets a full snapshot
+    sensors_stream_t *stream = &streams[stream_count++];
+    memset(stream, 0, sizeof(*stream));
+    stream->req = async_req;
+    memset(stream->dirty, 0xFF, sizeof(stream->dirty));
+    tracked_mutex_give(stream_mutex);
+    
+    atomic_fetch_add(&streams_accepted, 1);
+    xTaskNotifyGive(stream_task_handle);
+    return ESP_OK;
+}
+
+// State for streaming a sensor's history as chunked JSON or binary
+typedef struct {
+    httpd_req_t *req;
+    bool binary;
+    bool first;
+    int64_t boot_time;      // Unix time at boot, to convert sample timestamps
+    esp_err_t err;          // First send failure; the client has gone away
+    size_t len;
+    char buf[256];
+} history_stream_t;
+
+static void history_stream_flush(history_stream_t *stream) {
+    if (stream->len > 0 && stream->err == ESP_OK) {
+        stream->err = httpd_resp_send_chunk(stream->req, stream->buf, stream->len);
+    }
+    stream->len = 0;
+}
+
+static bool history_stream_sample(uint32_t timestamp, float value, void *user_data) {
+    history_stream_t *stream = (history_stream_t *)user_data;
+    int64_t unix_time = stream->boot_time + timestamp;
+    
+    if (stream->binary) {
+        // Little-endian uint32 Unix time followed by little-endian float32
+        if (stream->len + 8 > sizeof(stream->buf)) {
+            history_stream_flush(stream);
+        }
+        uint32_t t = (uint32_t)unix_time;
+        uint32_t v;
+        memcpy(&v, &value, sizeof(v));
+        for (int i = 0; i < 4; i++) {
+            stream->buf[stream->len + i] = (char)(t >> (8 * i));
+            stream->buf[stream->len + 4 + i] = (char)(v >> (8 * i));
+        }
+        stream->len += 8;
+        return stream->err == ESP_OK;
+    }
+    
+    char point[48];
+    int n = snprintf(point, sizeof(point), "%s[%" PRId64 ",%.6g]",
+                     stream->first ? "" : ",", unix_time, value);
+    stream->first = false;
+    if (stream->len + n > sizeof(stream->buf)) {
+        history_stream_flush(stream);
+    }
+    memcpy(stream->buf + stream->len, point, n);
+    stream->len += n;
+    return stream->err == ESP_OK;
+}
+
+static esp_err_t sensors_history_handler(httpd_req_t *req) {
+    char query[64];
+    char param[16];
+    int sensor_id = -1;
+    int64_t since = 0;
+    bool binary = false;
+    
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "id", param, sizeof(param)) == ESP_OK) {
+            sensor_id = atoi(param);
+        }
+        if (httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK) {
+            since = strtoll(param, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "format", param, sizeof(param)) == ESP_OK) {
+            binary = (strcmp(param, "binary") == 0);
+        }
+    }
+    
+    sensor_data_t sensor;
+    if (!sensors_read_snapshot(sensor_id, &sensor)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown sensor id");
+        return ESP_OK;
+    }
+    
+    history_stream_t stream = {
+        .req = req,
+        .binary = binary,
+        .first = true,
+        .boot_time = (int64_t)time(NULL) - esp_timer_get_time() / 1000000,
+        .err = ESP_OK,
+        .len = 0,
+    };
+    
+    // History timestamps are seconds since boot
+    int64_t since_uptime = since - stream.boot_time;
+    if (since_uptime < 0) {
+        since_uptime = 0;
     }
     
     httpd_resp_set_status(req, HTTPD_200);
-    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "application/json");
     httpd_resp_set_hdr(req, "Connection", "keep-alive");
-    httpd_resp_send(req, json_buf, strlen(json_buf));
-    free(json_buf);
-    atomic_fetch_add(&free_count_sensors, 1);
-    return ESP_OK;
+    
+    if (!binary) {
+        stream.len = snprintf(stream.buf, sizeof(stream.buf),
+                              "{\"id\":%d,\"name\":\"%s\",\"unit\":\"%s\",\"interval\":%d,\"samples\":[",
+                              sensor_id, sensor.display_name, sensor.unit, SENSOR_HISTORY_INTERVAL_SECONDS);
+    }
+    
+    sensor_history_query(sensor_id, (uint32_t)since_uptime, history_stream_sample, &stream);
+    if (stream.err != ESP_OK) {
+        ESP_LOGW(TAG, "History client for sensor %d went away: %s", sensor_id, esp_err_to_name(stream.err));
+        return stream.err;
+    }
+    
+    if (!binary) {
+        if (stream.len + 2 > sizeof(stream.buf)) {
+            history_stream_flush(&stream);
+        }
+        memcpy(stream.buf + stream.len, "]}", 2);
+        stream.len += 2;
+    }
+    history_stream_flush(&stream);
+    if (stream.err != ESP_OK) {
+        return stream.err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 static esp_err_t version_handler(httpd_req_t *req) {
@@ -263,6 +889,20 @@ static httpd_uri_t sensors_data_uri = {
     .user_ctx  = NULL
 };
 
+static httpd_uri_t sensors_history_uri = {
+    .uri       = "/sensors/history",
+    .method    = HTTP_GET,
+    .handler   = sensors_history_handler,
+    .user_ctx  = NULL
+};
+
+static httpd_uri_t sensors_stream_uri = {
+    .uri       = "/sensors/stream",
+    .method    = HTTP_GET,
+    .handler   = sensors_stream_handler,
+    .user_ctx  = NULL
+};
+
 static httpd_uri_t version_uri = {
     .uri       = "/version",
     .method    = HTTP_GET,
@@ -270,75 +910,501 @@ static httpd_uri_t version_uri = {
     .user_ctx  = NULL
 };
 
-int sensors_register(
+sensor_key_t sensor_key_from_mac(const uint8_t mac[6], uint16_t metric) {
+    sensor_key_t key = { .device = 0, .metric = metric };
+    for (int i = 0; i < 6; i++) {
+        key.device = (key.device << 8) | mac[i];
+    }
+    return key;
+}
+
+static uint32_t sensor_key_hash(sensor_key_t key) {
+    // splitmix64 finalizer; MACs from one vendor differ only in the low bytes
+    uint64_t h = key.device ^ ((uint64_t)key.metric << 48);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return (uint32_t)h;
+}
+
+int sensors_find(sensor_key_t key) {
+    uint32_t slot = sensor_key_hash(key);
+    for (int i = 0; i < SENSOR_INDEX_SIZE; i++) {
+        slot &= SENSOR_INDEX_SIZE - 1;
+        uint8_t entry = atomic_load_explicit(&sensor_index[slot], memory_order_acquire);
+        if (entry == 0) {
+            return -1;
+        }
+        int id = entry - 1;
+        if (sensor_keys[id].device == key.device && sensor_keys[id].metric == key.metric) {
+            return id;
+        }
+        slot++;
+    }
+    return -1;
+}
+
+// Caller must hold sensors_mutex and have called sensors_find first
+static void sensor_index_insert(sensor_key_t key, int id) {
+    sensor_keys[id] = key;
+    uint32_t slot = sensor_key_hash(key);
+    for (;;) {
+        slot &= SENSOR_INDEX_SIZE - 1;
+        if (atomic_load_explicit(&sensor_index[slot], memory_order_relaxed) == 0) {
+            atomic_store_explicit(&sensor_index[slot], (uint8_t)(id + 1), memory_order_release);
+            return;
+        }
+        slot++;
+    }
+}
+
+// Intern a sensor's names and unit. Done before sensor_write_begin so the
+// pool lock is never taken while readers are spinning on the slot.
+static void sensor_intern_metadata(
+    sensor_meta_t *meta,
     const char *display_name,
     const char *unit,
     const char *metric_name,
     const char *device_name, 
     const char *device_id) {
-    if (sensors_mutex != NULL) {
-        xSemaphoreTake(sensors_mutex, portMAX_DELAY);
-    }
-    
-    if (sensor_count >= MAX_SENSORS) {
+    meta->display_name = string_pool_intern(display_name, SENSOR_DISPLAY_NAME_MAX_LEN);
+    meta->unit = string_pool_intern(unit, SENSOR_UNIT_MAX_LEN);
+    meta->metric_name = string_pool_intern(metric_name, SENSOR_DISPLAY_NAME_MAX_LEN);
+    meta->device_name = string_pool_intern(device_name, SENSOR_DEVICE_NAME_MAX_LEN);
+    meta->device_id = string_pool_intern(device_id, SENSOR_DEVICE_ID_MAX_LEN);
+}
+
+// Claim and initialize a new slot. Caller must hold sensors_mutex.
+static int sensor_add_locked(
+    const sensor_key_t *key,
+    const char *display_name,
+    const char *unit,
+    const char *metric_name,
+    const char *device_name, 
+    const char *device_id) {
+    int id = atomic_load_explicit(&sensor_count, memory_order_relaxed);
+    if (id >= MAX_SENSORS) {
         ESP_LOGE(TAG, "Cannot register sensor '%s': maximum number of sensors (%d) reached", 
                  display_name, MAX_SENSORS);
-        if (sensors_mutex != NULL) {
-            xSemaphoreGive(sensors_mutex);
-        }
         return -1;
     }
     
-    int id = sensor_count++;
+    sensor_meta_t meta;
+    sensor_intern_metadata(&meta, display_name, unit, metric_name, device_name, device_id);
     
-    // Copy name, unit, and metric_name, ensuring null termination
-    if (display_name != NULL && strlen(display_name) > 0) {
-        strncpy(sensors[id].display_name, display_name, SENSOR_DISPLAY_NAME_MAX_LEN - 1);
-        sensors[id].display_name[SENSOR_DISPLAY_NAME_MAX_LEN - 1] = '\0';
-    } else {
-        sensors[id].display_name[0] = '\0';
+    sensor_write_begin(id);
+    
+    sensor_meta[id] = meta;
+    sensor_state[id].value = 0.0f;
+    sensor_state[id].updated_us = 0;
+    sensor_state[id].available = false;
+    sensor_state[id].link_slot = SENSOR_NO_LINK;
+    sensor_state[id].link_text = STRING_HANDLE_EMPTY;
+    
+    sensor_write_end(id);
+    atomic_fetch_add(&sensors_generation, 1);
+    
+    memset(&sensor_published[id], 0, sizeof(sensor_published[id]));
+    sensor_timeout_s[id] = SENSOR_DEFAULT_TIMEOUT_SECONDS;
+    
+    // Publish the new slot only once it is fully initialized
+    atomic_store_explicit(&sensor_count, id + 1, memory_order_release);
+    atomic_fetch_add(&sensors_meta_generation, 1);
+    if (key != NULL) {
+        sensor_index_insert(*key, id);
+    }
+    
+    ESP_LOGI(TAG, "Registered sensor %d: '%s' (%s) [metric: %s]", id,
+             string_pool_get(meta.display_name), string_pool_get(meta.unit), string_pool_get(meta.metric_name));
+    return id;
+}
+
+int sensors_register(
+    const char *display_name,
+    const char *unit,
+    const char *metric_name,
+    const char *device_name, 
+    const char *device_id) {
+    if (sensors_mutex != NULL) {
+        tracked_mutex_take(sensors_mutex, portMAX_DELAY);
+    }
+    
+    int id = sensor_add_locked(NULL, display_name, unit, metric_name, device_name, device_id);
+    
+    if (sensors_mutex != NULL) {
+        tracked_mutex_give(sensors_mutex);
     }
+    return id;
+}
 
-    if (device_name && strlen(device_name) > 0) {
-        strncpy(sensors[id].device_name, device_name, SENSOR_DEVICE_NAME_MAX_LEN - 1);
-        sensors[id].device_name[SENSOR_DEVICE_NAME_MAX_LEN - 1] = '\0';
-    } else {
-        sensors[id].device_name[0] = '\0';
+int sensors_register_with_key(
+    sensor_key_t key,
+    const char *display_name,
+    const char *unit,
+    const char *metric_name,
+    const char *device_name,
+    const char *device_id) {
+    if (sensors_mutex != NULL) {
+        tracked_mutex_take(sensors_mutex, portMAX_DELAY);
     }
     
-    if (device_id && strlen(device_id) > 0) {
-        strncpy(sensors[id].device_id, device_id, SENSOR_DEVICE_ID_MAX_LEN - 1);
-        sensors[id].device_id[SENSOR_DEVICE_ID_MAX_LEN - 1] = '\0';
+    // Re-check under the lock so concurrent registrations of one key share a slot
+    int id = sensors_find(key);
+    if (id >= 0) {
+        sensor_meta_t meta;
+        sensor_intern_metadata(&meta, display_name, unit, metric_name, device_name, device_id);
+        sensor_write_begin(id);
+        sensor_meta[id] = meta;
+        sensor_write_end(id);
+        atomic_fetch_add(&sensors_generation, 1);
+        atomic_fetch_add(&sensors_meta_generation, 1);
+        ESP_LOGI(TAG, "Re-registered sensor %d: '%s' (%s) [metric: %s]", id,
+                 string_pool_get(meta.display_name), string_pool_get(meta.unit), string_pool_get(meta.metric_name));
     } else {
-        sensors[id].device_id[0] = '\0';
+        id = sensor_add_locked(&key, display_name, unit, metric_name, device_name, device_id);
     }
     
-    if (unit != NULL && strlen(unit) > 0) {
-        strncpy(sensors[id].unit, unit, SENSOR_UNIT_MAX_LEN - 1);
-        sensors[id].unit[SENSOR_UNIT_MAX_LEN - 1] = '\0';
-    } else {
-        sensors[id].unit[0] = '\0';
+    if (sensors_mutex != NULL) {
+        tracked_mutex_give(sensors_mutex);
     }
+    return id;
+}
+
+static bool sensor_value_changed(const publish_policy_t *policy, float last, float value) {
+    float delta = fabsf(value - last);
+    if (policy->abs_deadband <= 0.0f && policy->rel_deadband <= 0.0f) {
+        return value != last;
+    }
+    if (policy->abs_deadband > 0.0f && delta >= policy->abs_deadband) {
+        return true;
+    }
+    if (policy->rel_deadband > 0.0f && delta >= fabsf(last) * policy->rel_deadband / 100.0f) {
+        return true;
+    }
+    return false;
+}
+
+// Apply the sensor's publish policy to an update and record it as published
+// if it passes. Only called from the dispatcher task.
+static bool sensor_should_publish(int sensor_id, const sensor_data_t *sensor) {
+    sensor_published_t *last = &sensor_published[sensor_id];
+    int64_t now_us = esp_timer_get_time();
+    publish_policy_t policy_copy;
+    const publish_policy_t *policy = settings_get_publish_policy(
+        g_settings, sensor->metric_name, sensor->device_id, &policy_copy) ? &policy_copy : NULL;
     
-    if (metric_name && strlen(metric_name) > 0) {
-        strncpy(sensors[id].metric_name, metric_name, SENSOR_DISPLAY_NAME_MAX_LEN - 1);
-        sensors[id].metric_name[SENSOR_DISPLAY_NAME_MAX_LEN - 1] = '\0';
-    } else {
-        sensors[id].metric_name[0] = '\0';
+    // Always publish the first value and availability changes
+    if (policy != NULL && last->valid && last->available == sensor->available) {
+        int64_t elapsed_s = (now_us - last->time_us) / 1000000;
+        bool heartbeat_due = policy->heartbeat_s > 0 && elapsed_s >= policy->heartbeat_s;
+        if (!heartbeat_due) {
+            if (policy->min_interval_s > 0 && elapsed_s < policy->min_interval_s) {
+                atomic_fetch_add(&publish_suppressed_interval, 1);
+                return false;
+            }
+            if (!sensor_value_changed(policy, last->value, sensor->value)) {
+                atomic_fetch_add(&publish_suppressed_deadband, 1);
+                return false;
+            }
+        }
     }
     
-    sensors[id].value = 0.0f;
-    sensors[id].last_updated = 0;
-    sensors[id].available = false;
-    sensors[id].link_url[0] = '\0';
-    sensors[id].link_text[0] = '\0';
+    last->value = sensor->value;
+    last->time_us = now_us;
+    last->available = sensor->available;
+    last->valid = true;
+    atomic_fetch_add(&publish_count, 1);
+    return true;
+}
+
+static bool sensor_event_push(int sensor_id) {
+    unsigned int pos = atomic_load_explicit(&event_enqueue_pos, memory_order_relaxed);
+    sensor_event_cell_t *cell;
+    for (;;) {
+        cell = &event_queue[pos & (SENSOR_EVENT_QUEUE_SIZE - 1)];
+        unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            // Cell is free for this position; claim it
+            if (atomic_compare_exchange_weak_explicit(&event_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;  // Full
+        } else {
+            pos = atomic_load_explicit(&event_enqueue_pos, memory_order_relaxed);
+        }
+    }
+    cell->sensor_id = (uint8_t)sensor_id;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+// Single consumer: only the dispatcher task pops
+static bool sensor_event_pop(int *sensor_id) {
+    unsigned int pos = atomic_load_explicit(&event_dequeue_pos, memory_order_relaxed);
+    sensor_event_cell_t *cell = &event_queue[pos & (SENSOR_EVENT_QUEUE_SIZE - 1)];
+    unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if ((int)(seq - (pos + 1)) < 0) {
+        return false;  // Empty, or a producer has claimed the cell but not filled it yet
+    }
+    *sensor_id = cell->sensor_id;
+    atomic_store_explicit(&event_dequeue_pos, pos + 1, memory_order_relaxed);
+    atomic_store_explicit(&cell->seq, pos + SENSOR_EVENT_QUEUE_SIZE, memory_order_release);
+    return true;
+}
+
+// Queue an update event for the dispatcher; never blocks
+static void sensor_event_notify(int sensor_id) {
+    if (atomic_exchange_explicit(&sensor_pending[sensor_id], true, memory_order_acq_rel)) {
+        // Already queued; the dispatcher will pick up the latest value
+        atomic_fetch_add_explicit(&events_coalesced, 1, memory_order_relaxed);
+        return;
+    }
+    if (!sensor_event_push(sensor_id)) {
+        atomic_store_explicit(&sensor_pending[sensor_id], false, memory_order_release);
+        atomic_fetch_add_explicit(&events_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&events_enqueued, 1, memory_order_relaxed);
+    if (dispatcher_task_handle != NULL) {
+        xTaskNotifyGive(dispatcher_task_handle);
+    }
+}
+
+static void sensor_dispatcher_task(void *pvParameters) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        int sensor_id;
+        while (sensor_event_pop(&sensor_id)) {
+            // Clear before reading so an update racing with the snapshot is re-queued
+            atomic_store_explicit(&sensor_pending[sensor_id], false, memory_order_seq_cst);
+            
+            sensor_data_t snapshot;
+            if (!sensors_read_snapshot(sensor_id, &snapshot)) {
+                continue;
+            }
+            atomic_fetch_add_explicit(&events_dispatched, 1, memory_order_relaxed);
+            
+            int count = atomic_load_explicit(&subscriber_count, memory_order_acquire);
+            for (int i = 0; i < count; i++) {
+                subscribers[i].callback(sensor_id, &snapshot, subscribers[i].user_data);
+            }
+        }
+    }
+}
+
+static void history_subscriber(int sensor_id, const sensor_data_t *sensor, void *user_data) {
+    if (sensor->available) {
+        sensor_history_record(sensor_id, (uint32_t)(esp_timer_get_time() / 1000000), sensor->value);
+    }
+}
+
+static void mqtt_subscriber(int sensor_id, const sensor_data_t *sensor, void *user_data) {
+    // While disconnected the publisher can keep readings for replay
+    if ((mqtt_is_enabled() || mqtt_offline_enabled()) && sensor_should_publish(sensor_id, sensor)) {
+        mqtt_publish_single_sensor(sensor_id);
+    }
+}
+
+esp_err_t sensors_subscribe(sensor_subscriber_cb_t callback, void *user_data) {
+    if (callback == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
     
-    ESP_LOGI(TAG, "Registered sensor %d: '%s' (%s) [metric: %s]", id, sensors[id].display_name, sensors[id].unit, sensors[id].metric_name);
+    if (sensors_mutex != NULL) {
+        tracked_mutex_take(sensors_mutex, portMAX_DELAY);
+    }
+    
+    int count = atomic_load_explicit(&subscriber_count, memory_order_relaxed);
+    if (count >= MAX_SENSOR_SUBSCRIBERS) {
+        if (sensors_mutex != NULL) {
+            tracked_mutex_give(sensors_mutex);
+        }
+        ESP_LOGE(TAG, "Cannot add sensor subscriber: maximum (%d) reached", MAX_SENSOR_SUBSCRIBERS);
+        return ESP_ERR_NO_MEM;
+    }
+    subscribers[count].callback = callback;
+    subscribers[count].user_data = user_data;
+    atomic_store_explicit(&subscriber_count, count + 1, memory_order_release);
     
     if (sensors_mutex != NULL) {
-        xSemaphoreGive(sensors_mutex);
+        tracked_mutex_give(sensors_mutex);
     }
-    return id;
+    return ESP_OK;
+}
+
+void sensors_get_event_stats(sensor_event_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->enqueued = atomic_load(&events_enqueued);
+    stats->coalesced = atomic_load(&events_coalesced);
+    stats->dropped = atomic_load(&events_dropped);
+    stats->dispatched = atomic_load(&events_dispatched);
+    stats->update_count = atomic_load(&update_count);
+    stats->update_max_us = atomic_load(&update_max_us);
+    stats->update_total_us = atomic_load(&update_total_us);
+    stats->stale = atomic_load(&stale_count);
+}
+
+uint32_t sensors_get_update_count(int sensor_id) {
+    if (sensor_id < 0 || sensor_id >= sensors_get_count()) {
+        return 0;
+    }
+    return atomic_load(&sensor_update_counts[sensor_id]);
+}
+
+uint32_t sensors_get_producer_update_count(sensor_producer_t producer) {
+    if (producer >= SENSOR_PRODUCER_COUNT) {
+        return 0;
+    }
+    return atomic_load(&producer_update_counts[producer]);
+}
+
+const char *sensor_producer_name(sensor_producer_t producer) {
+    return producer < SENSOR_PRODUCER_COUNT ? sensor_producer_names[producer] : "";
+}
+
+void sensors_get_stream_stats(sensor_stream_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->clients = stream_count;
+    stats->max_clients = SENSORS_MAX_STREAMS;
+    stats->accepted = atomic_load(&streams_accepted);
+    stats->rejected = atomic_load(&streams_rejected);
+    stats->events_sent = atomic_load(&stream_events_sent);
+}
+
+void sensors_get_publish_stats(uint32_t *published, uint32_t *suppressed_deadband, uint32_t *suppressed_interval) {
+    if (published != NULL) {
+        *published = atomic_load(&publish_count);
+    }
+    if (suppressed_deadband != NULL) {
+        *suppressed_deadband = atomic_load(&publish_suppressed_deadband);
+    }
+    if (suppressed_interval != NULL) {
+        *suppressed_interval = atomic_load(&publish_suppressed_interval);
+    }
+}
+
+static void deadline_heap_swap(int a, int b) {
+    sensor_deadline_t tmp = deadline_heap[a];
+    deadline_heap[a] = deadline_heap[b];
+    deadline_heap[b] = tmp;
+    deadline_heap_pos[deadline_heap[a].sensor_id] = a;
+    deadline_heap_pos[deadline_heap[b].sensor_id] = b;
+}
+
+static void deadline_heap_sift_up(int pos) {
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (deadline_heap[parent].deadline_us <= deadline_heap[pos].deadline_us) {
+            break;
+        }
+        deadline_heap_swap(pos, parent);
+        pos = parent;
+    }
+}
+
+static void deadline_heap_sift_down(int pos) {
+    while (1) {
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+        if (left < deadline_heap_size && deadline_heap[left].deadline_us < deadline_heap[smallest].deadline_us) {
+            smallest = left;
+        }
+        if (right < deadline_heap_size && deadline_heap[right].deadline_us < deadline_heap[smallest].deadline_us) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            break;
+        }
+        deadline_heap_swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+// Insert, re-key or remove (deadline_us < 0) a sensor's entry. Caller must
+// hold deadline_mutex.
+static void deadline_heap_set(int sensor_id, int64_t deadline_us) {
+    int pos = deadline_heap_pos[sensor_id];
+    if (deadline_us < 0) {
+        if (pos < 0) {
+            return;
+        }
+        deadline_heap_swap(pos, --deadline_heap_size);
+        deadline_heap_pos[sensor_id] = -1;
+        if (pos < deadline_heap_size) {
+            deadline_heap_sift_up(pos);
+            deadline_heap_sift_down(pos);
+        }
+        return;
+    }
+    if (pos < 0) {
+        pos = deadline_heap_size++;
+        deadline_heap[pos].sensor_id = (uint8_t)sensor_id;
+        deadline_heap_pos[sensor_id] = pos;
+    }
+    deadline_heap[pos].deadline_us = deadline_us;
+    deadline_heap_sift_up(pos);
+    deadline_heap_sift_down(pos);
+}
+
+// Start tracking a sensor's deadline if it isn't already. Called after
+// updates. The check is made under deadline_mutex: the cleanup task reads the
+// sensor and drops its entry under the same lock, so either it sees this
+// update and keeps the entry, or this sees the entry gone and re-arms it.
+static void sensor_deadline_arm(int sensor_id, int64_t updated_us) {
+    if (deadline_mutex == NULL) {
+        return;
+    }
+    tracked_mutex_take(deadline_mutex, portMAX_DELAY);
+    bool armed = false;
+    if (deadline_heap_pos[sensor_id] < 0 && sensor_timeout_s[sensor_id] > 0) {
+        deadline_heap_set(sensor_id, updated_us + (int64_t)sensor_timeout_s[sensor_id] * 1000000);
+        armed = true;
+    }
+    tracked_mutex_give(deadline_mutex);
+    
+    // The new deadline may be earlier than the one the task is sleeping toward
+    if (armed && cleanup_task_handle != NULL) {
+        xTaskNotifyGive(cleanup_task_handle);
+    }
+}
+
+void sensors_set_timeout(int sensor_id, uint32_t timeout_seconds) {
+    if (sensor_id < 0 || sensor_id >= sensors_get_count() || deadline_mutex == NULL) {
+        return;
+    }
+    
+    sensor_data_t sensor;
+    bool have_snapshot = sensors_read_snapshot(sensor_id, &sensor);
+    
+    tracked_mutex_take(deadline_mutex, portMAX_DELAY);
+    sensor_timeout_s[sensor_id] = timeout_seconds;
+    if (timeout_seconds == 0) {
+        deadline_heap_set(sensor_id, -1);
+    } else if (have_snapshot && sensor.available && sensor.updated_us > 0) {
+        // A shorter timeout can move the deadline earlier, so re-key it
+        deadline_heap_set(sensor_id, sensor.updated_us + (int64_t)timeout_seconds * 1000000);
+    }
+    tracked_mutex_give(deadline_mutex);
+    
+    if (cleanup_task_handle != NULL) {
+        xTaskNotifyGive(cleanup_task_handle);
+    }
+}
+
+void sensors_set_producer(int sensor_id, sensor_producer_t producer) {
+    if (sensor_id < 0 || sensor_id >= sensors_get_count() || producer >= SENSOR_PRODUCER_COUNT) {
+        return;
+    }
+    sensor_producer[sensor_id] = (uint8_t)producer;
 }
 
 bool sensors_update(int sensor_id, float value, bool available) {
@@ -346,144 +1412,344 @@ bool sensors_update(int sensor_id, float value, bool available) {
 }
 
 bool sensors_update_with_link(int sensor_id, float value, bool available, const char *link_url, const char *link_text) {
+    int64_t start_us = esp_timer_get_time();
+    int count = sensors_get_count();
+    if (sensor_id < 0 || sensor_id >= count) {
+        ESP_LOGE(TAG, "Invalid sensor_id %d (valid range: 0-%d)", sensor_id, count - 1);
+        return false;
+    }
+    
+    bool has_link = (link_url != NULL && link_text != NULL);
+    
     if (sensors_mutex != NULL) {
-        xSemaphoreTake(sensors_mutex, portMAX_DELAY);
+        tracked_mutex_take(sensors_mutex, portMAX_DELAY);
     }
     
-    if (sensor_id < 0 || sensor_id >= sensor_count) {
-        ESP_LOGE(TAG, "Invalid sensor_id %d (valid range: 0-%d)", sensor_id, sensor_count - 1);
-        if (sensors_mutex != NULL) {
-            xSemaphoreGive(sensors_mutex);
+    sensor_state_t *state = &sensor_state[sensor_id];
+    
+    // Link text comes from a small fixed set; only intern when it changes
+    string_handle_t link_text_handle = STRING_HANDLE_EMPTY;
+    if (has_link) {
+        link_text_handle = state->link_text;
+        if (strcmp(string_pool_get(link_text_handle), link_text) != 0) {
+            link_text_handle = string_pool_intern(link_text, SENSOR_LINK_TEXT_MAX_LEN);
+        }
+        if (state->link_slot == SENSOR_NO_LINK) {
+            if (sensor_link_count < MAX_SENSOR_LINKS) {
+                state->link_slot = (uint8_t)sensor_link_count++;
+            } else {
+                ESP_LOGW(TAG, "No link slots left for sensor %d", sensor_id);
+                has_link = false;
+            }
         }
-        return false;
     }
     
-    sensors[sensor_id].value = value;
-    sensors[sensor_id].available = available;
-    sensors[sensor_id].last_updated = time(NULL);
+    sensor_write_begin(sensor_id);
     
-    // Update link fields if provided
-    if (link_url != NULL && link_text != NULL) {
-        strncpy(sensors[sensor_id].link_url, link_url, sizeof(sensors[sensor_id].link_url) - 1);
-        sensors[sensor_id].link_url[sizeof(sensors[sensor_id].link_url) - 1] = '\0';
-        
-        strncpy(sensors[sensor_id].link_text, link_text, sizeof(sensors[sensor_id].link_text) - 1);
-        sensors[sensor_id].link_text[sizeof(sensors[sensor_id].link_text) - 1] = '\0';
+    state->value = value;
+    state->available = available;
+    state->updated_us = esp_timer_get_time();
+    
+    // Update link fields if provided, otherwise clear them
+    if (has_link) {
+        char *url = sensor_links[state->link_slot];
+        strncpy(url, link_url, SENSOR_LINK_URL_MAX_LEN - 1);
+        url[SENSOR_LINK_URL_MAX_LEN - 1] = '\0';
+        state->link_text = link_text_handle;
     } else {
-        // Clear link fields if not provided
-        sensors[sensor_id].link_url[0] = '\0';
-        sensors[sensor_id].link_text[0] = '\0';
+        state->link_text = STRING_HANDLE_EMPTY;
     }
     
+    int64_t updated_us = state->updated_us;
+    sensor_write_end(sensor_id);
+    atomic_fetch_add(&sensors_generation, 1);
+    
     if (sensors_mutex != NULL) {
-        xSemaphoreGive(sensors_mutex);
+        tracked_mutex_give(sensors_mutex);
     }
     
-    // Publish to MQTT if enabled (don't hold mutex during MQTT publish)
-    if (mqtt_is_enabled()) {
-        mqtt_publish_single_sensor(sensor_id);
+    if (available) {
+        sensor_deadline_arm(sensor_id, updated_us);
+    }
+    
+    // History and MQTT run on the dispatcher task so producers never wait on them
+    sensor_event_notify(sensor_id);
+    
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    atomic_fetch_add_explicit(&update_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sensor_update_counts[sensor_id], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&producer_update_counts[sensor_producer[sensor_id]], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&update_total_us, elapsed_us, memory_order_relaxed);
+    unsigned int max_us = atomic_load_explicit(&update_max_us, memory_order_relaxed);
+    while (elapsed_us > max_us &&
+           !atomic_compare_exchange_weak_explicit(&update_max_us, &max_us, elapsed_us,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
     }
     
     return true;
 }
 
-float sensors_get_value(int sensor_id, bool *available) {
-    if (sensors_mutex != NULL) {
-        xSemaphoreTake(sensors_mutex, portMAX_DELAY);
+// Offset from esp_timer time to Unix time in microseconds, or 0 until SNTP
+// has set the clock. Recomputed on each call so it follows clock corrections.
+static int64_t sensors_wall_offset_us(void) {
+    if (!g_ntp_initialized) {
+        return 0;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - esp_timer_get_time();
+}
+
+bool sensors_read_snapshot(int sensor_id, sensor_data_t *out) {
+    if (out == NULL || sensor_id < 0 || sensor_id >= sensors_get_count()) {
+        return false;
     }
     
-    if (sensor_id < 0 || sensor_id >= sensor_count) {
-        ESP_LOGE(TAG, "Invalid sensor_id %d (valid range: 0-%d)", sensor_id, sensor_count - 1);
+    for (int attempt = 1; ; attempt++) {
+        unsigned int start = atomic_load_explicit(&sensor_seq[sensor_id], memory_order_acquire);
+        if ((start & 1) == 0) {
+            sensor_state_t state = sensor_state[sensor_id];
+            sensor_meta_t meta = sensor_meta[sensor_id];
+            if (state.link_text != STRING_HANDLE_EMPTY && state.link_slot != SENSOR_NO_LINK) {
+                memcpy(out->link_url, sensor_links[state.link_slot], sizeof(out->link_url));
+            } else {
+                out->link_url[0] = '\0';
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&sensor_seq[sensor_id], memory_order_relaxed) == start) {
+                out->display_name = string_pool_get(meta.display_name);
+                out->unit = string_pool_get(meta.unit);
+                out->metric_name = string_pool_get(meta.metric_name);
+                out->device_name = string_pool_get(meta.device_name);
+                out->device_id = string_pool_get(meta.device_id);
+                out->value = state.value;
+                out->updated_us = state.updated_us;
+                int64_t wall_offset_us = sensors_wall_offset_us();
+                if (state.updated_us > 0 && wall_offset_us != 0) {
+                    out->last_updated_ms = (state.updated_us + wall_offset_us) / 1000;
+                } else {
+                    out->last_updated_ms = 0;
+                }
+                out->last_updated = (time_t)(out->last_updated_ms / 1000);
+                out->available = state.available;
+                out->link_text = string_pool_get(state.link_text);
+                return true;
+            }
+        }
+        
+        // A writer is mid-update; if it was preempted by this task, spinning
+        // won't let it finish, so give up the CPU for a tick
+        if (attempt % SENSOR_SNAPSHOT_SPIN_LIMIT == 0) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+float sensors_get_value(int sensor_id, bool *available) {
+    sensor_data_t sensor;
+    if (!sensors_read_snapshot(sensor_id, &sensor)) {
+        ESP_LOGE(TAG, "Invalid sensor_id %d (valid range: 0-%d)", sensor_id, sensors_get_count() - 1);
         if (available) {
             *available = false;
         }
-        if (sensors_mutex != NULL) {
-            xSemaphoreGive(sensors_mutex);
-        }
         return 0.0f;
     }
     
     if (available) {
-        *available = sensors[sensor_id].available;
-    }
-    
-    float value = sensors[sensor_id].value;
-    
-    if (sensors_mutex != NULL) {
-        xSemaphoreGive(sensors_mutex);
+        *available = sensor.available;
     }
-    return value;
+    return sensor.value;
+}
+
+uint32_t sensors_get_meta_generation(void) {
+    return atomic_load(&sensors_meta_generation);
 }
 
 int sensors_get_count(void) {
-    return sensor_count;
+    return atomic_load_explicit(&sensor_count, memory_order_acquire);
 }
 
-const sensor_data_t* sensors_get_by_index(int index) {
-    if (index < 0 || index >= sensor_count) {
-        return NULL;
+
+// Mark a sensor unavailable if it hasn't been updated since the snapshot the
+// cleanup task judged stale. Returns false if a producer got there first.
+static bool sensor_mark_stale(int sensor_id, int64_t seen_updated_us) {
+    bool marked = false;
+    if (sensors_mutex != NULL) {
+        tracked_mutex_take(sensors_mutex, portMAX_DELAY);
+    }
+    if (sensor_state[sensor_id].available && sensor_state[sensor_id].updated_us == seen_updated_us) {
+        sensor_write_begin(sensor_id);
+        sensor_state[sensor_id].available = false;
+        sensor_write_end(sensor_id);
+        atomic_fetch_add(&sensors_generation, 1);
+        marked = true;
     }
-    return &sensors[index];
+    if (sensors_mutex != NULL) {
+        tracked_mutex_give(sensors_mutex);
+    }
+    return marked;
 }
 
-
-// Cleanup task to mark stale sensors as unavailable
+// Marks sensors unavailable when they miss their deadline. Sleeps until the
+// earliest deadline, or until a new or earlier one is armed.
 static void sensor_cleanup_task(void *pvParameters) {
     while (1) {
-        vTaskDelay(pdMS_TO_TICKS(60000));  // Check every minute
+        TickType_t wait_ticks = portMAX_DELAY;
+        int64_t now_us = esp_timer_get_time();
         
-        if (sensors_mutex != NULL) {
-            xSemaphoreTake(sensors_mutex, portMAX_DELAY);
+        tracked_mutex_take(deadline_mutex, portMAX_DELAY);
+        if (deadline_heap_size > 0) {
+            int64_t remaining_us = deadline_heap[0].deadline_us - now_us;
+            wait_ticks = remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 0;
         }
+        tracked_mutex_give(deadline_mutex);
         
-        time_t now = time(NULL);
-        for (int i = 0; i < sensor_count; i++) {
-            if (sensors[i].available && sensors[i].last_updated > 0) {
-                time_t age = now - sensors[i].last_updated;
-                if (age > SENSOR_STALE_TIMEOUT_SECONDS) {
-                    ESP_LOGW(TAG, "Sensor %d (%s) is stale (%ld seconds old), marking unavailable",
-                             i, sensors[i].display_name, (long)age);
-                    sensors[i].available = false;
-                }
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+        
+        // Pop due entries under the lock; mark them stale outside it
+        uint8_t expired[MAX_SENSORS];
+        int64_t expired_updated_us[MAX_SENSORS];
+        int expired_count = 0;
+        now_us = esp_timer_get_time();
+        
+        tracked_mutex_take(deadline_mutex, portMAX_DELAY);
+        while (deadline_heap_size > 0 && deadline_heap[0].deadline_us <= now_us) {
+            int id = deadline_heap[0].sensor_id;
+            sensor_data_t sensor;
+            if (!sensors_read_snapshot(id, &sensor) || !sensor.available || sensor.updated_us <= 0) {
+                // Already unavailable; re-armed by the next available update
+                deadline_heap_set(id, -1);
+                continue;
             }
+            int64_t deadline_us = sensor.updated_us + (int64_t)sensor_timeout_s[id] * 1000000;
+            if (deadline_us > now_us) {
+                deadline_heap_set(id, deadline_us);
+                continue;
+            }
+            deadline_heap_set(id, -1);
+            expired[expired_count] = (uint8_t)id;
+            expired_updated_us[expired_count] = sensor.updated_us;
+            expired_count++;
         }
+        tracked_mutex_give(deadline_mutex);
         
-        if (sensors_mutex != NULL) {
-            xSemaphoreGive(sensors_mutex);
+        for (int i = 0; i < expired_count; i++) {
+            int id = expired[i];
+            if (!sensor_mark_stale(id, expired_updated_us[i])) {
+                // Refreshed after it was popped; arming is idempotent, so make sure
+                sensor_data_t sensor;
+                if (sensors_read_snapshot(id, &sensor) && sensor.available) {
+                    sensor_deadline_arm(id, sensor.updated_us);
+                }
+                continue;
+            }
+            atomic_fetch_add(&stale_count, 1);
+            ESP_LOGW(TAG, "Sensor %d (%s) is stale (no update for %" PRIu32 " seconds), marking unavailable",
+                     id, string_pool_get(sensor_meta[id].display_name), sensor_timeout_s[id]);
+            // Exporters and streams see the transition like any other update
+            sensor_event_notify(id);
         }
     }
 }
 
 void sensors_init(settings_t *settings, httpd_handle_t server)
 {
-    // Initialize sensor array
-    memset(sensors, 0, sizeof(sensors));
-    sensor_count = 0;
+    // Initialize sensor arrays
+    memset(sensor_state, 0, sizeof(sensor_state));
+    memset(sensor_meta, 0, sizeof(sensor_meta));
+    sensor_link_count = 0;
+    if (string_pool_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize string pool");
+    }
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        atomic_init(&sensor_seq[i], 0);
+    }
+    memset(sensor_keys, 0, sizeof(sensor_keys));
+    memset(sensor_published, 0, sizeof(sensor_published));
+    g_settings = settings;
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        deadline_heap_pos[i] = -1;
+    }
+    deadline_heap_size = 0;
+    deadline_mutex = tracked_mutex_create("sensor_deadlines");
+    if (deadline_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create sensor deadline mutex");
+    }
+    for (int i = 0; i < SENSOR_INDEX_SIZE; i++) {
+        atomic_init(&sensor_index[i], 0);
+    }
+    atomic_store(&sensor_count, 0);
     
     // Create mutex for thread safety
-    sensors_mutex = xSemaphoreCreateMutex();
+    sensors_mutex = tracked_mutex_create("sensors");
     if (sensors_mutex == NULL) {
         ESP_LOGE(TAG, "Failed to create sensors mutex");
     }
     
+    if (sensor_history_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize sensor history");
+    }
+    
+    // Set up the update event queue and built-in subscribers
+    for (int i = 0; i < SENSOR_EVENT_QUEUE_SIZE; i++) {
+        atomic_init(&event_queue[i].seq, i);
+    }
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        atomic_init(&sensor_pending[i], false);
+    }
+    sensors_subscribe(history_subscriber, NULL);
+    sensors_subscribe(mqtt_subscriber, NULL);
+    sensors_subscribe(long_poll_subscriber, NULL);
+    sensors_subscribe(stream_subscriber, NULL);
+    if (xTaskCreate(sensor_dispatcher_task, "sensor_events", 4096, NULL, 5, &dispatcher_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create sensor event dispatcher task");
+    }
+    
+    // Start long-poll task for /sensors/data?wait=
+    long_poll_mutex = tracked_mutex_create("sensor_long_poll");
+    if (long_poll_mutex == NULL ||
+        xTaskCreate(sensors_long_poll_task, "sensors_poll", 4096, NULL, 5, &long_poll_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start sensor long-poll task");
+    }
+    
+    // Start Server-Sent Events task for /sensors/stream
+    stream_mutex = tracked_mutex_create("sensor_stream");
+    if (stream_mutex == NULL ||
+        xTaskCreate(sensors_stream_task, "sensors_stream", 4096, NULL, 5, &stream_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start sensor stream task");
+    }
+    
     // Start cleanup task
-    xTaskCreate(sensor_cleanup_task, "sensor_cleanup", 2048, NULL, 5, NULL);
+    if (deadline_mutex == NULL ||
+        xTaskCreate(sensor_cleanup_task, "sensor_cleanup", 3072, NULL, 5, &cleanup_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start sensor cleanup task");
+    }
     
     // Set user_ctx to settings so handlers can access hostname
     sensors_display_uri.user_ctx = settings;
     
     // Register HTTP handlers
-    esp_err_t err = httpd_register_uri_handler(server, &sensors_display_uri);
+    esp_err_t err = http_server_register_uri_handler(server, &sensors_display_uri);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) registering sensor display handler!", esp_err_to_name(err));
     }
     
-    err = httpd_register_uri_handler(server, &sensors_data_uri);
+    err = http_server_register_uri_handler(server, &sensors_data_uri);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) registering sensor data handler!", esp_err_to_name(err));
     }
     
-    err = httpd_register_uri_handler(server, &version_uri);
+    err = http_server_register_uri_handler(server, &sensors_history_uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) registering sensor history handler!", esp_err_to_name(err));
+    }
+    
+    err = http_server_register_uri_handler(server, &sensors_stream_uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) registering sensor stream handler!", esp_err_to_name(err));
+    }
+    
+    err = http_server_register_uri_handler(server, &version_uri);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) registering version handler!", esp_err_to_name(err));
     }
@@ -4,31 +4,72 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <esp_err.h>
+#include "sdkconfig.h"
 #include "settings.h"
 #include <esp_http_server.h>
 
 // Maximum number of sensors that can be registered
-#define MAX_SENSORS 60
+#define MAX_SENSORS CONFIG_SENSORS_MAX
 
 // Maximum length for sensor name and unit strings
 #define SENSOR_DISPLAY_NAME_MAX_LEN 40
 #define SENSOR_DEVICE_NAME_MAX_LEN 32
 #define SENSOR_DEVICE_ID_MAX_LEN 20
 #define SENSOR_UNIT_MAX_LEN 16
+#define SENSOR_LINK_URL_MAX_LEN 64
+#define SENSOR_LINK_TEXT_MAX_LEN 32
 
+// Time without an update after which a sensor is marked unavailable, unless
+// its producer sets its own with sensors_set_timeout
+#define SENSOR_DEFAULT_TIMEOUT_SECONDS 600
+
+// Snapshot of a sensor. The name, unit, label and link text strings are
+// interned and stay valid forever; they are never NULL ("" when unset).
+// Updates are stamped with the monotonic esp_timer clock; wall-clock times
+// are derived when the snapshot is taken, so readings from before SNTP sync
+// get correct timestamps once the clock is set.
 typedef struct {
-    char display_name[SENSOR_DISPLAY_NAME_MAX_LEN];
-    char unit[SENSOR_UNIT_MAX_LEN];
-    char metric_name[SENSOR_DISPLAY_NAME_MAX_LEN];  // Prometheus metric name
-    char device_name[SENSOR_DEVICE_NAME_MAX_LEN]; // Device label for Prometheus
-    char device_id[SENSOR_DEVICE_ID_MAX_LEN];    // Device ID for Prometheus
+    const char *display_name;
+    const char *unit;
+    const char *metric_name;    // Prometheus metric name
+    const char *device_name;    // Device label for Prometheus
+    const char *device_id;      // Device ID for Prometheus
     float value;
-    time_t last_updated;
+    int64_t updated_us;         // esp_timer time of the last update (0 = never updated)
+    int64_t last_updated_ms;    // Unix time of the last update in ms (0 = never, or clock not yet set)
+    time_t last_updated;        // last_updated_ms in seconds
     bool available;
-    char link_url[64];      // Optional action link URL
-    char link_text[32];     // Optional action link text
+    const char *link_text;                  // Optional action link text
+    char link_url[SENSOR_LINK_URL_MAX_LEN]; // Optional action link URL
 } sensor_data_t;
 
+// Subsystems that update sensors, for per-producer throughput counters
+typedef enum {
+    SENSOR_PRODUCER_OTHER,
+    SENSOR_PRODUCER_WEIGHT,
+    SENSOR_PRODUCER_DS18B20,
+    SENSOR_PRODUCER_BTHOME,
+    SENSOR_PRODUCER_PUMP,
+    SENSOR_PRODUCER_COUNT
+} sensor_producer_t;
+
+// Identifies a sensor by the device that produces it and the measurement it
+// reports, e.g. a BLE MAC and BTHome object ID or a 1-Wire address and unit
+typedef struct {
+    uint64_t device;    // MAC, 1-Wire address, or other producer-chosen ID
+    uint16_t metric;    // Producer-defined measurement ID
+} sensor_key_t;
+
+/**
+ * @brief Build a sensor key from a 6-byte MAC address
+ * 
+ * @param mac MAC address
+ * @param metric Producer-defined measurement ID
+ * @return sensor_key_t Key for use with sensors_find and sensors_register_with_key
+ */
+sensor_key_t sensor_key_from_mac(const uint8_t mac[6], uint16_t metric);
+
 /**
  * @brief Initialize the sensors subsystem and register HTTP handlers
  * 
@@ -54,6 +95,60 @@ int sensors_register(
     const char *device_name, 
     const char *device_id);
 
+/**
+ * @brief Register a sensor identified by key, or reuse its existing slot
+ * 
+ * If a sensor with the same key is already registered its names and unit are
+ * replaced and its ID is returned; the current value is kept. Otherwise a new
+ * sensor is registered as with sensors_register.
+ * 
+ * @param key Device and measurement identifying the sensor
+ * @param display_name Display name of the sensor (will be truncated if too long)
+ * @param unit Unit string for the sensor value
+ * @param metric_name Metric name for the sensor
+ * @param device_name Optional device name label for Prometheus (can be NULL)
+ * @param device_id Optional device ID label for Prometheus (can be NULL)
+ * @return int Sensor ID (index) if successful, -1 if registration failed
+ */
+int sensors_register_with_key(
+    sensor_key_t key,
+    const char *display_name,
+    const char *unit,
+    const char *metric_name,
+    const char *device_name,
+    const char *device_id);
+
+/**
+ * @brief Look up a sensor registered with sensors_register_with_key
+ * 
+ * Lock-free and O(1) on average, so producers can call it on every sample.
+ * 
+ * @param key Device and measurement identifying the sensor
+ * @return int Sensor ID if found, -1 otherwise
+ */
+int sensors_find(sensor_key_t key);
+
+/**
+ * @brief Set how long a sensor may go without updates before it is stale
+ * 
+ * Producers should set this to a few of their update intervals. Stale sensors
+ * are marked unavailable, which is published like any other update.
+ * 
+ * @param sensor_id Sensor ID returned from sensors_register
+ * @param timeout_seconds Timeout in seconds, or 0 to never mark the sensor stale
+ */
+void sensors_set_timeout(int sensor_id, uint32_t timeout_seconds);
+
+/**
+ * @brief Set which producer updates a sensor
+ * 
+ * Sensors count towards SENSOR_PRODUCER_OTHER until this is called.
+ * 
+ * @param sensor_id Sensor ID returned from sensors_register
+ * @param producer Producer updating the sensor
+ */
+void sensors_set_producer(int sensor_id, sensor_producer_t producer);
+
 /**
  * @brief Update a sensor's value
  * 
@@ -94,11 +189,117 @@ float sensors_get_value(int sensor_id, bool *available);
 int sensors_get_count(void);
 
 /**
- * @brief Get sensor data by index
+ * @brief Get a counter that changes whenever a sensor is registered or renamed
+ * 
+ * Lets consumers cache anything derived from sensor names, units and labels.
+ * 
+ * @return uint32_t Metadata generation
+ */
+uint32_t sensors_get_meta_generation(void);
+
+/**
+ * @brief Take a consistent copy of a sensor's data without blocking writers
+ * 
+ * Readers never take the sensors mutex; the copy is retried until it was not
+ * overlapped by an update, so the snapshot never mixes old and new fields.
+ * 
+ * @param sensor_id Sensor ID (0 to sensor_count-1)
+ * @param out Destination for the snapshot
+ * @return true if the snapshot was taken, false if sensor_id is invalid
+ */
+bool sensors_read_snapshot(int sensor_id, sensor_data_t *out);
+
+/**
+ * @brief Callback invoked on the dispatcher task after a sensor is updated
+ * 
+ * Updates that arrive while an event for the same sensor is still queued are
+ * coalesced, so subscribers see the latest value but not every intermediate one.
+ * 
+ * @param sensor_id Sensor ID that was updated
+ * @param sensor Snapshot of the sensor taken when the event was dispatched
+ * @param user_data User data passed to sensors_subscribe
+ */
+typedef void (*sensor_subscriber_cb_t)(int sensor_id, const sensor_data_t *sensor, void *user_data);
+
+/**
+ * @brief Subscribe to sensor update events
+ * 
+ * Subscribers run sequentially on a single dispatcher task and should not
+ * block for long. History and MQTT are subscribed by sensors_init.
+ * 
+ * @param callback Callback invoked for each dispatched update
+ * @param user_data User data passed to the callback
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if all subscriber slots are used
+ */
+esp_err_t sensors_subscribe(sensor_subscriber_cb_t callback, void *user_data);
+
+typedef struct {
+    uint32_t enqueued;          // Events queued for the dispatcher
+    uint32_t coalesced;         // Updates merged into an already queued event
+    uint32_t dropped;           // Events lost because the queue was full
+    uint32_t dispatched;        // Events delivered to subscribers
+    uint32_t update_count;      // Calls to sensors_update/sensors_update_with_link
+    uint32_t update_max_us;     // Longest time a producer spent in an update
+    uint64_t update_total_us;   // Total time producers spent in updates
+    uint32_t stale;             // Sensors marked unavailable for missing their deadline
+} sensor_event_stats_t;
+
+/**
+ * @brief Get update event queue and producer latency counters
+ * 
+ * @param stats Destination for the counters
+ */
+void sensors_get_event_stats(sensor_event_stats_t *stats);
+
+typedef struct {
+    int clients;                // Connected /sensors/stream clients
+    int max_clients;            // Maximum concurrent streams
+    uint32_t accepted;          // Streams opened
+    uint32_t rejected;          // Streams refused because the limit was reached
+    uint32_t events_sent;       // Sensor events written to streams
+} sensor_stream_stats_t;
+
+/**
+ * @brief Get the number of updates a sensor has received
+ * 
+ * @param sensor_id Sensor ID returned from sensors_register
+ * @return uint32_t Calls to sensors_update/sensors_update_with_link for the sensor
+ */
+uint32_t sensors_get_update_count(int sensor_id);
+
+/**
+ * @brief Get the number of sensor updates made by a producer
+ * 
+ * @param producer Producer
+ * @return uint32_t Calls to sensors_update/sensors_update_with_link for its sensors
+ */
+uint32_t sensors_get_producer_update_count(sensor_producer_t producer);
+
+/**
+ * @brief Get the name of a producer, as exported on /metrics
+ * 
+ * @param producer Producer
+ * @return const char* Name
+ */
+const char *sensor_producer_name(sensor_producer_t producer);
+
+/**
+ * @brief Get /sensors/stream (Server-Sent Events) client counters
+ * 
+ * @param stats Destination for the counters
+ */
+void sensors_get_stream_stats(sensor_stream_stats_t *stats);
+
+/**
+ * @brief Get counters for the per-sensor publish policies
+ * 
+ * Updates are only pushed to sinks (MQTT) when they pass the publish policy
+ * configured for the sensor in settings; suppressed updates are counted here.
  * 
- * @param index Sensor index (0 to sensor_count-1)
- * @return const sensor_data_t* Pointer to sensor data, or NULL if index is invalid
+ * @param published Number of updates passed to sinks (can be NULL)
+ * @param suppressed_deadband Updates dropped because the value did not change enough (can be NULL)
+ * @param suppressed_interval Updates dropped by the minimum publish interval (can be NULL)
  */
-const sensor_data_t* sensors_get_by_index(int index);
+void sensors_get_publish_stats(uint32_t *published, uint32_t *suppressed_deadband, uint32_t *suppressed_interval);
 
 #endif // SENSORS_H
@@ -18,16 +18,24 @@
 #include "bthome.h"
 #include "temperature.h"
 #include "pump.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
 #include "mqtt_publisher.h"
+#include "mqtt_payload.h"
 #include "ota.h"  // For OTA status
 
 static const char *TAG = "settings";
 
+// Maximum number of sensor publish policies
+#define MAX_PUBLISH_POLICIES 16
+
+// Guards publish_policies and publish_policies_count against the settings POST
+// handler swapping them while the sensor event dispatcher looks up a policy
+static portMUX_TYPE publish_policies_lock = portMUX_INITIALIZER_UNLOCKED;
+
 // URL encode function - encodes special characters for HTML attribute values
 // Returns allocated string that must be freed by caller
 static char *url_encode(const char *src) {
-    if (!src) return strdup("");
+    if (!src) return tracked_strdup(ALLOC_SETTINGS, "");
     
     // Calculate required buffer size
     size_t len = 0;
@@ -42,8 +50,7 @@ static char *url_encode(const char *src) {
         }
     }
     
-    char *encoded = malloc(len + 1);
-    atomic_fetch_add(&malloc_count_settings, 1);
+    char *encoded = tracked_malloc(ALLOC_SETTINGS, len + 1);
     if (!encoded) return NULL;
     
     char *dst = encoded;
@@ -107,8 +114,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Connection", "keep-alive");
     
     // Allocate buffers on heap to avoid stack overflow
-    char *buffer = malloc(1024);
-    atomic_fetch_add(&malloc_count_settings, 1);
+    char *buffer = tracked_malloc(ALLOC_SETTINGS, 1024);
     if (!buffer) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_ERR_NO_MEM;
@@ -180,8 +186,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='hostname' name='hostname' value='%s'>\n",
         encoded_hostname ? encoded_hostname : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_hostname);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_hostname);
 
     // Send update_url with current value
     char *encoded_update_url = url_encode(settings->update_url);
@@ -191,8 +196,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='update_url' name='update_url' value='%s'>\n",
         encoded_update_url ? encoded_update_url : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_update_url);    
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_update_url);
 
     // Send timezone with current value
     char *encoded_timezone = url_encode(settings->timezone);
@@ -201,8 +205,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='timezone' name='timezone' value='%s' placeholder='UTC0'>\n",
         encoded_timezone ? encoded_timezone : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_timezone);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_timezone);
 
     // Send temperature unit checkbox
     snprintf(buffer, 1024,
@@ -222,8 +225,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='wifi_ssid' name='wifi_ssid' value='%s'>\n",
         encoded_wifi_ssid ? encoded_wifi_ssid : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_wifi_ssid);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_wifi_ssid);
     
     // Send wifi_password and checkbox
     snprintf(buffer, 1024,
@@ -247,8 +249,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='syslog_server' name='syslog_server' value='%s' placeholder='syslog.example.com'>\n",
         encoded_syslog_server ? encoded_syslog_server : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_syslog_server);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_syslog_server);
     
     // Send syslog_port with current value
     snprintf(buffer, 1024,
@@ -279,8 +280,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='mqtt_broker_url' name='mqtt_broker_url' value='%s' placeholder='mqtt://broker.example.com'>\n",
         encoded_mqtt_broker ? encoded_mqtt_broker : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_mqtt_broker);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_mqtt_broker);
     
     // Send mqtt_username with current value
     char *encoded_mqtt_username = url_encode(settings->mqtt_username);
@@ -289,8 +289,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='mqtt_username' name='mqtt_username' value='%s'>\n",
         encoded_mqtt_username ? encoded_mqtt_username : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_mqtt_username);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_mqtt_username);
     
     // Send mqtt_password with current value
     char *encoded_mqtt_password = url_encode(settings->mqtt_password);
@@ -299,8 +298,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='password' id='mqtt_password' name='mqtt_password' value='%s'>\n",
         encoded_mqtt_password ? encoded_mqtt_password : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_mqtt_password);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_mqtt_password);
     
     // Send mqtt_topic with current value
     char *encoded_mqtt_topic = url_encode(settings->mqtt_topic);
@@ -309,8 +307,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='mqtt_topic' name='mqtt_topic' value='%s' placeholder='station/sensor'>\n",
         encoded_mqtt_topic ? encoded_mqtt_topic : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_mqtt_topic);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_mqtt_topic);
 
     // Send mqtt_status_topic with current value
     char *encoded_mqtt_status_topic = url_encode(settings->mqtt_status_topic);
@@ -319,8 +316,100 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "<input type='text' id='mqtt_status_topic' name='mqtt_status_topic' value='%s' placeholder='station/status'>\n",
         encoded_mqtt_status_topic ? encoded_mqtt_status_topic : "");
     httpd_resp_sendstr_chunk(req, buffer);
-    free(encoded_mqtt_status_topic);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, encoded_mqtt_status_topic);
+
+    // Send mqtt_batch_window_ms with current value
+    snprintf(buffer, 1024,
+        "<label for='mqtt_batch_window_ms'>MQTT Batch Window (ms, 0 = off):</label>\n"
+        "<input type='number' id='mqtt_batch_window_ms' name='mqtt_batch_window_ms' value='%u' min='0' max='60000'>\n",
+        settings->mqtt_batch_window_ms);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_batch_max with current value
+    snprintf(buffer, 1024,
+        "<label for='mqtt_batch_max'>MQTT Batch Size (sensors):</label>\n"
+        "<input type='number' id='mqtt_batch_max' name='mqtt_batch_max' value='%u' min='2' max='%d'>\n",
+        settings->mqtt_batch_max, MQTT_BATCH_MAX_SENSORS);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_offline_max with current value
+    snprintf(buffer, 1024,
+        "<label for='mqtt_offline_max'>MQTT Offline Buffer (readings, 0 = off):</label>\n"
+        "<input type='number' id='mqtt_offline_max' name='mqtt_offline_max' value='%u' min='0' max='%d'>\n",
+        settings->mqtt_offline_max, MQTT_OFFLINE_MAX_READINGS);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_replay_rate with current value
+    snprintf(buffer, 1024,
+        "<label for='mqtt_replay_rate'>MQTT Replay Rate (readings/s):</label>\n"
+        "<input type='number' id='mqtt_replay_rate' name='mqtt_replay_rate' value='%u' min='1' max='1000'>\n",
+        settings->mqtt_replay_rate);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_format with current value selected
+    snprintf(buffer, 1024,
+        "<label for='mqtt_format'>MQTT Payload Format:</label>\n"
+        "<select id='mqtt_format' name='mqtt_format'>\n"
+        "<option value='%d'%s>JSON</option>\n"
+        "<option value='%d'%s>CBOR</option>\n"
+        "</select>\n",
+        MQTT_FORMAT_JSON, settings->mqtt_format == MQTT_FORMAT_JSON ? " selected" : "",
+        MQTT_FORMAT_CBOR, settings->mqtt_format == MQTT_FORMAT_CBOR ? " selected" : "");
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_descriptors checkbox
+    snprintf(buffer, 1024,
+        "<label for='mqtt_descriptors'>\n"
+        "<input type='checkbox' id='mqtt_descriptors' name='mqtt_descriptors' value='1'%s> Publish Sensor Names and Units as Retained Descriptors (&lt;topic&gt;/meta/...)\n"
+        "</label>\n",
+        settings->mqtt_descriptors ? " checked" : "");
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_sensor_qos and mqtt_status_qos with current values selected
+    snprintf(buffer, 1024,
+        "<label for='mqtt_sensor_qos'>MQTT Sensor QoS:</label>\n"
+        "<select id='mqtt_sensor_qos' name='mqtt_sensor_qos'>\n"
+        "<option value='0'%s>0 (at most once)</option>\n"
+        "<option value='1'%s>1 (at least once)</option>\n"
+        "</select>\n"
+        "<label for='mqtt_status_qos'>MQTT Status QoS:</label>\n"
+        "<select id='mqtt_status_qos' name='mqtt_status_qos'>\n"
+        "<option value='0'%s>0 (at most once)</option>\n"
+        "<option value='1'%s>1 (at least once)</option>\n"
+        "</select>\n",
+        settings->mqtt_sensor_qos == 0 ? " selected" : "",
+        settings->mqtt_sensor_qos == 1 ? " selected" : "",
+        settings->mqtt_status_qos == 0 ? " selected" : "",
+        settings->mqtt_status_qos == 1 ? " selected" : "");
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send mqtt_inflight_max with current value
+    snprintf(buffer, 1024,
+        "<label for='mqtt_inflight_max'>MQTT QoS 1 In-Flight Window (messages):</label>\n"
+        "<input type='number' id='mqtt_inflight_max' name='mqtt_inflight_max' value='%u' min='1' max='%d'>\n",
+        settings->mqtt_inflight_max, MQTT_INFLIGHT_MAX);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    // Send remote_write settings
+    httpd_resp_sendstr_chunk(req,
+        "<hr class='major'/>\n"
+        "<h2>Prometheus Remote Write</h2>\n");
+    
+    // Send remote_write_url with current value
+    char *encoded_remote_write_url = url_encode(settings->remote_write_url);
+    snprintf(buffer, 1024,
+        "<label for='remote_write_url'>Remote Write URL:</label>\n"
+        "<input type='text' id='remote_write_url' name='remote_write_url' value='%s' placeholder='http://prometheus.example.com:9090/api/v1/write'>\n",
+        encoded_remote_write_url ? encoded_remote_write_url : "");
+    httpd_resp_sendstr_chunk(req, buffer);
+    tracked_free(ALLOC_SETTINGS, encoded_remote_write_url);
+    
+    // Send remote_write_interval with current value
+    snprintf(buffer, 1024,
+        "<label for='remote_write_interval'>Remote Write Interval (seconds):</label>\n"
+        "<input type='number' id='remote_write_interval' name='remote_write_interval' value='%u' min='10' max='3600'>\n",
+        settings->remote_write_interval);
+    httpd_resp_sendstr_chunk(req, buffer);
 
     // Send weight_tare with current value
     snprintf(buffer, 1024,
@@ -452,8 +541,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
             "</div>\n",
             display_index, addr_str, display_index, encoded_name ? encoded_name : "");
         httpd_resp_sendstr_chunk(req, buffer);
-        free(encoded_name);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, encoded_name);
         display_index++;
     }
     
@@ -481,8 +569,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
                 "</div>\n",
                 display_index, addr_str, display_index, encoded_name ? encoded_name : "");
             httpd_resp_sendstr_chunk(req, buffer);
-            free(encoded_name);
-            atomic_fetch_add(&free_count_settings, 1);
+            tracked_free(ALLOC_SETTINGS, encoded_name);
             display_index++;
         }
     }
@@ -585,8 +672,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
             "</div>\n",
             i, mac_str, i, encoded_name ? encoded_name : "", i, settings->mac_filters[i].enabled ? " checked" : "");
         httpd_resp_sendstr_chunk(req, buffer);
-        free(encoded_name);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, encoded_name);
     }
     
     httpd_resp_sendstr_chunk(req,
@@ -615,6 +701,65 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "}\n"
         "</script>\n");
     
+    // Send sensor publish policies section
+    httpd_resp_sendstr_chunk(req,
+        "<hr class='major'/>\n"
+        "<h2>Sensor Publish Policies</h2>\n"
+        "<p>Limit MQTT updates per sensor. Empty metric or device ID matches any sensor; 0 disables a limit.</p>\n"
+        "<div id='publish_policies_container'>\n");
+    
+    for (size_t i = 0; i < settings->publish_policies_count; i++) {
+        const publish_policy_t *policy = &settings->publish_policies[i];
+        char *encoded_metric = url_encode(policy->metric_name);
+        char *encoded_device = url_encode(policy->device_id);
+        
+        snprintf(buffer, 1024,
+            "<div class='publish_policy_row' style='margin: 10px 0; padding: 10px; background: #fff; border: 1px solid #ddd; border-radius: 4px;'>\n"
+            "  <input type='text' name='publish_policy[%zu][metric]' value='%s' placeholder='Metric name' style='width: 180px;'>\n"
+            "  <input type='text' name='publish_policy[%zu][device]' value='%s' placeholder='Device ID' style='width: 180px;'>\n"
+            "  <label>Deadband (abs / %%): <input type='number' step='any' min='0' name='publish_policy[%zu][abs]' value='%g' style='width: 80px;'>"
+            " <input type='number' step='any' min='0' name='publish_policy[%zu][rel]' value='%g' style='width: 80px;'></label>\n"
+            "  <label>Min interval / heartbeat (s): <input type='number' min='0' max='65535' name='publish_policy[%zu][min_interval]' value='%u' style='width: 80px;'>"
+            " <input type='number' min='0' max='65535' name='publish_policy[%zu][heartbeat]' value='%u' style='width: 80px;'></label>\n"
+            "  <button type='button' onclick='this.parentElement.remove()' style='width: auto; padding: 5px 10px; background: #dc3545; margin-left: 10px;'>Remove</button>\n"
+            "</div>\n",
+            i, encoded_metric ? encoded_metric : "",
+            i, encoded_device ? encoded_device : "",
+            i, policy->abs_deadband, i, policy->rel_deadband,
+            i, policy->min_interval_s, i, policy->heartbeat_s);
+        httpd_resp_sendstr_chunk(req, buffer);
+        tracked_free(ALLOC_SETTINGS, encoded_metric);
+        tracked_free(ALLOC_SETTINGS, encoded_device);
+    }
+    
+    httpd_resp_sendstr_chunk(req,
+        "</div>\n"
+        "<button type='button' onclick='addPublishPolicy()' style='width: auto; background: #007bff; margin-top: 10px;'>Add Publish Policy</button>\n"
+        "<script>\n"
+        "var publishPolicyIndex = " );
+    
+    snprintf(buffer, 1024, "%zu;\n", settings->publish_policies_count);
+    httpd_resp_sendstr_chunk(req, buffer);
+    
+    httpd_resp_sendstr_chunk(req,
+        "function addPublishPolicy() {\n"
+        "  var container = document.getElementById('publish_policies_container');\n"
+        "  var div = document.createElement('div');\n"
+        "  div.className = 'publish_policy_row';\n"
+        "  div.style = 'margin: 10px 0; padding: 10px; background: #fff; border: 1px solid #ddd; border-radius: 4px;';\n"
+        "  div.innerHTML = `\n"
+        "    <input type='text' name='publish_policy[${publishPolicyIndex}][metric]' placeholder='Metric name' style='width: 180px;'>\n"
+        "    <input type='text' name='publish_policy[${publishPolicyIndex}][device]' placeholder='Device ID' style='width: 180px;'>\n"
+        "    <label>Deadband (abs / %): <input type='number' step='any' min='0' name='publish_policy[${publishPolicyIndex}][abs]' value='0' style='width: 80px;'>"
+        " <input type='number' step='any' min='0' name='publish_policy[${publishPolicyIndex}][rel]' value='0' style='width: 80px;'></label>\n"
+        "    <label>Min interval / heartbeat (s): <input type='number' min='0' max='65535' name='publish_policy[${publishPolicyIndex}][min_interval]' value='0' style='width: 80px;'>"
+        " <input type='number' min='0' max='65535' name='publish_policy[${publishPolicyIndex}][heartbeat]' value='0' style='width: 80px;'></label>\n"
+        "    <button type='button' onclick='this.parentElement.remove()' style='width: auto; padding: 5px 10px; background: #dc3545; margin-left: 10px;'>Remove</button>\n"
+        "  `;\n"
+        "  container.appendChild(div);\n"
+        "  publishPolicyIndex++;\n"
+        "}\n"
+        "</script>\n");
     
     // Get firmware version info
     const esp_app_desc_t *app_desc = esp_app_get_description();
@@ -664,8 +809,10 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "    if (input.value) ds18b20NameCount++;\n"
         "  });\n"
         "  params.append('ds18b20_name_count', ds18b20NameCount);\n"
+        "  // Count publish policies\n"
+        "  params.append('publish_policy_count', document.querySelectorAll('.publish_policy_row').length);\n"
         "  // Fields that should be sent even when empty (to allow clearing)\n"
-        "  var allowEmptyFields = ['syslog_server', 'mqtt_broker_url', 'mqtt_username', 'mqtt_password'];\n"
+        "  var allowEmptyFields = ['syslog_server', 'mqtt_broker_url', 'mqtt_username', 'mqtt_password', 'remote_write_url'];\n"
         "  // Process all other form fields\n"
         "  for (var pair of formData.entries()) {\n"
         "    if (pair[1]) {\n"
@@ -677,6 +824,9 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "    } else if (pair[0].startsWith('mac_filter[') && pair[0].includes('[mac]')) {\n"
         "      // Include MAC filter fields even if empty for proper indexing\n"
         "      params.append(pair[0], pair[1]);\n"
+        "    } else if (pair[0].startsWith('publish_policy[')) {\n"
+        "      // Empty metric/device fields are wildcards and must be kept\n"
+        "      params.append(pair[0], pair[1]);\n"
         "    } else if (allowEmptyFields.includes(pair[0])) {\n"
         "      // Include these fields even if empty to allow clearing them\n"
         "      params.append(pair[0], pair[1]);\n"
@@ -715,8 +865,7 @@ static esp_err_t settings_get_handler(httpd_req_t *req) {
         "</html>\n");
     
     httpd_resp_sendstr_chunk(req, NULL);
-    free(buffer);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, buffer);
     return ESP_OK;
 }
 
@@ -733,8 +882,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
     size_t content_len = req->content_len;
     if (content_len > 0) {
         // Allocate buffer for POST data
-        query_buf = malloc(content_len + 1);
-        atomic_fetch_add(&malloc_count_settings, 1);
+        query_buf = tracked_malloc(ALLOC_SETTINGS, content_len + 1);
         if (query_buf == NULL) {
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
             return ESP_ERR_NO_MEM;
@@ -743,8 +891,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         // Read the POST data from request body
         int ret = httpd_req_recv(req, query_buf, content_len);
         if (ret <= 0) {
-            free(query_buf);
-            atomic_fetch_add(&free_count_settings, 1);
+            tracked_free(ALLOC_SETTINGS, query_buf);
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Request timeout");
             } else {
@@ -761,16 +908,14 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             return ESP_FAIL;
         }
         
-        query_buf = malloc(query_len + 1);
-        atomic_fetch_add(&malloc_count_settings, 1);
+        query_buf = tracked_malloc(ALLOC_SETTINGS, query_len + 1);
         if (query_buf == NULL) {
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
             return ESP_ERR_NO_MEM;
         }
         
         if (httpd_req_get_url_query_str(req, query_buf, query_len + 1) != ESP_OK) {
-            free(query_buf);
-            atomic_fetch_add(&free_count_settings, 1);
+            tracked_free(ALLOC_SETTINGS, query_buf);
             httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to parse query string");
             return ESP_FAIL;
         }
@@ -780,8 +925,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
     nvs_handle_t settings_handle;
     err = nvs_open("settings", NVS_READWRITE, &settings_handle);
     if (err != ESP_OK) {
-        free(query_buf);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, query_buf);
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to open NVS");
         return err;
     }
@@ -801,10 +945,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "password", decoded_param);
             if (err == ESP_OK) {
                 if (settings->password != NULL) {
-                    free(settings->password);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->password);
                 }
-                settings->password = strdup(decoded_param);
+                settings->password = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 ESP_LOGI(TAG, "Updated password");
             } else {
@@ -824,10 +967,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "update_url", decoded_param);
             if (err == ESP_OK) {
                 if (settings->update_url != NULL) {
-                    free(settings->update_url);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->update_url);
                 }
-                settings->update_url = strdup(decoded_param);
+                settings->update_url = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 ESP_LOGI(TAG, "Updated update_url to %s", decoded_param);
             } else {
@@ -1066,10 +1208,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "wifi_ssid", decoded_param);
             if (err == ESP_OK) {
                 if (settings->wifi_ssid != NULL) {
-                    free(settings->wifi_ssid);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->wifi_ssid);
                 }
-                settings->wifi_ssid = strdup(decoded_param);
+                settings->wifi_ssid = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 ESP_LOGI(TAG, "Updated ssid");  
                 restart_needed = true;
@@ -1089,10 +1230,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "wifi_password", decoded_param);
             if (err == ESP_OK) {
                 if (settings->wifi_password != NULL) {
-                    free(settings->wifi_password);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->wifi_password);
                 }
-                settings->wifi_password = strdup(decoded_param);
+                settings->wifi_password = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 ESP_LOGI(TAG, "Updated wifi_password");
                 restart_needed = true;
@@ -1156,10 +1296,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "syslog_server", decoded_param);
             if (err == ESP_OK) {
                 if (settings->syslog_server != NULL) {
-                    free(settings->syslog_server);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->syslog_server);
                 }
-                settings->syslog_server = strdup(decoded_param);
+                settings->syslog_server = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated syslog_server to %s", decoded_param);
@@ -1206,10 +1345,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "mqtt_broker", decoded_param);
             if (err == ESP_OK) {
                 if (settings->mqtt_broker_url != NULL) {
-                    free(settings->mqtt_broker_url);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->mqtt_broker_url);
                 }
-                settings->mqtt_broker_url = strdup(decoded_param);
+                settings->mqtt_broker_url = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated mqtt_broker_url to %s", decoded_param);
@@ -1238,10 +1376,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "mqtt_user", decoded_param);
             if (err == ESP_OK) {
                 if (settings->mqtt_username != NULL) {
-                    free(settings->mqtt_username);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->mqtt_username);
                 }
-                settings->mqtt_username = strdup(decoded_param);
+                settings->mqtt_username = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated mqtt_username to %s", decoded_param);
@@ -1270,10 +1407,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "mqtt_pass", decoded_param);
             if (err == ESP_OK) {
                 if (settings->mqtt_password != NULL) {
-                    free(settings->mqtt_password);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->mqtt_password);
                 }
-                settings->mqtt_password = strdup(decoded_param);
+                settings->mqtt_password = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated mqtt_password");
@@ -1302,10 +1438,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "mqtt_topic", decoded_param);
             if (err == ESP_OK) {
                 if (settings->mqtt_topic != NULL) {
-                    free(settings->mqtt_topic);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->mqtt_topic);
                 }
-                settings->mqtt_topic = strdup(decoded_param);
+                settings->mqtt_topic = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated mqtt_topic to %s", decoded_param);
@@ -1334,10 +1469,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "mqtt_status_topic", decoded_param);
             if (err == ESP_OK) {
                 if (settings->mqtt_status_topic != NULL) {
-                    free(settings->mqtt_status_topic);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->mqtt_status_topic);
                 }
-                settings->mqtt_status_topic = strdup(decoded_param);
+                settings->mqtt_status_topic = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 restart_needed = true;
                 ESP_LOGI(TAG, "Updated mqtt_status_topic to %s", decoded_param);
@@ -1349,6 +1483,224 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         }
     }
 
+    // Check and update mqtt_batch_window_ms
+    if (httpd_query_key_value(query_buf, "mqtt_batch_window_ms", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_batch_window_ms = atoi(param_buf);
+        if (mqtt_batch_window_ms >= 0 && mqtt_batch_window_ms <= 60000 &&
+            mqtt_batch_window_ms != settings->mqtt_batch_window_ms) {
+            err = nvs_set_u16(settings_handle, "mqtt_batch_ms", (uint16_t)mqtt_batch_window_ms);
+            if (err == ESP_OK) {
+                settings->mqtt_batch_window_ms = (uint16_t)mqtt_batch_window_ms;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_batch_window_ms to %d", mqtt_batch_window_ms);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_batch_window_ms to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT batch window unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_batch_max
+    if (httpd_query_key_value(query_buf, "mqtt_batch_max", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_batch_max = atoi(param_buf);
+        if (mqtt_batch_max >= 2 && mqtt_batch_max <= MQTT_BATCH_MAX_SENSORS &&
+            mqtt_batch_max != settings->mqtt_batch_max) {
+            err = nvs_set_u8(settings_handle, "mqtt_batch_max", (uint8_t)mqtt_batch_max);
+            if (err == ESP_OK) {
+                settings->mqtt_batch_max = (uint8_t)mqtt_batch_max;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_batch_max to %d", mqtt_batch_max);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_batch_max to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT batch size unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_offline_max
+    if (httpd_query_key_value(query_buf, "mqtt_offline_max", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_offline_max = atoi(param_buf);
+        if (mqtt_offline_max >= 0 && mqtt_offline_max <= MQTT_OFFLINE_MAX_READINGS &&
+            mqtt_offline_max != settings->mqtt_offline_max) {
+            err = nvs_set_u16(settings_handle, "mqtt_offline", (uint16_t)mqtt_offline_max);
+            if (err == ESP_OK) {
+                settings->mqtt_offline_max = (uint16_t)mqtt_offline_max;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_offline_max to %d", mqtt_offline_max);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_offline_max to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT offline buffer size unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_replay_rate
+    if (httpd_query_key_value(query_buf, "mqtt_replay_rate", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_replay_rate = atoi(param_buf);
+        if (mqtt_replay_rate >= 1 && mqtt_replay_rate <= 1000 &&
+            mqtt_replay_rate != settings->mqtt_replay_rate) {
+            err = nvs_set_u16(settings_handle, "mqtt_replay", (uint16_t)mqtt_replay_rate);
+            if (err == ESP_OK) {
+                settings->mqtt_replay_rate = (uint16_t)mqtt_replay_rate;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_replay_rate to %d", mqtt_replay_rate);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_replay_rate to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT replay rate unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_format
+    if (httpd_query_key_value(query_buf, "mqtt_format", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_format = atoi(param_buf);
+        if (mqtt_format >= 0 && mqtt_format < MQTT_FORMAT_COUNT &&
+            mqtt_format != settings->mqtt_format) {
+            err = nvs_set_u8(settings_handle, "mqtt_format", (uint8_t)mqtt_format);
+            if (err == ESP_OK) {
+                settings->mqtt_format = (uint8_t)mqtt_format;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_format to %d", mqtt_format);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_format to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT payload format unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_descriptors
+    bool mqtt_descriptors = false;
+    if (httpd_query_key_value(query_buf, "mqtt_descriptors", param_buf, sizeof(param_buf)) == ESP_OK) {
+        mqtt_descriptors = true;
+    }
+    if (mqtt_descriptors != settings->mqtt_descriptors) {
+        err = nvs_set_u8(settings_handle, "mqtt_desc", mqtt_descriptors ? 1 : 0);
+        if (err == ESP_OK) {
+            settings->mqtt_descriptors = mqtt_descriptors;
+            updated = true;
+            restart_needed = true;
+            ESP_LOGI(TAG, "Updated mqtt_descriptors to %d", mqtt_descriptors);
+        } else {
+            ESP_LOGE(TAG, "Failed to write mqtt_descriptors to NVS: %s", esp_err_to_name(err));
+        }
+    }
+
+    // Check and update mqtt_sensor_qos
+    if (httpd_query_key_value(query_buf, "mqtt_sensor_qos", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_sensor_qos = atoi(param_buf);
+        if (mqtt_sensor_qos >= 0 && mqtt_sensor_qos <= 1 &&
+            mqtt_sensor_qos != settings->mqtt_sensor_qos) {
+            err = nvs_set_u8(settings_handle, "mqtt_qos_sensor", (uint8_t)mqtt_sensor_qos);
+            if (err == ESP_OK) {
+                settings->mqtt_sensor_qos = (uint8_t)mqtt_sensor_qos;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_sensor_qos to %d", mqtt_sensor_qos);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_sensor_qos to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT sensor QoS unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_status_qos
+    if (httpd_query_key_value(query_buf, "mqtt_status_qos", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_status_qos = atoi(param_buf);
+        if (mqtt_status_qos >= 0 && mqtt_status_qos <= 1 &&
+            mqtt_status_qos != settings->mqtt_status_qos) {
+            err = nvs_set_u8(settings_handle, "mqtt_qos_status", (uint8_t)mqtt_status_qos);
+            if (err == ESP_OK) {
+                settings->mqtt_status_qos = (uint8_t)mqtt_status_qos;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_status_qos to %d", mqtt_status_qos);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_status_qos to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT status QoS unchanged or invalid");
+        }
+    }
+
+    // Check and update mqtt_inflight_max
+    if (httpd_query_key_value(query_buf, "mqtt_inflight_max", param_buf, sizeof(param_buf)) == ESP_OK) {
+        int mqtt_inflight_max = atoi(param_buf);
+        if (mqtt_inflight_max >= 1 && mqtt_inflight_max <= MQTT_INFLIGHT_MAX &&
+            mqtt_inflight_max != settings->mqtt_inflight_max) {
+            err = nvs_set_u8(settings_handle, "mqtt_inflight", (uint8_t)mqtt_inflight_max);
+            if (err == ESP_OK) {
+                settings->mqtt_inflight_max = (uint8_t)mqtt_inflight_max;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated mqtt_inflight_max to %d", mqtt_inflight_max);
+            } else {
+                ESP_LOGE(TAG, "Failed to write mqtt_inflight_max to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "MQTT in-flight window unchanged or invalid");
+        }
+    }
+
+    // Check and update remote_write_url
+    if (httpd_query_key_value(query_buf, "remote_write_url", param_buf, sizeof(param_buf)) == ESP_OK) {
+        url_decode(decoded_param, param_buf);
+        // Only update if the value has actually changed
+        bool should_update = false;
+        if (settings->remote_write_url == NULL || strlen(settings->remote_write_url) == 0) {
+            // Currently empty, update if new value is not empty
+            should_update = (strlen(decoded_param) > 0);
+        } else {
+            // Currently has a value, update if new value is different
+            should_update = (strcmp(decoded_param, settings->remote_write_url) != 0);
+        }
+        
+        if (should_update) {
+            err = nvs_set_str(settings_handle, "rw_url", decoded_param);
+            if (err == ESP_OK) {
+                if (settings->remote_write_url != NULL) {
+                    tracked_free(ALLOC_SETTINGS, settings->remote_write_url);
+                }
+                settings->remote_write_url = tracked_strdup(ALLOC_SETTINGS, decoded_param);
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated remote_write_url to %s", decoded_param);
+            } else {
+                ESP_LOGE(TAG, "Failed to write remote_write_url to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "Remote write URL unchanged");
+        }
+    }
+
+    // Check and update remote_write_interval
+    if (httpd_query_key_value(query_buf, "remote_write_interval", param_buf, sizeof(param_buf)) == ESP_OK) {
+        uint16_t remote_write_interval = (uint16_t)atoi(param_buf);
+        if (remote_write_interval >= 10 && remote_write_interval != settings->remote_write_interval) {
+            err = nvs_set_u16(settings_handle, "rw_interval", remote_write_interval);
+            if (err == ESP_OK) {
+                settings->remote_write_interval = remote_write_interval;
+                updated = true;
+                restart_needed = true;
+                ESP_LOGI(TAG, "Updated remote_write_interval to %u", remote_write_interval);
+            } else {
+                ESP_LOGE(TAG, "Failed to write remote_write_interval to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "Remote write interval unchanged or invalid");
+        }
+    }
+
     // Check and update hostname
     if (httpd_query_key_value(query_buf, "hostname", param_buf, sizeof(param_buf)) == ESP_OK) {
         url_decode(decoded_param, param_buf);  // Decode URL encoding
@@ -1360,10 +1712,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "hostname", decoded_param);
             if (err == ESP_OK) {
                 if (settings->hostname != NULL) {
-                    free(settings->hostname);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->hostname);
                 }
-                settings->hostname = strdup(decoded_param);
+                settings->hostname = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 updated = true;
                 ESP_LOGI(TAG, "Updated hostname to %s", decoded_param);
                 restart_needed = true;
@@ -1384,10 +1735,9 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             err = nvs_set_str(settings_handle, "timezone", decoded_param);
             if (err == ESP_OK) {
                 if (settings->timezone != NULL) {
-                    free(settings->timezone);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->timezone);
                 }
-                settings->timezone = strdup(decoded_param);
+                settings->timezone = tracked_strdup(ALLOC_SETTINGS, decoded_param);
                 // Apply timezone using setenv and tzset
                 setenv("TZ", settings->timezone, 1);
                 tzset();
@@ -1407,12 +1757,10 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         
         // The multi-select will send multiple parameters with the same name
         // We need to parse them all and create a blob
-        uint8_t *selected_ids = malloc(256);  // Maximum 256 object IDs
-        atomic_fetch_add(&malloc_count_settings, 1);
+        uint8_t *selected_ids = tracked_malloc(ALLOC_SETTINGS, 256);  // Maximum 256 object IDs
         if (!selected_ids) {
             nvs_close(settings_handle);
-            free(query_buf);
-            atomic_fetch_add(&free_count_settings, 1);
+            tracked_free(ALLOC_SETTINGS, query_buf);
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
             return ESP_ERR_NO_MEM;
         }
@@ -1469,13 +1817,11 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         
         if (err == ESP_OK) {
             if (settings->selected_bthome_object_ids != NULL) {
-                free(settings->selected_bthome_object_ids);
-                atomic_fetch_add(&free_count_settings, 1);
+                tracked_free(ALLOC_SETTINGS, settings->selected_bthome_object_ids);
             }
             
             if (selected_count > 0) {
-                settings->selected_bthome_object_ids = malloc(selected_count);
-                atomic_fetch_add(&malloc_count_settings, 1);
+                settings->selected_bthome_object_ids = tracked_malloc(ALLOC_SETTINGS, selected_count);
                 if (settings->selected_bthome_object_ids != NULL) {
                     memcpy(settings->selected_bthome_object_ids, selected_ids, selected_count);
                     settings->selected_bthome_object_ids_count = selected_count;
@@ -1496,8 +1842,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         } else {
             ESP_LOGI(TAG, "BTHome object IDs unchanged");
         }
-        free(selected_ids);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, selected_ids);
     } else {
         ESP_LOGI(TAG, "BTHome object IDs field not present in request, skipping");
     }
@@ -1509,11 +1854,10 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         ESP_LOGI(TAG, "MAC filter count field present: %zu", expected_count);
         
         // Format: mac_filter[N][field]=value where field is: mac, name, enabled
-        mac_filter_t *filters = malloc(64 * sizeof(mac_filter_t));  // Maximum 64 filters
-        atomic_fetch_add(&malloc_count_settings, 1);
+        mac_filter_t *filters = tracked_malloc(ALLOC_SETTINGS, 64 * sizeof(mac_filter_t));  // Maximum 64 filters
         if (!filters) {
             nvs_close(settings_handle);
-            free(query_buf);
+            tracked_free(ALLOC_SETTINGS, query_buf);
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
             return ESP_ERR_NO_MEM;
         }
@@ -1605,13 +1949,11 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         
         if (err == ESP_OK) {
             if (settings->mac_filters != NULL) {
-                free(settings->mac_filters);
-                atomic_fetch_add(&free_count_settings, 1);
+                tracked_free(ALLOC_SETTINGS, settings->mac_filters);
             }
             
             if (filter_count > 0) {
-                settings->mac_filters = malloc(filter_count * sizeof(mac_filter_t));
-                atomic_fetch_add(&malloc_count_settings, 1);
+                settings->mac_filters = tracked_malloc(ALLOC_SETTINGS, filter_count * sizeof(mac_filter_t));
                 if (settings->mac_filters != NULL) {
                     memcpy(settings->mac_filters, filters, filter_count * sizeof(mac_filter_t));
                     settings->mac_filters_count = filter_count;
@@ -1632,8 +1974,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         } else {
             ESP_LOGI(TAG, "MAC filters unchanged");
         }
-        free(filters);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, filters);
     } else {
         ESP_LOGI(TAG, "MAC filter field not present in request, skipping");
     }
@@ -1645,12 +1986,10 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         ESP_LOGI(TAG, "DS18B20 name count field present: %zu", expected_count);
         
         // Format: ds18b20_name[N][field]=value where field is: address, name
-        ds18b20_name_t *names = malloc(64 * sizeof(ds18b20_name_t));  // Maximum 64 devices
-        atomic_fetch_add(&malloc_count_settings, 1);
+        ds18b20_name_t *names = tracked_malloc(ALLOC_SETTINGS, 64 * sizeof(ds18b20_name_t));  // Maximum 64 devices
         if (!names) {
             nvs_close(settings_handle);
-            free(query_buf);
-            atomic_fetch_add(&free_count_settings, 1);
+            tracked_free(ALLOC_SETTINGS, query_buf);
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
             return ESP_ERR_NO_MEM;
         }
@@ -1730,13 +2069,11 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
             
             if (err == ESP_OK) {
                 if (settings->ds18b20_names != NULL) {
-                    free(settings->ds18b20_names);
-                    atomic_fetch_add(&free_count_settings, 1);
+                    tracked_free(ALLOC_SETTINGS, settings->ds18b20_names);
                 }
                 
                 if (name_count > 0) {
-                    settings->ds18b20_names = malloc(name_count * sizeof(ds18b20_name_t));
-                    atomic_fetch_add(&malloc_count_settings, 1);
+                    settings->ds18b20_names = tracked_malloc(ALLOC_SETTINGS, name_count * sizeof(ds18b20_name_t));
                     if (settings->ds18b20_names != NULL) {
                         memcpy(settings->ds18b20_names, names, name_count * sizeof(ds18b20_name_t));
                         settings->ds18b20_names_count = name_count;
@@ -1757,12 +2094,126 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
         } else {
             ESP_LOGI(TAG, "DS18B20 names unchanged");
         }
-        free(names);
-        atomic_fetch_add(&free_count_settings, 1);
+        tracked_free(ALLOC_SETTINGS, names);
     } else {
         ESP_LOGI(TAG, "DS18B20 name field not present in request, skipping");
     }
     
+    // Check and update sensor publish policies
+    // Only process if publish_policy_count field is present in the query
+    if (httpd_query_key_value(query_buf, "publish_policy_count", param_buf, sizeof(param_buf)) == ESP_OK) {
+        size_t expected_count = (size_t)atoi(param_buf);
+        ESP_LOGI(TAG, "Publish policy count field present: %zu", expected_count);
+        
+        // Format: publish_policy[N][field]=value where field is: metric, device, abs, rel, min_interval, heartbeat
+        publish_policy_t *policies = tracked_calloc(ALLOC_SETTINGS, MAX_PUBLISH_POLICIES, sizeof(publish_policy_t));
+        if (!policies) {
+            nvs_close(settings_handle);
+            tracked_free(ALLOC_SETTINGS, query_buf);
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
+            return ESP_ERR_NO_MEM;
+        }
+        size_t policy_count = 0;
+        
+        // Rows can be removed in the form, so indexes may have gaps
+        for (size_t i = 0; i < 64 && policy_count < MAX_PUBLISH_POLICIES; i++) {
+            char key_buf[64];
+            publish_policy_t *policy = &policies[policy_count];
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Bmetric%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) != ESP_OK) {
+                continue;
+            }
+            url_decode(decoded_param, param_buf);
+            strncpy(policy->metric_name, decoded_param, sizeof(policy->metric_name) - 1);
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Bdevice%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) == ESP_OK) {
+                url_decode(decoded_param, param_buf);
+                strncpy(policy->device_id, decoded_param, sizeof(policy->device_id) - 1);
+            }
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Babs%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) == ESP_OK) {
+                policy->abs_deadband = fabsf(strtof(param_buf, NULL));
+            }
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Brel%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) == ESP_OK) {
+                policy->rel_deadband = fabsf(strtof(param_buf, NULL));
+            }
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Bmin_interval%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) == ESP_OK) {
+                int value = atoi(param_buf);
+                policy->min_interval_s = value < 0 ? 0 : (value > UINT16_MAX ? UINT16_MAX : value);
+            }
+            
+            snprintf(key_buf, sizeof(key_buf), "publish_policy%%5B%zu%%5D%%5Bheartbeat%%5D", i);
+            if (httpd_query_key_value(query_buf, key_buf, param_buf, sizeof(param_buf)) == ESP_OK) {
+                int value = atoi(param_buf);
+                policy->heartbeat_s = value < 0 ? 0 : (value > UINT16_MAX ? UINT16_MAX : value);
+            }
+            
+            ESP_LOGI(TAG, "Found publish policy[%zu]: metric='%s', device='%s', abs=%g, rel=%g%%, min_interval=%us, heartbeat=%us",
+                     policy_count, policy->metric_name, policy->device_id,
+                     policy->abs_deadband, policy->rel_deadband,
+                     policy->min_interval_s, policy->heartbeat_s);
+            policy_count++;
+        }
+        
+        // Check if publish policies have changed
+        bool policies_changed = (policy_count != settings->publish_policies_count) ||
+            (policy_count > 0 && memcmp(policies, settings->publish_policies, policy_count * sizeof(publish_policy_t)) != 0);
+        
+        if (policies_changed) {
+            if (policy_count > 0) {
+                err = nvs_set_blob(settings_handle, "pub_policies", policies, policy_count * sizeof(publish_policy_t));
+            } else {
+                // If no policies, erase the key
+                err = nvs_erase_key(settings_handle, "pub_policies");
+                if (err == ESP_ERR_NVS_NOT_FOUND) {
+                    err = ESP_OK;  // Already doesn't exist, that's fine
+                }
+            }
+            
+            if (err == ESP_OK) {
+                // Build the new array first, then swap it in under the lock;
+                // lookups copy the policy out, so the old array is free to go
+                publish_policy_t *new_policies = NULL;
+                if (policy_count > 0) {
+                    new_policies = tracked_malloc(ALLOC_SETTINGS, policy_count * sizeof(publish_policy_t));
+                    if (new_policies != NULL) {
+                        memcpy(new_policies, policies, policy_count * sizeof(publish_policy_t));
+                    } else {
+                        ESP_LOGE(TAG, "Failed to allocate memory for publish policies");
+                        policy_count = 0;
+                    }
+                }
+                
+                taskENTER_CRITICAL(&publish_policies_lock);
+                publish_policy_t *old_policies = settings->publish_policies;
+                settings->publish_policies = new_policies;
+                settings->publish_policies_count = policy_count;
+                taskEXIT_CRITICAL(&publish_policies_lock);
+                
+                if (old_policies != NULL) {
+                    tracked_free(ALLOC_SETTINGS, old_policies);
+                }
+                
+                updated = true;
+                ESP_LOGI(TAG, "Updated publish policies - count: %zu", policy_count);
+            } else {
+                ESP_LOGE(TAG, "Failed to write pub_policies to NVS: %s", esp_err_to_name(err));
+            }
+        } else {
+            ESP_LOGI(TAG, "Publish policies unchanged");
+        }
+        tracked_free(ALLOC_SETTINGS, policies);
+    } else {
+        ESP_LOGI(TAG, "Publish policy field not present in request, skipping");
+    }
+    
     
     // Commit changes to NVS
     if (updated) {
@@ -1773,8 +2224,7 @@ static esp_err_t settings_post_handler(httpd_req_t *req) {
     }
     
     nvs_close(settings_handle);
-    free(query_buf);
-    atomic_fetch_add(&free_count_settings, 1);
+    tracked_free(ALLOC_SETTINGS, query_buf);
     
     if (updated) {
         httpd_resp_set_status(req, HTTPD_200);
@@ -1841,6 +2291,8 @@ esp_err_t settings_init(settings_t *settings)
     settings->selected_bthome_object_ids_count = 0;
     settings->mac_filters = NULL;
     settings->mac_filters_count = 0;
+    settings->publish_policies = NULL;
+    settings->publish_policies_count = 0;
     settings->ds18b20_gpio = -1;
     settings->ds18b20_pwr_gpio = -1;
     settings->weight_dt_gpio = -1;
@@ -1856,6 +2308,17 @@ esp_err_t settings_init(settings_t *settings)
     settings->mqtt_password = NULL;
     settings->mqtt_topic = NULL;
     settings->mqtt_status_topic = NULL;
+    settings->mqtt_batch_window_ms = 0;  // Default one message per update
+    settings->mqtt_batch_max = 16;  // Default batch size
+    settings->mqtt_offline_max = 256;  // Default offline buffer size
+    settings->mqtt_replay_rate = 10;  // Default replay rate
+    settings->mqtt_format = MQTT_FORMAT_JSON;  // Default JSON payloads
+    settings->mqtt_descriptors = false;  // Default full readings
+    settings->mqtt_sensor_qos = 0;  // Default at most once
+    settings->mqtt_status_qos = 0;  // Default at most once
+    settings->mqtt_inflight_max = 8;  // Default in-flight window
+    settings->remote_write_url = NULL;
+    settings->remote_write_interval = 60;  // Default remote_write interval
     // Open NVS handle
     ESP_LOGI(TAG, "Opening Non-Volatile Storage (NVS) handle...");
     nvs_handle_t settings_handle;
@@ -1870,8 +2333,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "update_url", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->update_url = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->update_url = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->update_url == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for update_url");
                 return ESP_ERR_NO_MEM;
@@ -1884,7 +2346,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'update_url' = '%s'", settings->update_url);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->update_url = strdup(CONFIG_OTA_FIRMWARE_UPGRADE_URL);
+            settings->update_url = tracked_strdup(ALLOC_SETTINGS, CONFIG_OTA_FIRMWARE_UPGRADE_URL);
             ESP_LOGI(TAG, "No value for 'update_url'; using default = '%s'", settings->update_url);
             break;
         default:
@@ -1896,8 +2358,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "password", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->password = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->password = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->password == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for password");
                 return ESP_ERR_NO_MEM;
@@ -1910,7 +2371,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'password' = '%s'", settings->password);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->password = strdup(CONFIG_HTTPD_BASIC_AUTH_PASSWORD);
+            settings->password = tracked_strdup(ALLOC_SETTINGS, CONFIG_HTTPD_BASIC_AUTH_PASSWORD);
             ESP_LOGI(TAG, "No value for 'password'; using default = '%s'", settings->password);
             break;
         default:
@@ -1971,8 +2432,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "wifi_ssid", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->wifi_ssid = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->wifi_ssid = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->wifi_ssid == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for wifi_ssid");
                 return ESP_ERR_NO_MEM;
@@ -1985,7 +2445,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'wifi_ssid' = '%s'", settings->wifi_ssid);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->wifi_ssid = strdup(CONFIG_ESP_WIFI_SSID);
+            settings->wifi_ssid = tracked_strdup(ALLOC_SETTINGS, CONFIG_ESP_WIFI_SSID);
             ESP_LOGI(TAG, "No value for 'wifi_ssid'; using default = '%s'", settings->wifi_ssid);
             break;
         default:
@@ -1997,8 +2457,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "wifi_password", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->wifi_password = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->wifi_password = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->wifi_password == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for password");
                 return ESP_ERR_NO_MEM;
@@ -2011,7 +2470,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'wifi_password' = '%s'", settings->wifi_password);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->wifi_password = strdup(CONFIG_ESP_WIFI_PASSWORD);
+            settings->wifi_password = tracked_strdup(ALLOC_SETTINGS, CONFIG_ESP_WIFI_PASSWORD);
             ESP_LOGI(TAG, "No value for 'wifi_password'; using default = '%s'", settings->wifi_password);
             break;
         default:
@@ -2061,8 +2520,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "hostname", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->hostname = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->hostname = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->hostname == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for hostname");
                 return ESP_ERR_NO_MEM;
@@ -2075,7 +2533,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'hostname' = '%s'", settings->hostname);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->hostname = strdup(CONFIG_ESP_WIFI_HOSTNAME);
+            settings->hostname = tracked_strdup(ALLOC_SETTINGS, CONFIG_ESP_WIFI_HOSTNAME);
             ESP_LOGI(TAG, "No value for 'hostname'; using default = '%s'", settings->hostname);
             break;
         default:
@@ -2087,8 +2545,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "timezone", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->timezone = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->timezone = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->timezone == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for timezone");
                 return ESP_ERR_NO_MEM;
@@ -2104,7 +2561,7 @@ esp_err_t settings_init(settings_t *settings)
             tzset();
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->timezone = strdup("UTC0");
+            settings->timezone = tracked_strdup(ALLOC_SETTINGS, "UTC0");
             ESP_LOGI(TAG, "No value for 'timezone'; using default = '%s'", settings->timezone);
             // Apply default timezone
             setenv("TZ", settings->timezone, 1);
@@ -2120,8 +2577,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_blob(settings_handle, "bthome_obj_ids", NULL, &blob_size);
     switch (err) {
         case ESP_OK:
-            settings->selected_bthome_object_ids = malloc(blob_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->selected_bthome_object_ids = tracked_malloc(ALLOC_SETTINGS, blob_size);
             if (settings->selected_bthome_object_ids == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for selected_bthome_object_ids");
                 return ESP_ERR_NO_MEM;
@@ -2129,8 +2585,7 @@ esp_err_t settings_init(settings_t *settings)
             err = nvs_get_blob(settings_handle, "bthome_obj_ids", settings->selected_bthome_object_ids, &blob_size);
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Error (%s) reading bthome_obj_ids!", esp_err_to_name(err));
-                free(settings->selected_bthome_object_ids);
-                atomic_fetch_add(&free_count_settings, 1);
+                tracked_free(ALLOC_SETTINGS, settings->selected_bthome_object_ids);
                 settings->selected_bthome_object_ids = NULL;
                 return err;
             }
@@ -2296,8 +2751,7 @@ esp_err_t settings_init(settings_t *settings)
                 break;
             }
             settings->mac_filters_count = blob_size / sizeof(mac_filter_t);
-            settings->mac_filters = malloc(blob_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mac_filters = tracked_malloc(ALLOC_SETTINGS, blob_size);
             if (settings->mac_filters == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mac_filters");
                 return ESP_ERR_NO_MEM;
@@ -2305,8 +2759,7 @@ esp_err_t settings_init(settings_t *settings)
             err = nvs_get_blob(settings_handle, "mac_filters", settings->mac_filters, &blob_size);
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Error (%s) reading mac_filters!", esp_err_to_name(err));
-                free(settings->mac_filters);
-                atomic_fetch_add(&free_count_settings, 1);
+                tracked_free(ALLOC_SETTINGS, settings->mac_filters);
                 settings->mac_filters = NULL;
                 settings->mac_filters_count = 0;
                 return err;
@@ -2345,8 +2798,7 @@ esp_err_t settings_init(settings_t *settings)
                 break;
             }
             settings->ds18b20_names_count = blob_size / sizeof(ds18b20_name_t);
-            settings->ds18b20_names = malloc(blob_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->ds18b20_names = tracked_malloc(ALLOC_SETTINGS, blob_size);
             if (settings->ds18b20_names == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for ds18b20_names");
                 return ESP_ERR_NO_MEM;
@@ -2354,8 +2806,7 @@ esp_err_t settings_init(settings_t *settings)
             err = nvs_get_blob(settings_handle, "ds18b20_names", settings->ds18b20_names, &blob_size);
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Error (%s) reading ds18b20_names!", esp_err_to_name(err));
-                free(settings->ds18b20_names);
-                atomic_fetch_add(&free_count_settings, 1);
+                tracked_free(ALLOC_SETTINGS, settings->ds18b20_names);
                 settings->ds18b20_names = NULL;
                 settings->ds18b20_names_count = 0;
                 return err;
@@ -2378,12 +2829,46 @@ esp_err_t settings_init(settings_t *settings)
             return err;
     }
 
+    ESP_LOGI(TAG, "Reading 'pub_policies' from NVS...");
+    blob_size = 0;
+    err = nvs_get_blob(settings_handle, "pub_policies", NULL, &blob_size);
+    switch (err) {
+        case ESP_OK:
+            if (blob_size % sizeof(publish_policy_t) != 0) {
+                ESP_LOGE(TAG, "Invalid pub_policies blob size: %zu", blob_size);
+                break;
+            }
+            settings->publish_policies_count = blob_size / sizeof(publish_policy_t);
+            settings->publish_policies = tracked_malloc(ALLOC_SETTINGS, blob_size);
+            if (settings->publish_policies == NULL) {
+                ESP_LOGE(TAG, "Failed to allocate memory for pub_policies");
+                return ESP_ERR_NO_MEM;
+            }
+            err = nvs_get_blob(settings_handle, "pub_policies", settings->publish_policies, &blob_size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Error (%s) reading pub_policies!", esp_err_to_name(err));
+                tracked_free(ALLOC_SETTINGS, settings->publish_policies);
+                settings->publish_policies = NULL;
+                settings->publish_policies_count = 0;
+                return err;
+            }
+            ESP_LOGI(TAG, "Read 'pub_policies' - %zu policies", settings->publish_policies_count);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->publish_policies = NULL;
+            settings->publish_policies_count = 0;
+            ESP_LOGI(TAG, "No value for 'pub_policies'; publishing every update");
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading pub_policies!", esp_err_to_name(err));
+            return err;
+    }
+
     ESP_LOGI(TAG, "Reading 'syslog_server' from NVS...");
     err = nvs_get_str(settings_handle, "syslog_server", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->syslog_server = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->syslog_server = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->syslog_server == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for syslog_server");
                 return ESP_ERR_NO_MEM;
@@ -2396,7 +2881,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'syslog_server' = '%s'", settings->syslog_server);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->syslog_server = strdup("");
+            settings->syslog_server = tracked_strdup(ALLOC_SETTINGS, "");
             ESP_LOGI(TAG, "No value for 'syslog_server'; using default = ''");
             break;
         default:
@@ -2425,8 +2910,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "mqtt_broker", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->mqtt_broker_url = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mqtt_broker_url = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->mqtt_broker_url == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mqtt_broker_url");
                 return ESP_ERR_NO_MEM;
@@ -2439,7 +2923,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'mqtt_broker_url' = '%s'", settings->mqtt_broker_url);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->mqtt_broker_url = strdup("");
+            settings->mqtt_broker_url = tracked_strdup(ALLOC_SETTINGS, "");
             ESP_LOGI(TAG, "No value for 'mqtt_broker_url'; using default = ''");
             break;
         default:
@@ -2451,8 +2935,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "mqtt_user", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->mqtt_username = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mqtt_username = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->mqtt_username == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mqtt_username");
                 return ESP_ERR_NO_MEM;
@@ -2465,7 +2948,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'mqtt_username' = '%s'", settings->mqtt_username);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->mqtt_username = strdup("");
+            settings->mqtt_username = tracked_strdup(ALLOC_SETTINGS, "");
             ESP_LOGI(TAG, "No value for 'mqtt_username'; using default = ''");
             break;
         default:
@@ -2477,8 +2960,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "mqtt_pass", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->mqtt_password = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mqtt_password = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->mqtt_password == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mqtt_password");
                 return ESP_ERR_NO_MEM;
@@ -2491,7 +2973,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'mqtt_password' = '***'");
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->mqtt_password = strdup("");
+            settings->mqtt_password = tracked_strdup(ALLOC_SETTINGS, "");
             ESP_LOGI(TAG, "No value for 'mqtt_password'; using default = ''");
             break;
         default:
@@ -2503,8 +2985,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "mqtt_topic", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->mqtt_topic = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mqtt_topic = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->mqtt_topic == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mqtt_topic");
                 return ESP_ERR_NO_MEM;
@@ -2517,7 +2998,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'mqtt_topic' = '%s'", settings->mqtt_topic);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->mqtt_topic = strdup("station/sensor");
+            settings->mqtt_topic = tracked_strdup(ALLOC_SETTINGS, "station/sensor");
             ESP_LOGI(TAG, "No value for 'mqtt_topic'; using default = 'station/sensor'");
             break;
         default:
@@ -2529,8 +3010,7 @@ esp_err_t settings_init(settings_t *settings)
     err = nvs_get_str(settings_handle, "mqtt_status_topic", NULL, &str_size);
     switch (err) {
         case ESP_OK:
-            settings->mqtt_status_topic = malloc(str_size);
-            atomic_fetch_add(&malloc_count_settings, 1);
+            settings->mqtt_status_topic = tracked_malloc(ALLOC_SETTINGS, str_size);
             if (settings->mqtt_status_topic == NULL) {
                 ESP_LOGE(TAG, "Failed to allocate memory for mqtt_status_topic");
                 return ESP_ERR_NO_MEM;
@@ -2543,7 +3023,7 @@ esp_err_t settings_init(settings_t *settings)
             ESP_LOGI(TAG, "Read 'mqtt_status_topic' = '%s'", settings->mqtt_status_topic);
             break;
         case ESP_ERR_NVS_NOT_FOUND:
-            settings->mqtt_status_topic = strdup("station/status");
+            settings->mqtt_status_topic = tracked_strdup(ALLOC_SETTINGS, "station/status");
             ESP_LOGI(TAG, "No value for 'mqtt_status_topic'; using default = 'station/status'");
             break;
         default:
@@ -2551,6 +3031,201 @@ esp_err_t settings_init(settings_t *settings)
             return err;
     }
 
+    ESP_LOGI(TAG, "Reading 'mqtt_batch_window_ms' from NVS...");
+    uint16_t mqtt_batch_window_ms_value;
+    err = nvs_get_u16(settings_handle, "mqtt_batch_ms", &mqtt_batch_window_ms_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_batch_window_ms = mqtt_batch_window_ms_value;
+            ESP_LOGI(TAG, "Read 'mqtt_batch_window_ms' = %u", settings->mqtt_batch_window_ms);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_batch_window_ms = 0;  // Default one message per update
+            ESP_LOGI(TAG, "No value for 'mqtt_batch_window_ms'; using default = %u", settings->mqtt_batch_window_ms);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_batch_window_ms!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_batch_max' from NVS...");
+    uint8_t mqtt_batch_max_value;
+    err = nvs_get_u8(settings_handle, "mqtt_batch_max", &mqtt_batch_max_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_batch_max = mqtt_batch_max_value;
+            ESP_LOGI(TAG, "Read 'mqtt_batch_max' = %u", settings->mqtt_batch_max);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_batch_max = 16;  // Default batch size
+            ESP_LOGI(TAG, "No value for 'mqtt_batch_max'; using default = %u", settings->mqtt_batch_max);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_batch_max!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_offline_max' from NVS...");
+    uint16_t mqtt_offline_max_value;
+    err = nvs_get_u16(settings_handle, "mqtt_offline", &mqtt_offline_max_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_offline_max = mqtt_offline_max_value;
+            ESP_LOGI(TAG, "Read 'mqtt_offline_max' = %u", settings->mqtt_offline_max);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_offline_max = 256;  // Default offline buffer size
+            ESP_LOGI(TAG, "No value for 'mqtt_offline_max'; using default = %u", settings->mqtt_offline_max);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_offline_max!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_replay_rate' from NVS...");
+    uint16_t mqtt_replay_rate_value;
+    err = nvs_get_u16(settings_handle, "mqtt_replay", &mqtt_replay_rate_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_replay_rate = mqtt_replay_rate_value;
+            ESP_LOGI(TAG, "Read 'mqtt_replay_rate' = %u", settings->mqtt_replay_rate);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_replay_rate = 10;  // Default replay rate
+            ESP_LOGI(TAG, "No value for 'mqtt_replay_rate'; using default = %u", settings->mqtt_replay_rate);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_replay_rate!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_format' from NVS...");
+    uint8_t mqtt_format_value;
+    err = nvs_get_u8(settings_handle, "mqtt_format", &mqtt_format_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_format = mqtt_format_value < MQTT_FORMAT_COUNT ? mqtt_format_value : MQTT_FORMAT_JSON;
+            ESP_LOGI(TAG, "Read 'mqtt_format' = %u", settings->mqtt_format);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_format = MQTT_FORMAT_JSON;  // Default JSON payloads
+            ESP_LOGI(TAG, "No value for 'mqtt_format'; using default = %u", settings->mqtt_format);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_format!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_descriptors' from NVS...");
+    uint8_t mqtt_desc_value;
+    err = nvs_get_u8(settings_handle, "mqtt_desc", &mqtt_desc_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_descriptors = mqtt_desc_value != 0;
+            ESP_LOGI(TAG, "Read 'mqtt_descriptors' = %d", settings->mqtt_descriptors);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_descriptors = false;  // Default full readings
+            ESP_LOGI(TAG, "No value for 'mqtt_descriptors'; using default = %d", settings->mqtt_descriptors);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_descriptors!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_sensor_qos' from NVS...");
+    uint8_t mqtt_sensor_qos_value;
+    err = nvs_get_u8(settings_handle, "mqtt_qos_sensor", &mqtt_sensor_qos_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_sensor_qos = mqtt_sensor_qos_value;
+            ESP_LOGI(TAG, "Read 'mqtt_sensor_qos' = %u", settings->mqtt_sensor_qos);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_sensor_qos = 0;  // Default at most once
+            ESP_LOGI(TAG, "No value for 'mqtt_sensor_qos'; using default = %u", settings->mqtt_sensor_qos);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_sensor_qos!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_status_qos' from NVS...");
+    uint8_t mqtt_status_qos_value;
+    err = nvs_get_u8(settings_handle, "mqtt_qos_status", &mqtt_status_qos_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_status_qos = mqtt_status_qos_value;
+            ESP_LOGI(TAG, "Read 'mqtt_status_qos' = %u", settings->mqtt_status_qos);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_status_qos = 0;  // Default at most once
+            ESP_LOGI(TAG, "No value for 'mqtt_status_qos'; using default = %u", settings->mqtt_status_qos);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_status_qos!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'mqtt_inflight_max' from NVS...");
+    uint8_t mqtt_inflight_max_value;
+    err = nvs_get_u8(settings_handle, "mqtt_inflight", &mqtt_inflight_max_value);
+    switch (err) {
+        case ESP_OK:
+            settings->mqtt_inflight_max = mqtt_inflight_max_value;
+            ESP_LOGI(TAG, "Read 'mqtt_inflight_max' = %u", settings->mqtt_inflight_max);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->mqtt_inflight_max = 8;  // Default in-flight window
+            ESP_LOGI(TAG, "No value for 'mqtt_inflight_max'; using default = %u", settings->mqtt_inflight_max);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading mqtt_inflight_max!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'remote_write_url' from NVS...");
+    err = nvs_get_str(settings_handle, "rw_url", NULL, &str_size);
+    switch (err) {
+        case ESP_OK:
+            settings->remote_write_url = tracked_malloc(ALLOC_SETTINGS, str_size);
+            if (settings->remote_write_url == NULL) {
+                ESP_LOGE(TAG, "Failed to allocate memory for remote_write_url");
+                return ESP_ERR_NO_MEM;
+            }
+            err = nvs_get_str(settings_handle, "rw_url", settings->remote_write_url, &str_size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Error (%s) reading remote_write_url!", esp_err_to_name(err));
+                return err;
+            }
+            ESP_LOGI(TAG, "Read 'remote_write_url' = '%s'", settings->remote_write_url);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->remote_write_url = tracked_strdup(ALLOC_SETTINGS, "");
+            ESP_LOGI(TAG, "No value for 'remote_write_url'; using default = ''");
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading remote_write_url!", esp_err_to_name(err));
+            return err;
+    }
+
+    ESP_LOGI(TAG, "Reading 'remote_write_interval' from NVS...");
+    uint16_t remote_write_interval_value;
+    err = nvs_get_u16(settings_handle, "rw_interval", &remote_write_interval_value);
+    switch (err) {
+        case ESP_OK:
+            settings->remote_write_interval = remote_write_interval_value;
+            ESP_LOGI(TAG, "Read 'remote_write_interval' = %u", settings->remote_write_interval);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            settings->remote_write_interval = 60;  // Default remote_write interval
+            ESP_LOGI(TAG, "No value for 'remote_write_interval'; using default = %u", settings->remote_write_interval);
+            break;
+        default:
+            ESP_LOGE(TAG, "Error (%s) reading remote_write_interval!", esp_err_to_name(err));
+            return err;
+    }
+
     nvs_close(settings_handle);
     return ESP_OK;
 }
@@ -2590,3 +3265,40 @@ const char* settings_get_ds18b20_name(settings_t *settings, uint64_t address) {
     return NULL;
 }
 
+bool settings_get_publish_policy(settings_t *settings, const char *metric_name, const char *device_id,
+                                 publish_policy_t *out) {
+    if (settings == NULL) {
+        return false;
+    }
+    
+    taskENTER_CRITICAL(&publish_policies_lock);
+    // Score: 2 for a metric match, 1 for a device match, -1 if either field conflicts
+    const publish_policy_t *best = NULL;
+    int best_score = -1;
+    for (size_t i = 0; i < settings->publish_policies_count; i++) {
+        const publish_policy_t *policy = &settings->publish_policies[i];
+        int score = 0;
+        if (policy->metric_name[0] != '\0') {
+            if (strcmp(policy->metric_name, metric_name) != 0) {
+                continue;
+            }
+            score += 2;
+        }
+        if (policy->device_id[0] != '\0') {
+            if (strcmp(policy->device_id, device_id) != 0) {
+                continue;
+            }
+            score += 1;
+        }
+        if (score > best_score) {
+            best = policy;
+            best_score = score;
+        }
+    }
+    if (best != NULL) {
+        *out = *best;
+    }
+    taskEXIT_CRITICAL(&publish_policies_lock);
+    
+    return best != NULL;
+}
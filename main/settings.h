@@ -20,6 +20,18 @@ typedef struct {
     char name[32];           // Human-readable name for the device
 } ds18b20_name_t;
 
+// Structure to hold a sensor publish policy. Policies are matched by metric
+// name and device ID; an empty field matches any sensor, and the most
+// specific match wins.
+typedef struct {
+    char metric_name[40];    // Sensor metric name to match (empty = any)
+    char device_id[20];      // Sensor device ID to match (empty = any)
+    float abs_deadband;      // Minimum absolute change to publish (0 = disabled)
+    float rel_deadband;      // Minimum change in percent of last published value (0 = disabled)
+    uint16_t min_interval_s; // Minimum seconds between publishes (0 = disabled)
+    uint16_t heartbeat_s;    // Republish unchanged values after this many seconds (0 = disabled)
+} publish_policy_t;
+
 typedef struct {
     char *update_url;
     char *password;
@@ -37,6 +49,8 @@ typedef struct {
     size_t mac_filters_count;          // Number of MAC address filters
     ds18b20_name_t *ds18b20_names;     // Array of DS18B20 device names
     size_t ds18b20_names_count;        // Number of DS18B20 device names
+    publish_policy_t *publish_policies; // Array of sensor publish policies
+    size_t publish_policies_count;     // Number of sensor publish policies
     int8_t ds18b20_gpio;               // DS18B20 temperature sensor GPIO pin (-1 = disabled)
     int8_t ds18b20_pwr_gpio;           // DS18B20 power GPIO pin (-1 = disabled)
     int8_t weight_dt_gpio;           // HX711 DOUT GPIO pin (-1 = disabled)
@@ -53,6 +67,17 @@ typedef struct {
     char *mqtt_password;               // MQTT password (optional)
     char *mqtt_topic;                  // MQTT topic for sensor updates (default: station/sensor)
     char *mqtt_status_topic;           // MQTT topic for status updates (default: station/status)
+    uint16_t mqtt_batch_window_ms;     // Milliseconds to collect sensor updates into one message (0 = one message per update)
+    uint8_t mqtt_batch_max;            // Most sensors in one batched message (default 16)
+    uint16_t mqtt_offline_max;         // Sensor readings kept while the broker is unreachable (0 = drop them)
+    uint16_t mqtt_replay_rate;         // Buffered readings replayed per second after reconnecting
+    uint8_t mqtt_format;               // Payload encoding, an mqtt_format_t (default JSON)
+    bool mqtt_descriptors;             // Publish names and units once as retained descriptors, not in every reading
+    uint8_t mqtt_sensor_qos;           // QoS of sensor readings and descriptors (0 or 1)
+    uint8_t mqtt_status_qos;           // QoS of status messages (0 or 1)
+    uint8_t mqtt_inflight_max;         // Most QoS 1 messages awaiting PUBACK (default 8)
+    char *remote_write_url;            // Prometheus remote_write endpoint (empty = disabled)
+    uint16_t remote_write_interval;    // Seconds between remote_write pushes (default 60)
 } settings_t;
 
 esp_err_t settings_init(settings_t *settings);
@@ -61,4 +86,20 @@ esp_err_t settings_register(settings_t *settings, httpd_handle_t http_server);
 
 const char* settings_get_ds18b20_name(settings_t *settings, uint64_t address);
 
+/**
+ * @brief Find the publish policy that applies to a sensor
+ * 
+ * A policy matching both metric name and device ID is preferred over one
+ * matching only the metric name, then only the device ID, then a catch-all.
+ * 
+ * @param settings Pointer to settings structure
+ * @param metric_name Sensor metric name (may be empty)
+ * @param device_id Sensor device ID (may be empty)
+ * @param out Destination for a copy of the matching policy, as the settings
+ *            page may replace the policies at any time
+ * @return true if a policy matched, false to publish every update
+ */
+bool settings_get_publish_policy(settings_t *settings, const char *metric_name, const char *device_id,
+                                 publish_policy_t *out);
+
 #endif // SETTINGS_H
\ No newline at end of file
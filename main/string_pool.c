@@ -0,0 +1,104 @@
+#include "string_pool.h"
+#include "tracked_mutex.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+static const char *TAG = "string_pool";
+
+#define STRING_POOL_SIZE CONFIG_SENSORS_STRING_POOL_SIZE
+
+// Open-addressing table of handles used to find existing strings when
+// interning. Power of two; kept at most 3/4 full.
+#define STRING_POOL_HASH_SIZE 512
+
+_Static_assert(STRING_POOL_SIZE <= UINT16_MAX + 1, "string handles are 16-bit offsets");
+
+// Strings are stored back to back with their terminators. Offset 0 holds the
+// empty string, so a zeroed handle is always valid.
+static char pool[STRING_POOL_SIZE];
+static size_t pool_used = 1;
+static size_t pool_count = 0;
+static string_handle_t pool_hash[STRING_POOL_HASH_SIZE];
+static tracked_mutex_t *pool_mutex = NULL;
+
+// FNV-1a over at most len bytes
+static uint32_t string_hash(const char *str, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+esp_err_t string_pool_init(void) {
+    if (pool_mutex == NULL) {
+        pool_mutex = tracked_mutex_create("string_pool");
+        if (pool_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create string pool mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+string_handle_t string_pool_intern(const char *str, size_t max_len) {
+    if (str == NULL || str[0] == '\0' || max_len < 2 || pool_mutex == NULL) {
+        return STRING_HANDLE_EMPTY;
+    }
+
+    size_t len = strnlen(str, max_len - 1);
+    uint32_t slot = string_hash(str, len);
+
+    tracked_mutex_take(pool_mutex, portMAX_DELAY);
+
+    for (;;) {
+        slot &= STRING_POOL_HASH_SIZE - 1;
+        string_handle_t handle = pool_hash[slot];
+        if (handle == STRING_HANDLE_EMPTY) {
+            break;
+        }
+        if (strncmp(&pool[handle], str, len) == 0 && pool[handle + len] == '\0') {
+            tracked_mutex_give(pool_mutex);
+            return handle;
+        }
+        slot++;
+    }
+
+    if (pool_used + len + 1 > STRING_POOL_SIZE || (pool_count + 1) * 4 > STRING_POOL_HASH_SIZE * 3) {
+        tracked_mutex_give(pool_mutex);
+        ESP_LOGE(TAG, "String pool full, dropping '%.*s'", (int)len, str);
+        return STRING_HANDLE_EMPTY;
+    }
+
+    string_handle_t handle = (string_handle_t)pool_used;
+    memcpy(&pool[handle], str, len);
+    pool[handle + len] = '\0';
+    pool_used += len + 1;
+    pool_count++;
+    pool_hash[slot] = handle;
+
+    tracked_mutex_give(pool_mutex);
+    return handle;
+}
+
+const char *string_pool_get(string_handle_t handle) {
+    if (handle >= STRING_POOL_SIZE) {
+        return "";
+    }
+    return &pool[handle];
+}
+
+void string_pool_get_stats(size_t *used, size_t *capacity, size_t *count) {
+    if (used != NULL) {
+        *used = pool_used;
+    }
+    if (capacity != NULL) {
+        *capacity = STRING_POOL_SIZE;
+    }
+    if (count != NULL) {
+        *count = pool_count;
+    }
+}
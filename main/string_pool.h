@@ -0,0 +1,52 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+// Handle to an interned string: its byte offset in the pool
+typedef uint16_t string_handle_t;
+
+// Handle of the empty string; also returned when interning fails
+#define STRING_HANDLE_EMPTY 0
+
+/**
+ * @brief Initialize the string pool
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t string_pool_init(void);
+
+/**
+ * @brief Intern a string, returning a handle shared by all equal strings
+ *
+ * Interned strings are never freed, so only bounded sets of strings (names,
+ * units, labels) should be interned, not per-sample values.
+ *
+ * @param str String to intern (NULL or "" yields STRING_HANDLE_EMPTY)
+ * @param max_len Buffer-style length limit; at most max_len - 1 characters are kept
+ * @return string_handle_t Handle, or STRING_HANDLE_EMPTY if the pool is full
+ */
+string_handle_t string_pool_intern(const char *str, size_t max_len);
+
+/**
+ * @brief Get the string for a handle
+ *
+ * Lock-free; the returned pointer stays valid forever.
+ *
+ * @param handle Handle returned by string_pool_intern
+ * @return const char* The interned string (never NULL)
+ */
+const char *string_pool_get(string_handle_t handle);
+
+/**
+ * @brief Get pool usage
+ *
+ * @param used Bytes in use (can be NULL)
+ * @param capacity Total pool size in bytes (can be NULL)
+ * @param count Number of distinct strings (can be NULL)
+ */
+void string_pool_get_stats(size_t *used, size_t *capacity, size_t *count);
+
+#endif // STRING_POOL_H
@@ -5,13 +5,13 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
-#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_netif.h"
 #include "syslog.h"
 #include "settings.h"
-#include "metrics.h"
+#include "tracked_alloc.h"
+#include "tracked_mutex.h"
 
 static const char *TAG = "syslog";
 
@@ -50,11 +50,11 @@ static char *syslog_packet = NULL;
 
 // Custom log handler for ESP-IDF logging system
 static vprintf_like_t original_vprintf = NULL;
-static SemaphoreHandle_t vprintf_mutex = NULL;
+static tracked_mutex_t *vprintf_mutex = NULL;
 
 static int custom_vprintf(const char *fmt, va_list args) {
     // Take mutex with timeout to prevent deadlocks
-    if (vprintf_mutex && xSemaphoreTake(vprintf_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+    if (vprintf_mutex && !tracked_mutex_take(vprintf_mutex, pdMS_TO_TICKS(10))) {
         // If we can't get the mutex, just return to avoid blocking
         return 0;
     }
@@ -96,7 +96,7 @@ static int custom_vprintf(const char *fmt, va_list args) {
     }
 
     if (vprintf_mutex) {
-        xSemaphoreGive(vprintf_mutex);
+        tracked_mutex_give(vprintf_mutex);
     }
     
     return ret;
@@ -182,16 +182,15 @@ esp_err_t syslog_init(settings_t *settings) {
     
     // Create mutex for vprintf
     if (!vprintf_mutex) {
-        vprintf_mutex = xSemaphoreCreateMutex();
+        vprintf_mutex = tracked_mutex_create("syslog_vprintf");
         if (!vprintf_mutex) {
             ESP_LOGE(TAG, "Failed to create vprintf mutex");
             return ESP_ERR_NO_MEM;
         }
     }
 
-    recv_msg = malloc(sizeof(syslog_msg_t));
-    syslog_packet = malloc(SYSLOG_MAX_MSG_LEN + 100);
-    atomic_fetch_add(&malloc_count_syslog, 2);
+    recv_msg = tracked_malloc(ALLOC_SYSLOG, sizeof(syslog_msg_t));
+    syslog_packet = tracked_malloc(ALLOC_SYSLOG, SYSLOG_MAX_MSG_LEN + 100);
     
     
     // Create message queue
@@ -238,7 +237,7 @@ void syslog_deinit(void) {
     
     // Delete mutex
     if (vprintf_mutex) {
-        vSemaphoreDelete(vprintf_mutex);
+        tracked_mutex_delete(vprintf_mutex);
         vprintf_mutex = NULL;
     }
     
@@ -263,13 +262,11 @@ void syslog_deinit(void) {
     
     g_settings = NULL;
     if (recv_msg != NULL) {
-        free(recv_msg);
-        atomic_fetch_add(&free_count_syslog, 1);
+        tracked_free(ALLOC_SYSLOG, recv_msg);
         recv_msg = NULL;
     }
     if (syslog_packet != NULL) {
-        free(syslog_packet);
-        atomic_fetch_add(&free_count_syslog, 1);
+        tracked_free(ALLOC_SYSLOG, syslog_packet);
         syslog_packet = NULL;
     }
     
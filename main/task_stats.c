@@ -0,0 +1,104 @@
+#include "task_stats.h"
+#include "tracked_mutex.h"
+#include <esp_log.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "task_stats";
+
+// Raw sample and the statistics derived from it. Only the sampler task
+// touches task_status and task_sample; task_stats is published under the mutex.
+static TaskStatus_t task_status[TASK_STATS_MAX_TASKS];
+static task_stats_t task_sample[TASK_STATS_MAX_TASKS];
+static task_stats_t task_stats[TASK_STATS_MAX_TASKS];
+static int task_stats_len = 0;
+static configRUN_TIME_COUNTER_TYPE last_total_runtime = 0;
+static tracked_mutex_t *task_stats_mutex = NULL;
+
+// Runtime of a task in the previous sample, 0 if it's new
+static uint64_t task_last_runtime(uint32_t number) {
+    for (int i = 0; i < task_stats_len; i++) {
+        if (task_stats[i].number == number) {
+            return task_stats[i].runtime_us;
+        }
+    }
+    return 0;
+}
+
+static void task_stats_sample(void) {
+    configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, TASK_STATS_MAX_TASKS, &total_runtime);
+    if (count == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, not sampling", TASK_STATS_MAX_TASKS);
+        return;
+    }
+
+    // The run time counter is wall time while each task's runtime is per core,
+    // so a busy task reaches 100% of its core
+    uint64_t elapsed = total_runtime - last_total_runtime;
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *status = &task_status[i];
+        task_stats_t *sample = &task_sample[i];
+        snprintf(sample->name, sizeof(sample->name), "%s", status->pcTaskName);
+        sample->number = status->xTaskNumber;
+        sample->priority = status->uxCurrentPriority;
+        sample->core = status->xCoreID == tskNO_AFFINITY ? -1 : (int)status->xCoreID;
+        sample->stack_free_min = status->usStackHighWaterMark;
+        sample->runtime_us = status->ulRunTimeCounter;
+        uint64_t used = sample->runtime_us - task_last_runtime(sample->number);
+        sample->cpu_percent = elapsed > 0 ? (float)used * 100.0f / (float)elapsed : 0.0f;
+    }
+
+    tracked_mutex_take(task_stats_mutex, portMAX_DELAY);
+    memcpy(task_stats, task_sample, count * sizeof(task_stats_t));
+    task_stats_len = count;
+    tracked_mutex_give(task_stats_mutex);
+    last_total_runtime = total_runtime;
+}
+
+static void task_stats_task(void *pvParameters) {
+    while (1) {
+        task_stats_sample();
+        vTaskDelay(pdMS_TO_TICKS(TASK_STATS_INTERVAL_SECONDS * 1000));
+    }
+}
+
+esp_err_t task_stats_init(void) {
+    if (task_stats_mutex != NULL) {
+        return ESP_OK;
+    }
+    task_stats_mutex = tracked_mutex_create("task_stats");
+    if (task_stats_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create task stats mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(task_stats_task, "task_stats", 3072, NULL, 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task stats task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int task_stats_count(void) {
+    if (task_stats_mutex == NULL) {
+        return 0;
+    }
+    tracked_mutex_take(task_stats_mutex, portMAX_DELAY);
+    int count = task_stats_len;
+    tracked_mutex_give(task_stats_mutex);
+    return count;
+}
+
+bool task_stats_get(int index, task_stats_t *stats) {
+    if (task_stats_mutex == NULL) {
+        return false;
+    }
+    tracked_mutex_take(task_stats_mutex, portMAX_DELAY);
+    bool found = index >= 0 && index < task_stats_len;
+    if (found) {
+        *stats = task_stats[index];
+    }
+    tracked_mutex_give(task_stats_mutex);
+    return found;
+}
@@ -0,0 +1,47 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+
+#define TASK_STATS_MAX_TASKS 40
+#define TASK_STATS_INTERVAL_SECONDS 10
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t number;            // FreeRTOS task number, unique per task
+    uint32_t priority;          // Current priority
+    int core;                   // Core the task is pinned to, or -1
+    uint32_t stack_free_min;    // Stack high-water mark: least free stack seen, in bytes
+    uint64_t runtime_us;        // CPU time since boot
+    float cpu_percent;          // CPU use over the last interval, percent of one core
+} task_stats_t;
+
+/**
+ * @brief Start sampling task statistics every TASK_STATS_INTERVAL_SECONDS
+ *
+ * Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t task_stats_init(void);
+
+/**
+ * @brief Get the number of tasks in the last sample
+ *
+ * @return int Number of tasks
+ */
+int task_stats_count(void);
+
+/**
+ * @brief Copy one task's statistics from the last sample
+ *
+ * @param index Index in the sample, below task_stats_count()
+ * @param stats Receives the statistics
+ * @return true if index was in range
+ */
+bool task_stats_get(int index, task_stats_t *stats);
+
+#endif // TASK_STATS_H
@@ -17,6 +17,13 @@
 
 #define EXAMPLE_ONEWIRE_MAX_DS18B20 5
 
+// Measurement IDs for sensor keys; the device part is the 1-Wire address
+#define TEMPERATURE_METRIC_C 0
+#define TEMPERATURE_METRIC_F 1
+
+// The bus is read about once a second
+#define TEMPERATURE_SENSOR_TIMEOUT_SECONDS 60
+
 static const char *TAG = "ds18b20";
 static int ds18b20_device_num = 0;
 
@@ -154,16 +161,23 @@ void init_ds18b20(settings_t *settings) {
                          (uint8_t)(address >> 40), (uint8_t)(address >> 32), (uint8_t)(address >> 24),
                          (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)(address >> 0));
                 
+                // Key by 1-Wire address so a rescan reuses the existing slots
+                sensor_key_t key_c = { .device = address, .metric = TEMPERATURE_METRIC_C };
+                sensor_key_t key_f = { .device = address, .metric = TEMPERATURE_METRIC_F };
                 if (settings->temp_use_fahrenheit) {
-                    ds18b20s[ds18b20_device_num].sensor_id_f = sensors_register(
-                        "Temperature", unit, NULL, NULL, NULL);
-                    ds18b20s[ds18b20_device_num].sensor_id_c = sensors_register(
-                        NULL, NULL, "temperature", device_name ? device_name : addr_str, addr_str);
+                    ds18b20s[ds18b20_device_num].sensor_id_f = sensors_register_with_key(
+                        key_f, "Temperature", unit, NULL, NULL, NULL);
+                    ds18b20s[ds18b20_device_num].sensor_id_c = sensors_register_with_key(
+                        key_c, NULL, NULL, "temperature", device_name ? device_name : addr_str, addr_str);
                 } else {
-                    ds18b20s[ds18b20_device_num].sensor_id_c = sensors_register(
-                        "Temperature", unit, "temperature", device_name ? device_name : addr_str, addr_str);
+                    ds18b20s[ds18b20_device_num].sensor_id_c = sensors_register_with_key(
+                        key_c, "Temperature", unit, "temperature", device_name ? device_name : addr_str, addr_str);
                     ds18b20s[ds18b20_device_num].sensor_id_f = -1;
                 }
+                sensors_set_timeout(ds18b20s[ds18b20_device_num].sensor_id_c, TEMPERATURE_SENSOR_TIMEOUT_SECONDS);
+                sensors_set_timeout(ds18b20s[ds18b20_device_num].sensor_id_f, TEMPERATURE_SENSOR_TIMEOUT_SECONDS);
+                sensors_set_producer(ds18b20s[ds18b20_device_num].sensor_id_c, SENSOR_PRODUCER_DS18B20);
+                sensors_set_producer(ds18b20s[ds18b20_device_num].sensor_id_f, SENSOR_PRODUCER_DS18B20);
                 
                 if (device_name && strlen(device_name) > 0) {
                     ESP_LOGI(TAG, "Found a DS18B20[%d] '%s', address: %016llX", ds18b20_device_num, device_name, address);
@@ -0,0 +1,119 @@
+#include "tracked_alloc.h"
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+const uint32_t alloc_size_buckets_bytes[ALLOC_SIZE_BUCKETS] = {
+    16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192,
+};
+
+static const char *module_names[ALLOC_MODULE_COUNT] = {
+#define TRACKED_ALLOC_NAME(id, name) [ALLOC_##id] = name,
+    TRACKED_ALLOC_MODULES(TRACKED_ALLOC_NAME)
+#undef TRACKED_ALLOC_NAME
+};
+
+// Byte counts come from the heap's own block sizes, so a free always
+// subtracts what its allocation added, and memory a library allocated can
+// be adopted. The spinlock keeps each module's counters consistent.
+static alloc_stats_t module_stats[ALLOC_MODULE_COUNT];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int size_bucket(size_t size) {
+    int bucket = 0;
+    while (bucket < ALLOC_SIZE_BUCKETS && size > alloc_size_buckets_bytes[bucket]) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void record_alloc(alloc_module_t module, void *ptr, size_t requested) {
+    size_t size = heap_caps_get_allocated_size(ptr);
+    int bucket = size_bucket(requested);
+    alloc_stats_t *stats = &module_stats[module];
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats->allocs++;
+    stats->bytes += size;
+    stats->requested_bytes += requested;
+    stats->live_bytes += size;
+    if (stats->live_bytes > stats->peak_live_bytes) {
+        stats->peak_live_bytes = stats->live_bytes;
+    }
+    stats->size_buckets[bucket]++;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+// Takes the size measured before the block was released
+static void record_free(alloc_module_t module, size_t size) {
+    alloc_stats_t *stats = &module_stats[module];
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats->frees++;
+    stats->live_bytes -= size;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+void *tracked_malloc(alloc_module_t module, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr != NULL) {
+        record_alloc(module, ptr, size);
+    }
+    return ptr;
+}
+
+void *tracked_calloc(alloc_module_t module, size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (ptr != NULL) {
+        record_alloc(module, ptr, count * size);
+    }
+    return ptr;
+}
+
+void *tracked_realloc(alloc_module_t module, void *ptr, size_t size) {
+    size_t old_size = ptr != NULL ? heap_caps_get_allocated_size(ptr) : 0;
+    void *grown = realloc(ptr, size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    // Accounted as freeing the old block and allocating the new one
+    if (ptr != NULL) {
+        record_free(module, old_size);
+    }
+    record_alloc(module, grown, size);
+    return grown;
+}
+
+char *tracked_strdup(alloc_module_t module, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = tracked_malloc(module, len);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void tracked_adopt(alloc_module_t module, void *ptr) {
+    if (ptr != NULL) {
+        record_alloc(module, ptr, heap_caps_get_allocated_size(ptr));
+    }
+}
+
+void tracked_free(alloc_module_t module, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    record_free(module, heap_caps_get_allocated_size(ptr));
+    free(ptr);
+}
+
+const char *tracked_alloc_module_name(alloc_module_t module) {
+    return module < ALLOC_MODULE_COUNT ? module_names[module] : "";
+}
+
+void tracked_alloc_get_stats(alloc_module_t module, alloc_stats_t *stats) {
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = module_stats[module];
+    taskEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,115 @@
+#ifndef TRACKED_ALLOC_H
+#define TRACKED_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Modules whose heap use is accounted; each gets an ALLOC_<id> tag and is
+// exported on /metrics under its name
+#define TRACKED_ALLOC_MODULES(X) \
+    X(SETTINGS, "settings") \
+    X(METRICS, "metrics") \
+    X(SENSORS, "sensors") \
+    X(PUMP, "pump") \
+    X(MAIN, "main") \
+    X(HTTP_SERVER, "http_server") \
+    X(SYSLOG, "syslog") \
+    X(MQTT_PUBLISHER, "mqtt_publisher") \
+    X(SENSOR_HISTORY, "sensor_history") \
+    X(REMOTE_WRITE, "remote_write")
+
+typedef enum {
+#define TRACKED_ALLOC_ENUM(id, name) ALLOC_##id,
+    TRACKED_ALLOC_MODULES(TRACKED_ALLOC_ENUM)
+#undef TRACKED_ALLOC_ENUM
+    ALLOC_MODULE_COUNT
+} alloc_module_t;
+
+// Upper bounds of the requested-size histogram buckets; a final +Inf bucket
+// catches the rest
+#define ALLOC_SIZE_BUCKETS 10
+extern const uint32_t alloc_size_buckets_bytes[ALLOC_SIZE_BUCKETS];
+
+typedef struct {
+    uint32_t allocs;            // Successful allocations; a realloc counts as a free and an allocation
+    uint32_t frees;
+    uint64_t bytes;             // Bytes allocated, including heap block rounding
+    uint64_t requested_bytes;   // Bytes asked for
+    uint32_t live_bytes;
+    uint32_t peak_live_bytes;
+    uint32_t size_buckets[ALLOC_SIZE_BUCKETS + 1];  // Requested sizes, non-cumulative; last is +Inf
+} alloc_stats_t;
+
+/**
+ * @brief Allocate memory accounted to a module
+ *
+ * @param module Module tag
+ * @param size Bytes to allocate
+ * @return void* Memory, or NULL
+ */
+void *tracked_malloc(alloc_module_t module, size_t size);
+
+/**
+ * @brief Allocate zeroed memory accounted to a module
+ *
+ * @param module Module tag
+ * @param count Number of elements
+ * @param size Size of each element
+ * @return void* Memory, or NULL
+ */
+void *tracked_calloc(alloc_module_t module, size_t count, size_t size);
+
+/**
+ * @brief Resize memory accounted to a module
+ *
+ * @param module Module tag; must match the one ptr was allocated with
+ * @param ptr Memory to resize (can be NULL)
+ * @param size New size
+ * @return void* Resized memory, or NULL with ptr left untouched
+ */
+void *tracked_realloc(alloc_module_t module, void *ptr, size_t size);
+
+/**
+ * @brief Duplicate a string into memory accounted to a module
+ *
+ * @param module Module tag
+ * @param str String to copy
+ * @return char* Copy, or NULL
+ */
+char *tracked_strdup(alloc_module_t module, const char *str);
+
+/**
+ * @brief Account memory a library allocated with malloc (asprintf, cJSON) to a module
+ *
+ * Lets the caller release it with tracked_free.
+ *
+ * @param module Module tag
+ * @param ptr Memory (can be NULL)
+ */
+void tracked_adopt(alloc_module_t module, void *ptr);
+
+/**
+ * @brief Free memory accounted to a module
+ *
+ * @param module Module tag; must match the one ptr was allocated with
+ * @param ptr Memory to free (can be NULL)
+ */
+void tracked_free(alloc_module_t module, void *ptr);
+
+/**
+ * @brief Get the name of a module, as exported on /metrics
+ *
+ * @param module Module tag
+ * @return const char* Name
+ */
+const char *tracked_alloc_module_name(alloc_module_t module);
+
+/**
+ * @brief Get a consistent snapshot of a module's allocation statistics
+ *
+ * @param module Module tag
+ * @param stats Receives the statistics
+ */
+void tracked_alloc_get_stats(alloc_module_t module, alloc_stats_t *stats);
+
+#endif // TRACKED_ALLOC_H
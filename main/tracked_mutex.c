@@ -0,0 +1,113 @@
+#include "tracked_mutex.h"
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+struct tracked_mutex {
+    SemaphoreHandle_t handle;
+    int64_t taken_us;           // When the holder took it
+    tracked_mutex_stats_t stats;
+};
+
+// Slots are never freed, so stats outlive a delete and re-create. Nothing
+// here logs: syslog's vprintf hook takes one of these locks.
+static struct tracked_mutex mutexes[TRACKED_MUTEX_MAX];
+static int mutex_count = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+tracked_mutex_t *tracked_mutex_create(const char *name) {
+    SemaphoreHandle_t handle = xSemaphoreCreateMutex();
+    if (handle == NULL) {
+        return NULL;
+    }
+
+    tracked_mutex_t *mutex = NULL;
+    taskENTER_CRITICAL(&stats_lock);
+    for (int i = 0; i < mutex_count; i++) {
+        if (strcmp(mutexes[i].stats.name, name) == 0 && mutexes[i].handle == NULL) {
+            mutex = &mutexes[i];
+            break;
+        }
+    }
+    if (mutex == NULL && mutex_count < TRACKED_MUTEX_MAX) {
+        mutex = &mutexes[mutex_count++];
+        mutex->stats.name = name;
+    }
+    if (mutex != NULL) {
+        mutex->handle = handle;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (mutex == NULL) {
+        vSemaphoreDelete(handle);
+    }
+    return mutex;
+}
+
+void tracked_mutex_delete(tracked_mutex_t *mutex) {
+    if (mutex == NULL) {
+        return;
+    }
+    SemaphoreHandle_t handle = mutex->handle;
+    taskENTER_CRITICAL(&stats_lock);
+    mutex->handle = NULL;
+    taskEXIT_CRITICAL(&stats_lock);
+    vSemaphoreDelete(handle);
+}
+
+bool tracked_mutex_take(tracked_mutex_t *mutex, TickType_t timeout) {
+    // Uncontended takes only cost the try
+    if (xSemaphoreTake(mutex->handle, 0) == pdTRUE) {
+        mutex->taken_us = esp_timer_get_time();
+        taskENTER_CRITICAL(&stats_lock);
+        mutex->stats.acquisitions++;
+        taskEXIT_CRITICAL(&stats_lock);
+        return true;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    bool taken = timeout > 0 && xSemaphoreTake(mutex->handle, timeout) == pdTRUE;
+    int64_t now_us = esp_timer_get_time();
+    uint32_t wait_us = (uint32_t)(now_us - start_us);
+    if (taken) {
+        mutex->taken_us = now_us;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    mutex->stats.contended++;
+    if (taken) {
+        mutex->stats.acquisitions++;
+    } else {
+        mutex->stats.timeouts++;
+    }
+    mutex->stats.wait_us += wait_us;
+    if (wait_us > mutex->stats.wait_max_us) {
+        mutex->stats.wait_max_us = wait_us;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    return taken;
+}
+
+void tracked_mutex_give(tracked_mutex_t *mutex) {
+    uint32_t hold_us = (uint32_t)(esp_timer_get_time() - mutex->taken_us);
+
+    taskENTER_CRITICAL(&stats_lock);
+    mutex->stats.hold_us += hold_us;
+    if (hold_us > mutex->stats.hold_max_us) {
+        mutex->stats.hold_max_us = hold_us;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    xSemaphoreGive(mutex->handle);
+}
+
+bool tracked_mutex_get_stats(int index, tracked_mutex_stats_t *stats) {
+    bool found = false;
+    taskENTER_CRITICAL(&stats_lock);
+    if (index >= 0 && index < mutex_count) {
+        *stats = mutexes[index].stats;
+        found = true;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    return found;
+}
@@ -0,0 +1,65 @@
+#ifndef TRACKED_MUTEX_H
+#define TRACKED_MUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+
+// Most named locks; locks created with a name already in use share its slot
+#define TRACKED_MUTEX_MAX 16
+
+// A FreeRTOS mutex that records how long tasks wait for it and hold it
+typedef struct tracked_mutex tracked_mutex_t;
+
+typedef struct {
+    const char *name;
+    uint32_t acquisitions;      // Successful takes
+    uint32_t contended;         // Takes that found the lock held and had to wait
+    uint32_t timeouts;          // Takes that gave up
+    uint64_t wait_us;           // Time spent waiting in contended takes
+    uint32_t wait_max_us;
+    uint64_t hold_us;           // Time between take and give
+    uint32_t hold_max_us;
+} tracked_mutex_stats_t;
+
+/**
+ * @brief Create a mutex whose contention is exported on /metrics
+ *
+ * @param name Lock name, as exported; must be a string literal
+ * @return tracked_mutex_t* Mutex, or NULL if out of memory or slots
+ */
+tracked_mutex_t *tracked_mutex_create(const char *name);
+
+/**
+ * @brief Delete a mutex; its statistics are kept
+ *
+ * @param mutex Mutex (can be NULL)
+ */
+void tracked_mutex_delete(tracked_mutex_t *mutex);
+
+/**
+ * @brief Take a mutex, as xSemaphoreTake
+ *
+ * @param mutex Mutex
+ * @param timeout Ticks to wait
+ * @return true if taken
+ */
+bool tracked_mutex_take(tracked_mutex_t *mutex, TickType_t timeout);
+
+/**
+ * @brief Give a mutex taken by this task
+ *
+ * @param mutex Mutex
+ */
+void tracked_mutex_give(tracked_mutex_t *mutex);
+
+/**
+ * @brief Get a consistent snapshot of a lock's statistics
+ *
+ * @param index Lock index, from 0
+ * @param stats Receives the statistics
+ * @return true if index names a lock
+ */
+bool tracked_mutex_get_stats(int index, tracked_mutex_stats_t *stats);
+
+#endif // TRACKED_MUTEX_H
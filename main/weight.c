@@ -13,6 +13,9 @@
 #include "sensors.h"
 #include "settings.h"
 
+// Readings arrive every 500 ms; allow for a few slow HX711 conversions
+#define WEIGHT_SENSOR_TIMEOUT_SECONDS 30
+
 static const char *TAG = "hx711";
 
 // Global variable to store the latest weight reading
@@ -149,6 +152,10 @@ void weight_init(settings_t *settings)
     // Register weight sensors
     sensor_id_grams = sensors_register("Weight", "g", "weight_grams", NULL, NULL);
     sensor_id_lbs = sensors_register("Weight", "lbs", NULL, NULL, NULL);
+    sensors_set_timeout(sensor_id_grams, WEIGHT_SENSOR_TIMEOUT_SECONDS);
+    sensors_set_timeout(sensor_id_lbs, WEIGHT_SENSOR_TIMEOUT_SECONDS);
+    sensors_set_producer(sensor_id_grams, SENSOR_PRODUCER_WEIGHT);
+    sensors_set_producer(sensor_id_lbs, SENSOR_PRODUCER_WEIGHT);
     
     // Start the weight reading task
     xTaskCreate(weight, "weight", configMINIMAL_STACK_SIZE * 5, settings, 5, NULL);
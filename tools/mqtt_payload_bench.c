@@ -0,0 +1,104 @@
+// Host benchmark of MQTT payload encodings: size and encode time of the
+// messages mqtt_publisher.c builds, as JSON and CBOR, with and without
+// retained descriptors.
+//
+//     cc -O2 -Imain tools/mqtt_payload_bench.c main/mqtt_payload.c -o mqtt_payload_bench
+//     ./mqtt_payload_bench
+//
+// Host timings only show the relative cost; on the ESP32 JSON is slower still,
+// as %.2f formats a double in software.
+
+#include "mqtt_payload.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS 200000
+#define BATCH_SENSORS 16
+
+static const mqtt_payload_sensor_t sensors[] = {
+    { "temperature_celsius", "Greenhouse Temperature", "°C", "Greenhouse", "A4:C1:38:0B:5E:21", 21.37f, 0 },
+    { "humidity_percent", "Greenhouse Humidity", "%", "Greenhouse", "A4:C1:38:0B:5E:21", 64.5f, 0 },
+    { "battery_percent", "Greenhouse Battery", "%", "Greenhouse", "A4:C1:38:0B:5E:21", 87.0f, 0 },
+    { "weight_grams", "Water Tank", "g", "", "", 18234.25f, 0 },
+};
+#define SENSOR_COUNT (sizeof(sensors) / sizeof(sensors[0]))
+
+static const int64_t timestamp_ms = 1760611200123LL;
+
+// As mqtt_publish_sensor_data
+static size_t encode_single(uint8_t *buf, size_t size, mqtt_format_t format, int i, bool metadata) {
+    mqtt_payload_sensor_t sensor = sensors[i % SENSOR_COUNT];
+    mqtt_payload_t p;
+    mqtt_payload_begin(&p, buf, size, format);
+    mqtt_payload_object_begin(&p, NULL);
+    mqtt_payload_int(&p, "timestamp", timestamp_ms / 1000);
+    mqtt_payload_int(&p, "timestamp_ms", timestamp_ms);
+    mqtt_payload_string(&p, "hostname", "station");
+    mqtt_payload_sensor(&p, "sensor", &sensor, metadata);
+    mqtt_payload_object_end(&p);
+    return mqtt_payload_ok(&p) ? p.len : 0;
+}
+
+// As mqtt_batch_flush
+static size_t encode_batch(uint8_t *buf, size_t size, mqtt_format_t format, int i, bool metadata) {
+    mqtt_payload_t p;
+    mqtt_payload_begin(&p, buf, size, format);
+    mqtt_payload_object_begin(&p, NULL);
+    mqtt_payload_int(&p, "timestamp", timestamp_ms / 1000);
+    mqtt_payload_int(&p, "timestamp_ms", timestamp_ms);
+    mqtt_payload_string(&p, "hostname", "station");
+    mqtt_payload_array_begin(&p, "sensors");
+    for (int j = 0; j < BATCH_SENSORS; j++) {
+        mqtt_payload_sensor_t sensor = sensors[(i + j) % SENSOR_COUNT];
+        sensor.timestamp_ms = timestamp_ms - j;
+        mqtt_payload_sensor(&p, NULL, &sensor, metadata);
+    }
+    mqtt_payload_array_end(&p);
+    mqtt_payload_object_end(&p);
+    return mqtt_payload_ok(&p) ? p.len : 0;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *message, size_t (*encode)(uint8_t *, size_t, mqtt_format_t, int, bool)) {
+    static const struct {
+        const char *name;
+        mqtt_format_t format;
+        bool metadata;
+    } variants[] = {
+        { "json", MQTT_FORMAT_JSON, true },
+        { "json+descriptors", MQTT_FORMAT_JSON, false },
+        { "cbor", MQTT_FORMAT_CBOR, true },
+        { "cbor+descriptors", MQTT_FORMAT_CBOR, false },
+    };
+    static uint8_t buf[8192];
+    double base_bytes = 0, base_ns = 0;
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        size_t bytes = 0;
+        double start = now_ns();
+        for (int i = 0; i < ITERATIONS; i++) {
+            bytes += encode(buf, sizeof(buf), variants[v].format, i, variants[v].metadata);
+        }
+        double ns = (now_ns() - start) / ITERATIONS;
+        double avg_bytes = (double)bytes / ITERATIONS;
+        if (v == 0) {
+            base_bytes = avg_bytes;
+            base_ns = ns;
+        }
+        printf("%-7s %-17s %7.1f bytes (%5.1f%%) %8.1f ns (%5.1f%%)\n", message, variants[v].name,
+               avg_bytes, 100 * avg_bytes / base_bytes, ns, 100 * ns / base_ns);
+    }
+}
+
+int main(void) {
+    printf("%d iterations; percentages relative to JSON\n", ITERATIONS);
+    bench("sensor", encode_single);
+    bench("batch", encode_batch);
+    return 0;
+}
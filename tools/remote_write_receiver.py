@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Minimal Prometheus remote_write receiver for testing the push exporter.
+
+Accepts snappy-compressed WriteRequest POSTs and prints each sample. Uses only
+the standard library.
+
+    python3 tools/remote_write_receiver.py --port 9201
+
+then set the station's Remote Write URL to http://<this host>:9201/api/v1/write.
+--status makes every request fail with that HTTP status, to exercise retries.
+"""
+
+import argparse
+import datetime
+import http.server
+import struct
+
+
+def read_varint(data, pos):
+    result = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        result |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return result, pos
+        shift += 7
+
+
+def snappy_decompress(data):
+    length, pos = read_varint(data, 0)
+    out = bytearray()
+    while pos < len(data):
+        tag = data[pos]
+        pos += 1
+        kind = tag & 3
+        if kind == 0:
+            size = tag >> 2
+            if size >= 60:
+                extra = size - 59
+                size = int.from_bytes(data[pos:pos + extra], "little")
+                pos += extra
+            size += 1
+            out += data[pos:pos + size]
+            pos += size
+            continue
+        if kind == 1:
+            size = ((tag >> 2) & 7) + 4
+            offset = ((tag >> 5) << 8) | data[pos]
+            pos += 1
+        elif kind == 2:
+            size = (tag >> 2) + 1
+            offset = int.from_bytes(data[pos:pos + 2], "little")
+            pos += 2
+        else:
+            size = (tag >> 2) + 1
+            offset = int.from_bytes(data[pos:pos + 4], "little")
+            pos += 4
+        if offset == 0 or offset > len(out):
+            raise ValueError("bad copy offset %d" % offset)
+        for _ in range(size):
+            out.append(out[-offset])
+    if len(out) != length:
+        raise ValueError("decompressed %d bytes, expected %d" % (len(out), length))
+    return bytes(out)
+
+
+def parse_fields(data):
+    """Yield (field number, value) for a protobuf message."""
+    pos = 0
+    while pos < len(data):
+        key, pos = read_varint(data, pos)
+        field, wire_type = key >> 3, key & 7
+        if wire_type == 0:
+            value, pos = read_varint(data, pos)
+        elif wire_type == 1:
+            value = data[pos:pos + 8]
+            pos += 8
+        elif wire_type == 2:
+            size, pos = read_varint(data, pos)
+            value = data[pos:pos + size]
+            pos += size
+        elif wire_type == 5:
+            value = data[pos:pos + 4]
+            pos += 4
+        else:
+            raise ValueError("unsupported wire type %d" % wire_type)
+        yield field, value
+
+
+def parse_write_request(data):
+    """Return [(labels, [(timestamp_ms, value)])] from a WriteRequest."""
+    series = []
+    for field, timeseries in parse_fields(data):
+        if field != 1:
+            continue
+        labels = []
+        samples = []
+        for ts_field, value in parse_fields(timeseries):
+            if ts_field == 1:
+                label = dict(parse_fields(value))
+                labels.append((label.get(1, b"").decode(), label.get(2, b"").decode()))
+            elif ts_field == 2:
+                sample = dict(parse_fields(value))
+                samples.append((sample.get(2, 0), struct.unpack("<d", sample.get(1, bytes(8)))[0]))
+        names = [name for name, _ in labels]
+        if names != sorted(names):
+            raise ValueError("labels not sorted: %s" % names)
+        series.append((labels, samples))
+    return series
+
+
+def format_series(labels):
+    name = dict(labels).get("__name__", "")
+    rest = ",".join('%s="%s"' % (k, v) for k, v in labels if k != "__name__")
+    return "%s{%s}" % (name, rest)
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    status = 204
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        if self.status != 204:
+            self.send_response(self.status)
+            self.end_headers()
+            print("%s: %d bytes, answered %d" % (self.client_address[0], len(body), self.status))
+            return
+        try:
+            if self.headers.get("Content-Encoding") != "snappy":
+                raise ValueError("missing Content-Encoding: snappy")
+            series = parse_write_request(snappy_decompress(body))
+        except (ValueError, IndexError, struct.error) as e:
+            self.send_response(400)
+            self.end_headers()
+            self.wfile.write(str(e).encode())
+            print("%s: rejected: %s" % (self.client_address[0], e))
+            return
+        self.send_response(204)
+        self.end_headers()
+
+        now = datetime.datetime.now().isoformat(timespec="seconds")
+        print("%s %s: %d bytes, %d series" % (now, self.client_address[0], len(body), len(series)))
+        for labels, samples in series:
+            for timestamp_ms, value in samples:
+                print("  %s %g @%d" % (format_series(labels), value, timestamp_ms))
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9201)
+    parser.add_argument("--status", type=int, default=204, help="HTTP status to answer with")
+    args = parser.parse_args()
+
+    Handler.status = args.status
+    server = http.server.ThreadingHTTPServer(("", args.port), Handler)
+    print("Listening on :%d" % args.port)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
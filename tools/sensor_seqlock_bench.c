@@ -0,0 +1,177 @@
+// Host benchmark of sensor registry contention: producer update latency
+// while reader threads scrape every sensor, with readers taking the writers'
+// mutex (the old sensors_get_value/sensors_data_handler path) versus copying
+// through the per-sensor seqlock as sensors_read_snapshot does.
+//
+//     cc -O2 -pthread tools/sensor_seqlock_bench.c -o sensor_seqlock_bench
+//     ./sensor_seqlock_bench
+//
+// Host timings only show the relative cost. Readers only block producers
+// when they run in parallel, so run it on a host with at least
+// READERS + PRODUCERS cores; on one core the tails are scheduler noise.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SENSORS 32
+#define PRODUCERS 2
+#define READERS 2
+#define UPDATES 200000          // Per producer
+#define SNAPSHOT_SPIN_LIMIT 8   // As SENSOR_SNAPSHOT_SPIN_LIMIT
+
+// As sensor_state_t plus the link URL a snapshot copies
+typedef struct {
+    float value;
+    int64_t updated_us;
+    bool available;
+    char link_url[64];
+} slot_t;
+
+static slot_t slots[SENSORS];
+static atomic_uint seq[SENSORS];
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool running;
+static atomic_ulong reads;
+static bool use_seqlock;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// As sensors_update_with_link: writers serialize on the mutex and bump the
+// sequence counter around the modification
+static void update(int id, float value) {
+    pthread_mutex_lock(&mutex);
+    atomic_fetch_add_explicit(&seq[id], 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slots[id].value = value;
+    slots[id].updated_us = now_ns() / 1000;
+    slots[id].available = true;
+    snprintf(slots[id].link_url, sizeof(slots[id].link_url), "/tare?raw=%d", (int)value);
+    atomic_fetch_add_explicit(&seq[id], 1, memory_order_release);
+    pthread_mutex_unlock(&mutex);
+}
+
+// As sensors_read_snapshot
+static void read_seqlock(int id, slot_t *out) {
+    for (int attempt = 1; ; attempt++) {
+        unsigned int start = atomic_load_explicit(&seq[id], memory_order_acquire);
+        if ((start & 1) == 0) {
+            memcpy(out, &slots[id], sizeof(*out));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&seq[id], memory_order_relaxed) == start) {
+                return;
+            }
+        }
+        if (attempt % SNAPSHOT_SPIN_LIMIT == 0) {
+            sched_yield();
+        }
+    }
+}
+
+// Format one sensor as the /sensors/data handler does
+static size_t render(char *buf, size_t size, int id, const slot_t *slot) {
+    return snprintf(buf, size, "{\"id\":%d,\"value\":%.2f,\"updated\":%lld,\"available\":%s,\"link\":\"%s\"},",
+                    id, slot->value, (long long)slot->updated_us, slot->available ? "true" : "false",
+                    slot->link_url);
+}
+
+// Baseline: the scrape holds the mutex for the whole render
+static void scrape_mutex(char *buf, size_t size) {
+    size_t len = 0;
+    pthread_mutex_lock(&mutex);
+    for (int id = 0; id < SENSORS && len < size; id++) {
+        len += render(buf + len, size - len, id, &slots[id]);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+// Each sensor is copied through the seqlock, then rendered unlocked
+static void scrape_seqlock(char *buf, size_t size) {
+    size_t len = 0;
+    for (int id = 0; id < SENSORS && len < size; id++) {
+        slot_t copy;
+        read_seqlock(id, &copy);
+        len += render(buf + len, size - len, id, &copy);
+    }
+}
+
+static void *reader(void *arg) {
+    (void)arg;
+    char buf[SENSORS * 160];
+    while (atomic_load(&running)) {
+        if (use_seqlock) {
+            scrape_seqlock(buf, sizeof(buf));
+        } else {
+            scrape_mutex(buf, sizeof(buf));
+        }
+        atomic_fetch_add(&reads, 1);
+    }
+    return NULL;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void *producer(void *arg) {
+    int64_t *latency_ns = arg;
+    unsigned int rng = (unsigned int)(uintptr_t)arg;
+    for (int i = 0; i < UPDATES; i++) {
+        int id = rand_r(&rng) % SENSORS;
+        int64_t start = now_ns();
+        update(id, (float)i);
+        latency_ns[i] = now_ns() - start;
+    }
+    return NULL;
+}
+
+static void bench(const char *name, bool seqlock, int readers) {
+    static int64_t latency_ns[PRODUCERS][UPDATES];
+    pthread_t reader_threads[READERS], producer_threads[PRODUCERS];
+
+    use_seqlock = seqlock;
+    atomic_store(&running, true);
+    atomic_store(&reads, 0);
+    for (int r = 0; r < readers; r++) {
+        pthread_create(&reader_threads[r], NULL, reader, NULL);
+    }
+    int64_t start = now_ns();
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_create(&producer_threads[p], NULL, producer, latency_ns[p]);
+    }
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(producer_threads[p], NULL);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    atomic_store(&running, false);
+    for (int r = 0; r < readers; r++) {
+        pthread_join(reader_threads[r], NULL);
+    }
+
+    // Producers' latencies are contiguous, so sort them as one array
+    int64_t *all = &latency_ns[0][0];
+    size_t count = (size_t)PRODUCERS * UPDATES;
+    qsort(all, count, sizeof(*all), compare_ns);
+    printf("%-8s %d readers: p50 %6.0f ns  p99 %6.0f ns  p99.9 %8.0f ns  max %10.0f ns  %8.0f scrapes/s\n",
+           name, readers, (double)all[count / 2], (double)all[count * 99 / 100],
+           (double)all[count * 999 / 1000], (double)all[count - 1], atomic_load(&reads) / seconds);
+}
+
+int main(void) {
+    printf("%d producers x %d updates of %d sensors; producer update latency\n",
+           PRODUCERS, UPDATES, SENSORS);
+    bench("idle", true, 0);
+    bench("mutex", false, READERS);
+    bench("seqlock", true, READERS);
+    return 0;
+}